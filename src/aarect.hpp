@@ -3,6 +3,20 @@
 
 #include "rtweekend.hpp"
 #include "hittable.hpp"
+#include "material.hpp"
+
+// Solid angle density of sampling direction v from o by picking a uniform
+// point on the rectangle, shared by all three axis-aligned orientations.
+inline double rect_pdf_value(const hittable& rect, const point3& o, const vec3& v) {
+  hit_record rec;
+  if (!rect.hit(ray(o, v), 0.001, infinity, rec))
+    return 0;
+
+  auto distance_squared = rec.t * rec.t * v.length_squared();
+  auto cosine = fabs(dot(v, rec.normal) / v.length());
+
+  return distance_squared / (cosine * rect.area());
+}
 
 class xy_rect : public hittable {
 public:
@@ -12,6 +26,7 @@ public:
     x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
   virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override;
 
   virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
     // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -20,6 +35,33 @@ public:
     return true;
   }
 
+  virtual double pdf_value(const point3& o, const vec3& v) const override {
+    return rect_pdf_value(*this, o, v);
+  }
+
+  virtual vec3 random(const point3& o) const override {
+    return point3(random_double(x0,x1), random_double(y0,y1), k) - o;
+  }
+
+  virtual bool is_light() const override { return mp->is_emitter(); }
+  virtual double area() const override { return (x1-x0)*(y1-y0); }
+
+  virtual bool sample_surface(double u1, double u2, double time, hit_record& rec) const override {
+    auto x = x0 + u1*(x1-x0);
+    auto y = y0 + u2*(y1-y0);
+    rec.p = point3(x, y, k);
+    rec.normal = vec3(0, 0, 1);
+    rec.front_face = true;
+    rec.u = u1;
+    rec.v = u2;
+    rec.mat_ptr = mp;
+    return true;
+  }
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    slots.push_back(&mp);
+  }
+
 public:
   double x0, x1, y0, y1, k;
   shared_ptr<material> mp;
@@ -34,6 +76,7 @@ public:
     : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
   virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override;
 
   virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
     // The bounding box must have non-zero width in each dimension, so pad the Y
@@ -42,6 +85,33 @@ public:
     return true;
   }
 
+  virtual double pdf_value(const point3& o, const vec3& v) const override {
+    return rect_pdf_value(*this, o, v);
+  }
+
+  virtual vec3 random(const point3& o) const override {
+    return point3(random_double(x0,x1), k, random_double(z0,z1)) - o;
+  }
+
+  virtual bool is_light() const override { return mp->is_emitter(); }
+  virtual double area() const override { return (x1-x0)*(z1-z0); }
+
+  virtual bool sample_surface(double u1, double u2, double time, hit_record& rec) const override {
+    auto x = x0 + u1*(x1-x0);
+    auto z = z0 + u2*(z1-z0);
+    rec.p = point3(x, k, z);
+    rec.normal = vec3(0, 1, 0);
+    rec.front_face = true;
+    rec.u = u1;
+    rec.v = u2;
+    rec.mat_ptr = mp;
+    return true;
+  }
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    slots.push_back(&mp);
+  }
+
 public:
   double x0, x1, z0, z1, k;
   shared_ptr<material> mp;
@@ -56,6 +126,7 @@ public:
     : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
   virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override;
 
   virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
     // The bounding box must have non-zero width in each dimension, so pad the X
@@ -64,6 +135,33 @@ public:
     return true;
   }
 
+  virtual double pdf_value(const point3& o, const vec3& v) const override {
+    return rect_pdf_value(*this, o, v);
+  }
+
+  virtual vec3 random(const point3& o) const override {
+    return point3(k, random_double(y0,y1), random_double(z0,z1)) - o;
+  }
+
+  virtual bool is_light() const override { return mp->is_emitter(); }
+  virtual double area() const override { return (y1-y0)*(z1-z0); }
+
+  virtual bool sample_surface(double u1, double u2, double time, hit_record& rec) const override {
+    auto y = y0 + u1*(y1-y0);
+    auto z = z0 + u2*(z1-z0);
+    rec.p = point3(k, y, z);
+    rec.normal = vec3(1, 0, 0);
+    rec.front_face = true;
+    rec.u = u1;
+    rec.v = u2;
+    rec.mat_ptr = mp;
+    return true;
+  }
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    slots.push_back(&mp);
+  }
+
 public:
   double y0, y1, z0, z1, k;
   shared_ptr<material> mp;
@@ -79,6 +177,8 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     return false;
   rec.u = (x-x0)/(x1-x0);
   rec.v = (y-y0)/(y1-y0);
+  rec.dpdu = vec3(x1-x0, 0, 0);
+  rec.dpdv = vec3(0, y1-y0, 0);
   rec.t = t;
   auto outward_normal = vec3(0, 0, 1);
   rec.set_face_normal(r, outward_normal);
@@ -97,6 +197,8 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     return false;
   rec.u = (x-x0)/(x1-x0);
   rec.v = (z-z0)/(z1-z0);
+  rec.dpdu = vec3(x1-x0, 0, 0);
+  rec.dpdv = vec3(0, 0, z1-z0);
   rec.t = t;
   auto outward_normal = vec3(0, 1, 0);
   rec.set_face_normal(r, outward_normal);
@@ -115,6 +217,8 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     return false;
   rec.u = (y-y0)/(y1-y0);
   rec.v = (z-z0)/(z1-z0);
+  rec.dpdu = vec3(0, y1-y0, 0);
+  rec.dpdv = vec3(0, 0, z1-z0);
   rec.t = t;
   auto outward_normal = vec3(1, 0, 0);
   rec.set_face_normal(r, outward_normal);
@@ -123,4 +227,31 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
   return true;
 }
 
+bool xy_rect::occluded(const ray& r, double t_min, double t_max) const {
+  auto t = (k-r.origin().z()) / r.direction().z();
+  if (t < t_min || t > t_max)
+    return false;
+  auto x = r.origin().x() + t*r.direction().x();
+  auto y = r.origin().y() + t*r.direction().y();
+  return !(x < x0 || x > x1 || y < y0 || y > y1);
+}
+
+bool xz_rect::occluded(const ray& r, double t_min, double t_max) const {
+  auto t = (k-r.origin().y()) / r.direction().y();
+  if (t < t_min || t > t_max)
+    return false;
+  auto x = r.origin().x() + t*r.direction().x();
+  auto z = r.origin().z() + t*r.direction().z();
+  return !(x < x0 || x > x1 || z < z0 || z > z1);
+}
+
+bool yz_rect::occluded(const ray& r, double t_min, double t_max) const {
+  auto t = (k-r.origin().x()) / r.direction().x();
+  if (t < t_min || t > t_max)
+    return false;
+  auto y = r.origin().y() + t*r.direction().y();
+  auto z = r.origin().z() + t*r.direction().z();
+  return !(y < y0 || y > y1 || z < z0 || z > z1);
+}
+
 #endif
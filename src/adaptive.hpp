@@ -0,0 +1,126 @@
+#ifndef ADAPTIVE_HPP
+#define ADAPTIVE_HPP
+
+#include "rtweekend.hpp"
+
+#include "color.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <vector>
+
+// Running estimate for one pixel: the color sum for the image, and the mean
+// and variance of its luminance for the error estimate.
+struct pixel_estimate {
+  color sum;
+  int samples = 0;
+  double mean = 0;
+  double m2 = 0;
+
+  void add(const color& c) {
+    sum += c;
+    samples++;
+
+    // Welford's online variance.
+    auto y = luminance(c);
+    auto delta = y - mean;
+    mean += delta / samples;
+    m2 += delta * (y - mean);
+  }
+
+  // Standard error of the mean relative to the mean, with a floor so that
+  // nearly black pixels do not demand unbounded samples.
+  double relative_error() const {
+    if (samples < 2)
+      return infinity;
+    auto variance = m2 / (samples - 1);
+    return sqrt(variance / samples) / (mean + 0.01);
+  }
+};
+
+struct adaptive_settings {
+  int min_spp = 16;
+  int max_spp = 1024;
+  double average_spp = 64;    // the budget for the whole image
+  double threshold = 0.01;
+};
+
+// Renders every pixel with min_spp samples, then spends the rest of a budget
+// of average_spp samples per pixel in passes. Each pass ranks the pixels
+// still above the error threshold, noisiest first, and in that order gives
+// each as many samples as it already has until half of what is left of the
+// budget is spent, so the next pass ranks by the new estimates. Stops when
+// the budget is spent or every pixel has converged or reached max_spp.
+//
+// sample(i, j, index) traces sample number index of pixel (i, j), so
+// progressive samplers continue where the previous pass stopped.
+std::vector<pixel_estimate> render_adaptive(
+  int width, int height, const adaptive_settings& settings,
+  const std::function<color(int, int, int)>& sample
+) {
+  std::vector<pixel_estimate> pixels(width * height);
+  auto budget = long(settings.average_spp * width * height);
+  long spent = 0;
+
+  std::vector<std::pair<double, int>> ranked;
+  for (int p = 0; p < width * height; p++) {
+    auto& pixel = pixels[p];
+    for (int k = 0; k < settings.min_spp; k++)
+      pixel.add(sample(p % width, p / width, pixel.samples));
+    spent += settings.min_spp;
+
+    auto error = pixel.relative_error();
+    if (error > settings.threshold && pixel.samples < settings.max_spp)
+      ranked.push_back(std::make_pair(error, p));
+  }
+
+  int pass = 1;
+  while (!ranked.empty() && spent < budget) {
+    std::sort(ranked.begin(), ranked.end(), std::greater<std::pair<double, int>>());
+    auto pass_end = spent + (budget - spent + 1) / 2;
+
+    // Pixels past the end of the pass keep their place and error.
+    size_t kept = 0;
+    for (size_t r = 0; r < ranked.size(); r++) {
+      int p = ranked[r].second;
+      auto& pixel = pixels[p];
+      if (spent < pass_end) {
+        auto batch = std::min<long>(std::min(pixel.samples, settings.max_spp - pixel.samples),
+                                    pass_end - spent);
+        for (long k = 0; k < batch; k++)
+          pixel.add(sample(p % width, p / width, pixel.samples));
+        spent += batch;
+        ranked[r].first = pixel.relative_error();
+      }
+      if (ranked[r].first > settings.threshold && pixel.samples < settings.max_spp)
+        ranked[kept++] = ranked[r];
+    }
+    ranked.resize(kept);
+
+    std::cerr << "\rAdaptive pass " << ++pass << ", pixels remaining: " << ranked.size()
+              << ", budget left: " << 100.0 * (budget - std::min(spent, budget)) / budget
+              << "%          " << std::flush;
+  }
+  std::cerr << '\n';
+
+  return pixels;
+}
+
+// Writes samples per pixel as a grayscale PGM, brightest where the most
+// samples were spent. Rows are written top first like the image.
+void write_sample_map(const char* filename, const std::vector<pixel_estimate>& pixels,
+                      int width, int height) {
+  int most = 1;
+  for (const auto& pixel : pixels)
+    most = std::max(most, pixel.samples);
+
+  std::ofstream out(filename);
+  out << "P2\n" << width << ' ' << height << "\n255\n";
+  for (int j = height-1; j >= 0; --j) {
+    for (int i = 0; i < width; ++i)
+      out << 255 * pixels[j*width + i].samples / most << '\n';
+  }
+}
+
+#endif
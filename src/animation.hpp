@@ -0,0 +1,338 @@
+#ifndef ANIMATION_HPP
+#define ANIMATION_HPP
+
+#include "rtweekend.hpp"
+
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "hittable_list.hpp"
+#include "image_output.hpp"
+#include "light_tree.hpp"
+#include "parallel.hpp"
+#include "sampler.hpp"
+#include "scenes.hpp"
+#include "tiled_image.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Values set at keyframes, in between interpolated by a Catmull-Rom spline
+// through them, which keeps the motion smooth across keys. Before the first
+// key and after the last the value holds.
+template <typename T>
+class track {
+public:
+  void add(double frame, const T& value) {
+    auto at = std::upper_bound(keys.begin(), keys.end(), frame,
+                               [](double f, const std::pair<double, T>& key) { return f < key.first; });
+    keys.insert(at, std::make_pair(frame, value));
+  }
+
+  bool empty() const { return keys.empty(); }
+  double first() const { return keys.front().first; }
+  double last() const { return keys.back().first; }
+
+  T at(double frame) const {
+    if (frame <= first())
+      return keys.front().second;
+    if (frame >= last())
+      return keys.back().second;
+
+    size_t k = 1;
+    while (keys[k].first < frame)
+      k++;
+    const auto& a = keys[k-1];
+    const auto& b = keys[k];
+    auto dt = b.first - a.first;
+    if (dt <= 0)
+      return b.second;
+
+    // Hermite segment with the tangents of the neighbouring keys, one sided
+    // at the ends.
+    auto tangent = [&](size_t i) {
+      auto lo = i > 0 ? i - 1 : i, hi = i + 1 < keys.size() ? i + 1 : i;
+      return (keys[hi].second - keys[lo].second) * (1.0 / (keys[hi].first - keys[lo].first));
+    };
+    auto s = (frame - a.first) / dt, s2 = s*s, s3 = s2*s;
+    return a.second * (2*s3 - 3*s2 + 1) + tangent(k-1) * ((s3 - 2*s2 + s) * dt)
+      + b.second * (-2*s3 + 3*s2) + tangent(k) * ((s3 - s2) * dt);
+  }
+
+private:
+  std::vector<std::pair<double, T>> keys;
+};
+
+// Keyframes for the camera and for offsets of objects of the scene, read
+// from a text file of lines
+//
+//   camera FRAME  FROM_X FROM_Y FROM_Z  AT_X AT_Y AT_Z  VFOV [APERTURE]
+//   move OBJECT FRAME  DX DY DZ
+//
+// where OBJECT is the index of an object in the scene's list and # starts a
+// comment. The animation runs from the first keyframe to the last.
+class animation {
+public:
+  bool load(const std::string& path);
+
+  bool empty() const { return lookfrom.empty() && moves.empty(); }
+  int first_frame() const;
+  int last_frame() const;
+
+  // False when only the camera moves, so every frame renders the one scene,
+  // bvh and lights.
+  bool moves_objects() const { return !moves.empty(); }
+
+  // The camera at frame, or still if there are no camera keys.
+  camera camera_at_frame(double frame, double aspect_ratio, const camera& still) const {
+    if (lookfrom.empty())
+      return still;
+    return camera_at(lookfrom.at(frame), lookat.at(frame), aspect_ratio, vfov.at(frame),
+                     std::max(0.0, aperture.at(frame)));
+  }
+
+  // The objects of scene, those with keys offset to where they are at frame.
+  hittable_list scene_at_frame(const hittable_list& scene, double frame) const {
+    hittable_list moved = scene;
+    for (const auto& m : moves) {
+      if (m.first < moved.objects.size())
+        moved.objects[m.first] = make_shared<translate>(moved.objects[m.first], m.second.at(frame));
+    }
+    return moved;
+  }
+
+  // Object indices past the end of scene, for an error.
+  size_t unknown_objects(const hittable_list& scene) const {
+    size_t unknown = 0;
+    for (const auto& m : moves)
+      unknown += m.first >= scene.objects.size();
+    return unknown;
+  }
+
+private:
+  track<vec3> lookfrom, lookat;
+  track<double> vfov, aperture;
+  std::vector<std::pair<size_t, track<vec3>>> moves;
+};
+
+bool animation::load(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "ERROR: Could not read animation '" << path << "'.\n";
+    return false;
+  }
+
+  std::string line;
+  for (int number = 1; std::getline(in, line); number++) {
+    auto comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+    std::istringstream fields(line);
+    std::string kind;
+    if (!(fields >> kind))
+      continue;
+
+    double frame;
+    bool ok = false;
+    if (kind == "camera") {
+      double from[3], at[3], fov, lens = 0;
+      ok = bool(fields >> frame >> from[0] >> from[1] >> from[2] >> at[0] >> at[1] >> at[2] >> fov);
+      if (ok && !(fields >> lens))
+        lens = 0;
+      if (ok) {
+        lookfrom.add(frame, vec3(from[0], from[1], from[2]));
+        lookat.add(frame, vec3(at[0], at[1], at[2]));
+        vfov.add(frame, fov);
+        aperture.add(frame, lens);
+      }
+    } else if (kind == "move") {
+      long object;
+      double d[3];
+      ok = bool(fields >> object >> frame >> d[0] >> d[1] >> d[2]) && object >= 0;
+      if (ok) {
+        auto found = std::find_if(moves.begin(), moves.end(),
+                                  [&](const std::pair<size_t, track<vec3>>& m) {
+                                    return m.first == size_t(object);
+                                  });
+        if (found == moves.end())
+          found = moves.insert(moves.end(), std::make_pair(size_t(object), track<vec3>()));
+        found->second.add(frame, vec3(d[0], d[1], d[2]));
+      }
+    }
+
+    if (!ok) {
+      std::cerr << "ERROR: '" << path << "' line " << number << ": expected 'camera FRAME"
+                << " FROM_X FROM_Y FROM_Z AT_X AT_Y AT_Z VFOV [APERTURE]' or 'move OBJECT"
+                << " FRAME DX DY DZ'.\n";
+      return false;
+    }
+  }
+
+  if (empty()) {
+    std::cerr << "ERROR: Animation '" << path << "' has no keyframes.\n";
+    return false;
+  }
+  return true;
+}
+
+int animation::first_frame() const {
+  auto first = lookfrom.empty() ? infinity : lookfrom.first();
+  for (const auto& m : moves)
+    first = std::min(first, m.second.first());
+  return int(std::ceil(first));
+}
+
+int animation::last_frame() const {
+  auto last = lookfrom.empty() ? -infinity : lookfrom.last();
+  for (const auto& m : moves)
+    last = std::max(last, m.second.last());
+  return int(std::floor(last));
+}
+
+// The bvh and lights of a frame whose objects moved.
+struct frame_world {
+  frame_world(const hittable_list& list, bool use_bvh)
+    : objects(list), lights(objects, 0, 1), bvh_used(use_bvh) {
+    if (use_bvh)
+      bvh = bvh_node(objects, 0, 1);
+  }
+
+  const hittable& scene() const {
+    return bvh_used ? static_cast<const hittable&>(bvh) : objects;
+  }
+
+  hittable_list objects;
+  bvh_node bvh;
+  light_tree lights;
+  bool bvh_used;
+};
+
+// Renders frames [first, last], every one cut into the tiles of layout, as
+// one stream of frame and tile pairs on all threads: workers take the tiles
+// of the next frame while the last tiles of one finish, so none waits at a
+// frame boundary. prepare(frame) sets up a frame once, before its tiles;
+// render_tile(state, tile, image) fills a tile of the frame's image; done
+// gets the images in frame order. At most window frames are in flight, which
+// bounds memory when done, or the writer behind it, falls behind. Both draw
+// from generators seeded by frame and tile, so the frames do not depend on
+// the threads.
+template <typename Frame>
+void render_frames(int first, int last, const tile_layout& layout, int window,
+                   const std::function<shared_ptr<Frame>(int)>& prepare,
+                   const std::function<void(const Frame&, int, float_image&)>& render_tile,
+                   const std::function<void(int, float_image)>& done) {
+  struct slot {
+    int frame = -1;
+    bool ready = false;
+    int remaining = 0;
+    shared_ptr<Frame> state;
+    float_image image;
+  };
+
+  window = std::max(window, 1);
+  std::vector<slot> slots(window);
+  std::mutex lock, emitting;
+  std::condition_variable changed;
+  long total = long(last - first + 1) * layout.count();
+  std::atomic<long> next(0);
+  int emitted = first;
+
+  parallel_for(0, thread_count(), [&](int) {
+    for (;;) {
+      long item = next++;
+      if (item >= total)
+        return;
+      int frame = first + int(item / layout.count()), tile = int(item % layout.count());
+      auto& s = slots[(frame - first) % window];
+
+      std::unique_lock<std::mutex> hold(lock);
+      changed.wait(hold, [&] { return frame < emitted + window; });
+      if (s.frame != frame) {
+        s.frame = frame;
+        s.ready = false;
+        s.remaining = layout.count();
+        hold.unlock();
+        std::mt19937 generator(hash_uint(frame));
+        scoped_random_source random(generator);
+        auto state = prepare(frame);
+        float_image image(layout.width, layout.height);
+        hold.lock();
+        s.state = state;
+        s.image = std::move(image);
+        s.ready = true;
+        changed.notify_all();
+      } else {
+        changed.wait(hold, [&] { return s.ready; });
+      }
+      hold.unlock();
+
+      {
+        std::mt19937 generator(hash_combine(hash_uint(frame), tile + 1));
+        scoped_random_source random(generator);
+        render_tile(*s.state, tile, s.image);
+      }
+
+      hold.lock();
+      if (--s.remaining > 0)
+        continue;
+      hold.unlock();
+
+      // One worker at a time passes on the finished frames in order.
+      std::lock_guard<std::mutex> in_order(emitting);
+      for (;;) {
+        hold.lock();
+        auto& head = slots[(emitted - first) % window];
+        if (head.frame != emitted || !head.ready || head.remaining > 0) {
+          hold.unlock();
+          break;
+        }
+        auto image = std::move(head.image);
+        head.state.reset();
+        hold.unlock();
+
+        done(head.frame, std::move(image));
+
+        hold.lock();
+        emitted++;
+        changed.notify_all();
+        hold.unlock();
+      }
+    }
+  });
+}
+
+// YUV4MPEG2, the stream ffmpeg and most players read from a pipe: a header
+// for the stream, then every frame as planes of 8 bit Y, Cb and Cr at full
+// resolution, in video range BT.601 from the display values of PPM.
+bool write_y4m_header(std::ostream& out, int width, int height, int fps) {
+  out << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C444\n";
+  return bool(out);
+}
+
+bool write_y4m_frame(std::ostream& out, const float_image& image) {
+  auto pixels = size_t(image.width) * image.height;
+  std::vector<unsigned char> planes(3 * pixels);
+  for (size_t p = 0; p < pixels; p++) {
+    double r = display_byte(image.rgb[3*p]);
+    double g = display_byte(image.rgb[3*p+1]);
+    double b = display_byte(image.rgb[3*p+2]);
+    planes[p] = static_cast<unsigned char>(16.5 + (65.738*r + 129.057*g + 25.064*b) / 256);
+    planes[pixels + p] = static_cast<unsigned char>(128.5 + (-37.945*r - 74.494*g + 112.439*b) / 256);
+    planes[2*pixels + p] = static_cast<unsigned char>(128.5 + (112.439*r - 94.154*g - 18.285*b) / 256);
+  }
+  out << "FRAME\n";
+  out.write(reinterpret_cast<const char*>(planes.data()), planes.size());
+  return bool(out);
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef AOV_HPP
+#define AOV_HPP
+
+#include "rtweekend.hpp"
+
+#include "color.hpp"
+
+#include <vector>
+
+// Surface attributes at the first hit of a camera ray, the feature buffers
+// that guide the denoiser. Misses report the background, a normal facing the
+// camera and a far depth.
+struct aov_sample {
+  color albedo;
+  vec3 normal;
+  double depth;
+};
+
+// Per-pixel sums of the features, plus the luminance moments of the beauty
+// samples for a variance estimate. Indexed like framebuffer.
+struct aov_buffer {
+  aov_buffer(int w, int h)
+    : width(w), height(h), albedo(w*h), normal(w*h), depth(w*h, 0.0),
+      luminance(w*h, 0.0), luminance_squared(w*h, 0.0) {}
+
+  void add(int i, int j, const color& c, const aov_sample& aov) {
+    auto p = j*width + i;
+    albedo[p] += aov.albedo;
+    normal[p] += aov.normal;
+    depth[p] += aov.depth;
+    auto y = ::luminance(c);
+    luminance[p] += y;
+    luminance_squared[p] += y*y;
+  }
+
+  int width, height;
+  std::vector<color> albedo;
+  std::vector<vec3> normal;
+  std::vector<double> depth;
+  std::vector<double> luminance;
+  std::vector<double> luminance_squared;
+};
+
+#endif
@@ -0,0 +1,1125 @@
+// Microbenchmarks for the hot paths of the raytracer, built with `make bench`.
+
+#include "rtweekend.hpp"
+
+#include "compile.hpp"
+#include "denoise.hpp"
+#include "image_output.hpp"
+#include "incremental.hpp"
+#include "scenes.hpp"
+#include "lights.hpp"
+#include "light_tree.hpp"
+#include "paged_texture.hpp"
+#include "render.hpp"
+#include "sampler.hpp"
+#include "temporal.hpp"
+#include "texture_cache.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+  return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Rays between random pairs of points inside the scene bounds, like the shadow
+// rays cast from a shading point towards a sampled light.
+std::vector<ray> visibility_rays(const hittable& world, int count) {
+  aabb bounds;
+  world.bounding_box(0, 1, bounds);
+
+  std::vector<ray> rays;
+  rays.reserve(count);
+  for (int i = 0; i < count; i++) {
+    point3 from, to;
+    for (int a = 0; a < 3; a++) {
+      from[a] = random_double(bounds.min()[a], bounds.max()[a]);
+      to[a] = random_double(bounds.min()[a], bounds.max()[a]);
+    }
+    rays.push_back(ray(from, to - from, random_double()));
+  }
+  return rays;
+}
+
+void bench_occluded(const char* name, const hittable& world, int count) {
+  auto rays = visibility_rays(world, count);
+
+  // Shadow rays only care about (0.001, 1), the segment between the two points.
+  auto start = bench_clock::now();
+  int hits = 0;
+  for (const auto& r : rays) {
+    hit_record rec;
+    if (world.hit(r, 0.001, 0.999, rec))
+      hits++;
+  }
+  auto hit_time = seconds_since(start);
+
+  start = bench_clock::now();
+  int occluded = 0;
+  for (const auto& r : rays) {
+    if (world.occluded(r, 0.001, 0.999))
+      occluded++;
+  }
+  auto occluded_time = seconds_since(start);
+
+  std::cout << name << ": " << count << " rays, "
+            << "hit() " << hit_time << "s (" << hits << " blocked), "
+            << "occluded() " << occluded_time << "s (" << occluded << " blocked), "
+            << "speedup " << hit_time / occluded_time << "x\n";
+}
+
+// Times light selection and reports the relative standard deviation of the
+// unshadowed irradiance estimate at random points on the floor.
+void bench_light_sampler(const char* name, const light_sampler& lights,
+                         int points, int samples) {
+  auto start = bench_clock::now();
+  auto relative_deviation = 0.0;
+
+  for (int i = 0; i < points; i++) {
+    point3 p(random_double(0, 555), 0.001, random_double(0, 555));
+    vec3 normal(0, 1, 0);
+
+    auto sum = 0.0, sum_squared = 0.0;
+    for (int s = 0; s < samples; s++) {
+      light_sample ls;
+      auto estimate = 0.0;
+      if (lights.sample(p, 0, ls)) {
+        auto cosine = dot(unit_vector(ls.direction), normal);
+        if (cosine > 0)
+          estimate = luminance(ls.emitted) * cosine / ls.pdf;
+      }
+      sum += estimate;
+      sum_squared += estimate*estimate;
+    }
+
+    auto mean = sum / samples;
+    auto variance = sum_squared / samples - mean*mean;
+    if (mean > 0)
+      relative_deviation += sqrt(fmax(variance, 0.0)) / mean;
+  }
+
+  auto elapsed = seconds_since(start);
+  std::cout << name << ": " << 1e9 * elapsed / (points*samples) << "ns per light sample, "
+            << "relative std dev " << relative_deviation / points << "\n";
+}
+
+// The emitters of many_lights moved across the room, the bvh and light tree
+// refit in place against ones rebuilt over the moved objects: hits have to
+// agree exactly, and the refit tree should sample as well as the rebuilt one.
+// A tree left with the bounds from before the move shows what that is worth.
+void bench_refit(int rays, int points, int samples) {
+  auto objects = many_lights();
+  std::vector<shared_ptr<translate>> moving;
+  for (auto& object : objects.objects) {
+    if (object->is_light()) {
+      auto wrapped = make_shared<translate>(object, vec3(0, 0, 0));
+      moving.push_back(wrapped);
+      object = wrapped;
+    }
+  }
+  bvh_node world(objects, 0, 1);
+  light_tree lights(objects, 0, 1), stale(objects, 0, 1);
+
+  for (auto& m : moving)
+    m->offset = vec3(random_double(-100, 100), 0, random_double(-100, 100));
+
+  auto start = bench_clock::now();
+  world.refit(0, 1);
+  lights.refit(0, 1);
+  auto refit_time = seconds_since(start);
+
+  start = bench_clock::now();
+  bvh_node rebuilt_world(objects, 0, 1);
+  light_tree rebuilt_lights(objects, 0, 1);
+  auto rebuild_time = seconds_since(start);
+
+  // Emitters can overlap after the move, so two hits can tie at t with
+  // different materials; the distance is what has to match.
+  int mismatches = 0;
+  for (const auto& r : visibility_rays(rebuilt_world, rays)) {
+    hit_record a, b;
+    bool hit_a = world.hit(r, 0.001, infinity, a);
+    bool hit_b = rebuilt_world.hit(r, 0.001, infinity, b);
+    if (hit_a != hit_b || (hit_a && a.t != b.t)
+        || world.occluded(r, 0.001, 0.999) != rebuilt_world.occluded(r, 0.001, 0.999))
+      mismatches++;
+  }
+
+  std::cout << "many_lights, " << moving.size() << " emitters moved: refit " << refit_time
+            << "s, rebuild " << rebuild_time << "s, " << mismatches << " of " << rays
+            << " rays differ\n";
+  bench_light_sampler("  refit light_tree", lights, points, samples);
+  bench_light_sampler("  rebuilt light_tree", rebuilt_lights, points, samples);
+  bench_light_sampler("  stale light_tree", stale, points, samples);
+}
+
+// A small cornell box render used to compare estimators against a reference.
+struct test_render {
+  test_render(int size, const hittable_list& objects = cornell_box(),
+              const camera& view = camera_at(point3(278, 278, -800), point3(278, 278, 0), 1.0, 40.0, 0.0))
+    : scene(objects), world(scene, 0, 1), lights(scene, 0, 1),
+      context(background, world, lights), cam(view), width(size), height(size) {}
+
+  std::vector<color> render(sampler& s, int samples_per_pixel, int max_depth = 8) const {
+    std::vector<color> image(width*height);
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        color sum(0,0,0);
+        for (int k = 0; k < samples_per_pixel; k++)
+          sum += sample_pixel(i, j, k, width, height, cam, context, max_depth, s);
+        image[j*width + i] = sum / samples_per_pixel;
+      }
+    }
+    return image;
+  }
+
+  // The same samples, accumulated with their first-hit features for denoising.
+  void render(sampler& s, int samples_per_pixel, framebuffer& fb, aov_buffer& aovs,
+              int max_depth = 8) const {
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        for (int k = 0; k < samples_per_pixel; k++) {
+          aov_sample aov;
+          auto c = sample_pixel(i, j, k, width, height, cam, context, max_depth, s, &aov);
+          fb.add(i, j, c);
+          aovs.add(i, j, c, aov);
+        }
+      }
+    }
+  }
+
+  hittable_list scene;
+  bvh_node world;
+  light_tree lights;
+  environment background;
+  render_context context;
+  camera cam;
+  int width, height;
+};
+
+double rmse(const std::vector<color>& image, const std::vector<color>& reference) {
+  auto sum = 0.0;
+  for (size_t p = 0; p < image.size(); p++) {
+    auto d = image[p] - reference[p];
+    sum += d.length_squared() / 3;
+  }
+  return sqrt(sum / image.size());
+}
+
+// Error in the gamma corrected, clamped values write_color outputs, where
+// the emitters no longer dominate.
+double display_rmse(const std::vector<color>& image, const std::vector<color>& reference) {
+  auto display = [](double x) { return clamp(sqrt(fmax(x, 0.0)), 0.0, 0.999); };
+  auto sum = 0.0;
+  for (size_t p = 0; p < image.size(); p++) {
+    for (int c = 0; c < 3; c++) {
+      auto d = display(image[p][c]) - display(reference[p][c]);
+      sum += d*d / 3;
+    }
+  }
+  return sqrt(sum / image.size());
+}
+
+// Noise at equal spp for every sampler, against a high spp reference.
+void bench_samplers(int size, int reference_spp) {
+  test_render cornell(size);
+
+  auto start = bench_clock::now();
+  auto reference = cornell.render(*make_sampler("sobol", reference_spp), reference_spp);
+  std::cout << "cornell_box " << size << "x" << size << ", reference "
+            << reference_spp << " spp in " << seconds_since(start) << "s\n";
+
+  for (int spp : {4, 16, 64}) {
+    for (const char* name : sampler_names) {
+      start = bench_clock::now();
+      auto image = cornell.render(*make_sampler(name, spp), spp);
+      std::cout << "  " << spp << " spp " << name << ": rmse " << rmse(image, reference)
+                << " (" << seconds_since(start) << "s)\n";
+    }
+  }
+}
+
+// Denoised low spp renders against plain renders with many more samples.
+void bench_denoise(int size, int reference_spp) {
+  test_render cornell(size);
+  auto reference = cornell.render(*make_sampler("sobol", reference_spp), reference_spp);
+  std::cout << "cornell_box " << size << "x" << size << " on " << thread_count() << " threads\n";
+
+  for (int spp : {16, 64, 256}) {
+    auto start = bench_clock::now();
+    auto image = cornell.render(*make_sampler("sobol", spp), spp);
+    std::cout << "  " << spp << " spp: rmse " << rmse(image, reference)
+              << ", display rmse " << display_rmse(image, reference)
+              << " (" << seconds_since(start) << "s)\n";
+  }
+
+  for (int spp : {4, 16}) {
+    auto start = bench_clock::now();
+    framebuffer fb(size, size);
+    aov_buffer aovs(size, size);
+    cornell.render(*make_sampler("sobol", spp), spp, fb, aovs);
+    auto render_time = seconds_since(start);
+
+    start = bench_clock::now();
+    denoiser filter(fb, aovs);
+    denoise_timings timings;
+    timings.prepare = seconds_since(start);
+    auto image = filter.run(denoise_settings(), timings);
+    auto denoise_time = seconds_since(start);
+
+    std::cout << "  " << spp << " spp + denoise: rmse " << rmse(image, reference)
+              << ", display rmse " << display_rmse(image, reference) << "\n    ("<< render_time << "s render, " << denoise_time << "s denoise: "
+              << timings.prepare << "s prepare, " << timings.filter << "s filter, "
+              << timings.resolve << "s resolve)\n";
+  }
+}
+
+// Plain path tracing against interpolating diffuse interreflection from an
+// irradiance cache, which is built first.
+void bench_irradiance_cache(int size, int reference_spp) {
+  test_render cornell(size);
+  auto reference = cornell.render(*make_sampler("sobol", reference_spp), reference_spp);
+  std::cout << "cornell_box " << size << "x" << size << " on " << thread_count() << " threads\n";
+
+  for (int spp : {16, 64}) {
+    auto start = bench_clock::now();
+    auto image = cornell.render(*make_sampler("sobol", spp), spp);
+    std::cout << "  " << spp << " spp: rmse " << rmse(image, reference)
+              << ", display rmse " << display_rmse(image, reference)
+              << " (" << seconds_since(start) << "s)\n";
+  }
+
+  aabb bounds;
+  cornell.world.bounding_box(0, 1, bounds);
+  irradiance_cache cache(bounds);
+  auto start = bench_clock::now();
+  populate_irradiance_cache(cache, cache_points(cornell.cam, size, size, 2, cornell.context, 8),
+                            cornell.context);
+  std::cout << "  cache: " << cache.size() << " records in " << seconds_since(start) << "s\n";
+  cornell.context.irradiance = &cache;
+
+  for (int spp : {16, 64}) {
+    start = bench_clock::now();
+    auto image = cornell.render(*make_sampler("sobol", spp), spp);
+    std::cout << "  " << spp << " spp cached: rmse " << rmse(image, reference)
+              << ", display rmse " << display_rmse(image, reference)
+              << " (" << seconds_since(start) << "s)\n";
+  }
+}
+
+// Caustics from path tracing alone against a photon map, in the Cornell box
+// with a glass ball.
+void bench_caustics(int size, int reference_spp, int photons) {
+  test_render glass(size, cornell_glass());
+  auto reference = glass.render(*make_sampler("sobol", reference_spp), reference_spp);
+  std::cout << "cornell_glass " << size << "x" << size << " on " << thread_count() << " threads\n";
+
+  for (int spp : {16, 64}) {
+    auto start = bench_clock::now();
+    auto image = glass.render(*make_sampler("sobol", spp), spp);
+    std::cout << "  " << spp << " spp: display rmse " << display_rmse(image, reference)
+              << " (" << seconds_since(start) << "s)\n";
+  }
+
+  auto start = bench_clock::now();
+  photon_map caustics(glass.lights.lights, glass.world, photons, 3.0, 8);
+  std::cout << "  " << photons << " photons: " << caustics.size() << " stored in "
+            << seconds_since(start) << "s\n";
+  glass.context.caustics = &caustics;
+
+  for (int spp : {16, 64}) {
+    start = bench_clock::now();
+    auto image = glass.render(*make_sampler("sobol", spp), spp);
+    std::cout << "  " << spp << " spp with photons: display rmse "
+              << display_rmse(image, reference) << " (" << seconds_since(start) << "s)\n";
+  }
+}
+
+// Indirect light through a doorway, path traced with and without a guide
+// trained over passes, reporting the training time separately.
+void bench_guiding(int size, int reference_spp, int passes) {
+  test_render door(size, light_through_door());
+  auto reference = door.render(*make_sampler("sobol", reference_spp), reference_spp);
+  std::cout << "light_through_door " << size << "x" << size << " on " << thread_count()
+            << " threads\n";
+
+  for (int spp : {16, 64}) {
+    auto start = bench_clock::now();
+    auto image = door.render(*make_sampler("sobol", spp), spp);
+    std::cout << "  " << spp << " spp: display rmse " << display_rmse(image, reference)
+              << " (" << seconds_since(start) << "s)\n";
+  }
+
+  auto start = bench_clock::now();
+  aabb bounds;
+  door.world.bounding_box(0, 1, bounds);
+  path_guide guide(bounds);
+  train_guide(guide, passes, door.cam, door.width, door.height, door.context, 8);
+  std::cout << "  " << passes << " training passes: " << guide.size() << " cells in "
+            << seconds_since(start) << "s\n";
+  door.context.guide = &guide;
+
+  for (int spp : {16, 64}) {
+    start = bench_clock::now();
+    auto image = door.render(*make_sampler("sobol", spp), spp);
+    std::cout << "  " << spp << " spp guided: display rmse "
+              << display_rmse(image, reference) << " (" << seconds_since(start) << "s)\n";
+  }
+}
+
+// Turbulence summed from scalar noise() octaves, the reference, against the
+// vectorized per-point and batch evaluations.
+void bench_noise(int count) {
+  perlin noise;
+  std::vector<point3> points;
+  for (int i = 0; i < count; i++)
+    points.push_back(point3(random_double(-50, 50), random_double(-50, 50), random_double(-50, 50)));
+
+  auto start = bench_clock::now();
+  std::vector<double> reference(count);
+  for (int i = 0; i < count; i++) {
+    double sum = 0, weight = 1;
+    auto p = points[i];
+    for (int octave = 0; octave < 7; octave++, weight *= 0.5, p *= 2)
+      sum += weight * noise.noise(p);
+    reference[i] = fabs(sum);
+  }
+  auto scalar_time = seconds_since(start);
+
+  start = bench_clock::now();
+  double error = 0;
+  for (int i = 0; i < count; i++)
+    error = fmax(error, fabs(noise.turbulence(points[i]) - reference[i]));
+  auto point_time = seconds_since(start);
+
+  start = bench_clock::now();
+  std::vector<double> batch(count);
+  noise.turbulence(points.data(), batch.data(), count);
+  auto batch_time = seconds_since(start);
+  for (int i = 0; i < count; i++)
+    error = fmax(error, fabs(batch[i] - reference[i]));
+
+  std::cout << "turbulence, 7 octaves: scalar " << count / scalar_time / 1e6
+            << " M/s, per point " << count / point_time / 1e6
+            << " M/s, batch " << count / batch_time / 1e6 << " M/s, max error " << error << "\n";
+}
+
+// Albedo lookups of the diffuse materials of a scene at random points,
+// through the texture graphs and after compile_scene.
+void bench_textures(const char* name, hittable_list objects, int lookups) {
+  std::vector<shared_ptr<material>*> slots;
+  objects.material_slots(slots);
+  std::vector<const lambertian*> materials;
+  for (auto slot : slots) {
+    if (auto m = dynamic_cast<const lambertian*>(slot->get()))
+      materials.push_back(m);
+  }
+
+  std::vector<point3> points;
+  for (int i = 0; i < lookups; i++)
+    points.push_back(point3(random_double(-5, 5), random_double(-5, 5), random_double(-5, 5)));
+
+  auto run = [&]() {
+    color sum(0,0,0);
+    for (int i = 0; i < lookups; i++)
+      sum += materials[i % materials.size()]->albedo.value(0.5, 0.5, points[i]);
+    return sum;
+  };
+
+  auto start = bench_clock::now();
+  auto before = run();
+  auto graph_time = seconds_since(start);
+
+  auto stats = compile_scene(objects);
+  start = bench_clock::now();
+  auto after = run();
+  auto compiled_time = seconds_since(start);
+
+  std::cout << name << ": " << stats.materials << " materials, " << stats.unique_materials
+            << " after merging, " << stats.texture_nodes << " texture nodes; graph "
+            << lookups / graph_time / 1e6 << " M/s, compiled " << lookups / compiled_time / 1e6
+            << " M/s" << (before.x() == after.x() ? "" : ", RESULTS DIFFER") << "\n";
+}
+
+// Hides every override but hit() and occluded(), so media bounded by it fall
+// back to finding their entry and exit with two hit() queries.
+class hit_only : public hittable {
+public:
+  hit_only(shared_ptr<hittable> p) : ptr(p) {}
+
+  virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+    return ptr->hit(r, t_min, t_max, rec);
+  }
+  virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+    return ptr->bounding_box(time0, time1, output_box);
+  }
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+    return ptr->occluded(r, t_min, t_max);
+  }
+
+  shared_ptr<hittable> ptr;
+};
+
+void bench_medium(const char* name, const hittable& medium, const std::vector<ray>& rays) {
+  auto start = bench_clock::now();
+  int hits = 0;
+  for (const auto& r : rays) {
+    hit_record rec;
+    if (medium.hit(r, 0.001, 0.999, rec))
+      hits++;
+  }
+  auto hit_time = seconds_since(start);
+
+  start = bench_clock::now();
+  int occluded = 0;
+  for (const auto& r : rays) {
+    if (medium.occluded(r, 0.001, 0.999))
+      occluded++;
+  }
+  auto occluded_time = seconds_since(start);
+
+  std::cout << name << ": hit " << rays.size() / hit_time / 1e6 << " Mrays/s (" << hits
+            << " scattered), occluded " << rays.size() / occluded_time / 1e6 << " Mrays/s ("
+            << occluded << " blocked)\n";
+}
+
+// The 5000 unit fog sphere of final_scene, with its boundary solved directly
+// and through hit(), then the clouds of cornell_clouds in dense and brick grids.
+void bench_media(int count) {
+  auto white = make_shared<isotropic>(color(1,1,1));
+  auto fog = make_shared<sphere>(point3(0,0,0), 5000, white);
+  hittable_list scene_box;
+  scene_box.add(make_shared<sphere>(point3(0,0,0), 500, white));
+  auto rays = visibility_rays(scene_box, count);
+
+  bench_medium("constant_medium, analytic sphere", constant_medium(fog, .0001, color(1,1,1)), rays);
+  bench_medium("constant_medium, two hit() calls",
+               constant_medium(make_shared<hit_only>(fog), .0001, color(1,1,1)), rays);
+
+  auto clouds = cornell_clouds();
+  hittable_list room;
+  room.add(make_shared<box>(point3(0,0,0), point3(555,555,555), white));
+  rays = visibility_rays(room, count);
+  bench_medium("grid_medium, dense", *clouds.objects[clouds.objects.size() - 2], rays);
+  bench_medium("grid_medium, bricks", *clouds.objects.back(), rays);
+}
+
+// Fine checks in rings, most of it far above the Nyquist rate of a floor seen
+// at a grazing angle.
+std::vector<color> test_pattern(int size) {
+  std::vector<color> pixels(size_t(size) * size);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      auto ring = int(sqrt(double(x)*x + double(y)*y) / 7);
+      auto shade = ((x ^ y ^ ring) & 1) ? 0.9 : 0.1;
+      pixels[size_t(y) * size + x] = color(shade, 0.5 * shade, 1 - shade);
+    }
+  }
+  return pixels;
+}
+
+// Albedo of the first hit on a textured floor, the reference with many jittered
+// samples per pixel against one sample with and without the ray differential
+// footprint. Then bilinear lookups down the columns of a large image, stored
+// row by row as image_texture used to, against the Morton tiled mipmap.
+void bench_mipmap(int size, int reference_spp, int lookups) {
+  auto floor = make_shared<image_texture>(1024, 1024, test_pattern(1024));
+  hittable_list scene;
+  scene.add(make_shared<xz_rect>(-50, 50, -50, 50, 0, make_shared<lambertian>(floor)));
+  auto cam = camera_at(point3(0, 2, -45), point3(0, 0, 0), 1.0, 40.0, 0.0);
+  auto differential = cam.differentials(size, size);
+
+  auto render = [&](int spp, bool filtered) {
+    std::vector<color> image(size*size);
+    for (int j = 0; j < size; j++) {
+      for (int i = 0; i < size; i++) {
+        color sum(0,0,0);
+        for (int k = 0; k < spp; k++) {
+          auto r = cam.get_ray((i + random_double()) / (size-1), (j + random_double()) / (size-1),
+                               0.5, 0.5, 0);
+          hit_record rec;
+          if (!scene.hit(r, 0.001, infinity, rec))
+            continue;
+          if (filtered)
+            compute_footprint(r, differential, rec);
+          sum += floor->filtered_value(rec.u, rec.v, rec.p, rec.footprint);
+        }
+        image[j*size + i] = sum / spp;
+      }
+    }
+    return image;
+  };
+
+  auto reference = render(reference_spp, false);
+  std::cout << "floor, rmse against " << reference_spp << " spp: 1 spp point sampled "
+            << rmse(render(1, false), reference) << ", 16 spp point sampled "
+            << rmse(render(16, false), reference) << ", 1 spp filtered "
+            << rmse(render(1, true), reference) << "\n";
+
+  const int large = 4096;
+  auto pixels = test_pattern(large);
+  std::vector<rgb8_texel> rows(pixels.begin(), pixels.end());
+  auto row_major = [&](double u, double v) {
+    auto s = u * large - 0.5, t = v * large - 0.5;
+    int x = clamp(int(s), 0, large - 2), y = clamp(int(t), 0, large - 2);
+    auto fx = s - x, fy = t - y;
+    auto at = [&](int xi, int yi) { return rows[size_t(yi) * large + xi].to_color(); };
+    return (1 - fy) * ((1 - fx) * at(x, y) + fx * at(x + 1, y))
+      + fy * ((1 - fx) * at(x, y + 1) + fx * at(x + 1, y + 1));
+  };
+  mipmap<rgb8_texel> tiled(large, large, pixels);
+
+  auto walk = [&](const std::function<color(double, double)>& lookup) {
+    color sum(0,0,0);
+    auto start = bench_clock::now();
+    for (int n = 0; n < lookups; n++) {
+      auto u = (n / large % large + 0.5) / large;
+      auto v = (n % large + 0.5) / large;
+      sum += lookup(u, v);
+    }
+    auto elapsed = seconds_since(start);
+    return std::make_pair(lookups / elapsed / 1e6, sum.x() / lookups);
+  };
+  auto plain = walk(row_major);
+  auto morton = walk([&](double u, double v) { return tiled.lookup(u, v, 1); });
+  std::cout << "column walk over " << large << "x" << large << ": row major "
+            << plain.first << " M/s, tiled mipmap " << morton.first << " M/s ("
+            << tiled.level_count() << " levels, " << tiled.bytes() / (1 << 20) << " MiB)"
+            << (fabs(plain.second - morton.second) < 1e-6 ? "" : ", RESULTS DIFFER") << "\n";
+
+  // Incoherent lookups, like those of diffuse bounces, at random points.
+  std::vector<double> points(2 * (lookups / 8));
+  for (auto& p : points)
+    p = random_double();
+  auto scatter = [&](const std::function<color(double, double)>& lookup) {
+    color sum(0,0,0);
+    auto start = bench_clock::now();
+    for (size_t n = 0; n < points.size(); n += 2)
+      sum += lookup(points[n], points[n+1]);
+    return points.size() / 2 / seconds_since(start) / 1e6;
+  };
+  std::cout << "random lookups: row major " << scatter(row_major) << " M/s, tiled mipmap "
+            << scatter([&](double u, double v) { return tiled.lookup(u, v, 1); }) << " M/s\n";
+}
+
+// Building a pyramid from decoded pixels, the work every run used to repeat,
+// against mapping it from the store. The "image" is a stand-in file whose
+// stored pyramid is written first, then loaded by two paths with the same
+// contents, so the second is a hit.
+void bench_texture_cache(int size) {
+  char directory[] = "/tmp/texture_cacheXXXXXX";
+  if (!mkdtemp(directory))
+    return;
+  texture_cache cache(directory);
+  std::string first = std::string(directory) + "/a.img", second = std::string(directory) + "/b.img";
+  std::ofstream(first) << "stand-in image";
+  std::ofstream(second) << "stand-in image";
+
+  auto pixels = test_pattern(size);
+  auto start = bench_clock::now();
+  mipmap<rgb8_texel> built(size, size, pixels);
+  auto build_time = seconds_since(start);
+
+  std::uint64_t hash;
+  hash_file(first, hash);
+  auto stored = cache.store_path(hash, texel_format::rgb8);
+  std::ofstream out(stored, std::ios::binary);
+  built.write(out);
+  out.close();
+
+  start = bench_clock::now();
+  auto a = cache.load(first);
+  auto b = cache.load(second);
+  auto load_time = seconds_since(start);
+
+  bool same = a == b;
+  for (int i = 0; i < 1000 && same; i++) {
+    auto u = random_double(), v = random_double();
+    same = built.lookup(u, v, 4).x() == a->levels()->lookup(u, v, 4).x();
+  }
+
+  std::cout << size << "x" << size << " pyramid: built in " << build_time * 1e3
+            << " ms, mapped in " << load_time * 1e3 << " ms" << (same ? "" : ", RESULTS DIFFER")
+            << "\n";
+  cache.report(std::cout);
+
+  a.reset();
+  b.reset();
+  std::remove(stored.c_str());
+  std::remove(first.c_str());
+  std::remove(second.c_str());
+  rmdir(directory);
+}
+
+// A paged texture read through a page cache whose budget holds an eighth of
+// it, against the whole pyramid in memory: lookups in scanline order with a
+// footprint of about a texel, then random ones.
+void bench_paging(int size, int lookups) {
+  auto pixels = test_pattern(size);
+  mipmap<rgb8_texel> resident(size, size, pixels);
+  std::vector<rgb8_texel> texels(pixels.begin(), pixels.end());
+  pixels.clear();
+
+  char path[] = "/tmp/paged_textureXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return;
+  close(fd);
+  auto start = bench_clock::now();
+  write_paged_texture(path, size, size, std::move(texels));
+  auto convert_time = seconds_since(start);
+
+  page_cache cache(resident.bytes() / 8);
+  auto paged = open_paged_texture(path, cache);
+  std::remove(path);
+
+  std::vector<double> points;
+  int side = int(sqrt(double(lookups)));
+  for (int j = 0; j < side; j++)
+    for (int i = 0; i < side; i++)
+      points.push_back((i + 0.5) / side), points.push_back((j + 0.5) / side);
+  for (int n = 0; n < lookups; n++)
+    points.push_back(random_double()), points.push_back(random_double());
+
+  auto rate = [&](const mip_pyramid& pyramid, size_t from, size_t to) {
+    auto start = bench_clock::now();
+    color sum(0,0,0);
+    for (size_t n = from; n < to; n += 2)
+      sum += pyramid.lookup(points[n], points[n+1], double(size) / side);
+    return (to - from) / 2 / seconds_since(start) / 1e6;
+  };
+
+  auto ordered = size_t(2) * side * side;
+  std::cout << size << "x" << size << " converted in " << convert_time << "s, budget "
+            << cache.stats().budget / 1048576.0 << " of " << resident.bytes() / 1048576.0
+            << " MiB\n";
+  std::cout << "scanline lookups: in memory " << rate(resident, 0, ordered) << " M/s, paged "
+            << rate(*paged, 0, ordered) << " M/s\n";
+  std::cout << "random lookups: in memory " << rate(resident, ordered, points.size())
+            << " M/s, paged " << rate(*paged, ordered, points.size()) << " M/s\n";
+
+  double error = 0;
+  for (size_t n = 0; n < points.size(); n += 2) {
+    auto width = double(size) / side;
+    error = fmax(error, (paged->lookup(points[n], points[n+1], width)
+                         - resident.lookup(points[n], points[n+1], width)).length());
+  }
+
+  auto stats = cache.stats();
+  std::cout << "pages: " << stats.hits << " hits, " << stats.misses << " misses, "
+            << stats.evictions << " evictions, peak " << stats.peak_resident / 1048576.0
+            << " MiB resident; largest difference from in memory " << error << "\n";
+}
+
+// Times filling count outputs through libm and through a polynomial lanes
+// kernel, and reports the largest difference between them.
+void bench_kernel(const char* name, int count, const std::function<void(double*)>& exact,
+                  const std::function<void(double*)>& fast) {
+  std::vector<double> reference(count), approximate(count);
+  auto start = bench_clock::now();
+  exact(reference.data());
+  auto exact_time = seconds_since(start);
+  start = bench_clock::now();
+  fast(approximate.data());
+  auto fast_time = seconds_since(start);
+
+  auto error = 0.0;
+  for (int i = 0; i < count; i++)
+    error = fmax(error, fabs(approximate[i] - reference[i]));
+  std::cout << name << ": libm " << count / exact_time / 1e6 << " M/s, polynomial "
+            << count / fast_time / 1e6 << " M/s, largest error " << error << "\n";
+}
+
+// The fast_math kernels against libm, then renders in exact and fast mode
+// from the same random numbers: random_scene for sphere mapping, checkers,
+// Fresnel and sampling, cornell_smoke for media.
+void bench_fast_math(int count, int size, int spp) {
+  std::vector<double> x(count), y(count), unit(count), positive(count), sines(count);
+  for (int i = 0; i < count; i++) {
+    x[i] = random_double(-100, 100);
+    y[i] = random_double(-100, 100);
+    unit[i] = random_double(-1, 1);
+    positive[i] = 1 - random_double();
+  }
+
+  bench_kernel("sin", count, [&](double* out) {
+    for (int i = 0; i < count; i++)
+      out[i] = sin(x[i]);
+  }, [&](double* out) {
+    poly_sincos_lanes(count, x.data(), out, sines.data());
+  });
+  bench_kernel("cos", count, [&](double* out) {
+    for (int i = 0; i < count; i++)
+      out[i] = cos(x[i]);
+  }, [&](double* out) {
+    poly_sincos_lanes(count, x.data(), sines.data(), out);
+  });
+  bench_kernel("log", count, [&](double* out) {
+    for (int i = 0; i < count; i++)
+      out[i] = log(positive[i]);
+  }, [&](double* out) {
+    poly_log_lanes(count, positive.data(), out);
+  });
+  bench_kernel("acos", count, [&](double* out) {
+    for (int i = 0; i < count; i++)
+      out[i] = acos(unit[i]);
+  }, [&](double* out) {
+    poly_acos_lanes(count, unit.data(), out);
+  });
+  bench_kernel("atan2", count, [&](double* out) {
+    for (int i = 0; i < count; i++)
+      out[i] = atan2(y[i], x[i]);
+  }, [&](double* out) {
+    poly_atan2_lanes(count, y.data(), x.data(), out);
+  });
+
+  struct {
+    const char* name;
+    hittable_list objects;
+    camera view;
+    color sky;
+  } scenes[] = {
+    { "random_scene", random_scene(), camera_at(point3(13,2,3), point3(0,0,0), 1.0, 20.0, 0.1),
+      color(0.70, 0.80, 1.00) },
+    { "cornell_smoke", cornell_smoke(),
+      camera_at(point3(278, 278, -800), point3(278, 278, 0), 1.0, 40.0, 0.0), color(0,0,0) },
+  };
+
+  for (auto& scene : scenes) {
+    test_render render(size, scene.objects, scene.view);
+    render.background = environment(scene.sky);
+
+    auto run = [&](math_mode mode, double& seconds) {
+      shading_math = mode;
+      srand(1);
+      auto start = bench_clock::now();
+      auto image = render.render(*make_sampler("sobol", spp), spp);
+      seconds = seconds_since(start);
+      shading_math = math_mode::exact;
+      return image;
+    };
+    double exact_time, fast_time;
+    auto exact = run(math_mode::exact, exact_time);
+    auto fast = run(math_mode::fast, fast_time);
+    std::cout << scene.name << " " << size << "x" << size << ", " << spp << " spp: exact "
+              << exact_time << "s, fast " << fast_time << "s, display rmse between them "
+              << display_rmse(fast, exact) << "\n";
+  }
+}
+
+// Encoding a width x height image of render-like values, half of them past
+// the display range, in each output format into memory, against P3 by
+// write_color(); then what queueing it on an image_writer costs the render.
+void bench_output(int width, int height) {
+  float_image image(width, height);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      image.set(x, y, 2 * random_double() * color(random_double(), random_double(), random_double()));
+
+  auto start = bench_clock::now();
+  std::ostringstream legacy;
+  legacy << "P3\n" << width << ' ' << height << "\n255\n";
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      write_color(legacy, image.get(x, y), 1);
+  auto legacy_time = seconds_since(start);
+  std::cout << width << "x" << height << " write_color: " << legacy_time * 1e3 << " ms, "
+            << legacy.str().size() / 1048576.0 << " MiB\n";
+
+  const char* names[] = { "p3", "p6", "png", "pfm", "hdr" };
+  for (int f = 0; f < 5; f++) {
+    std::ostringstream out;
+    start = bench_clock::now();
+    bool written = write_image(out, image, image_format(f));
+    auto time = seconds_since(start);
+    std::cout << "  " << names[f] << ": ";
+    if (!written) {
+      std::cout << "not available\n";
+      continue;
+    }
+    std::cout << time * 1e3 << " ms, " << out.str().size() / 1048576.0 << " MiB";
+    if (f == 0)
+      std::cout << (out.str() == legacy.str() ? ", same as write_color" : ", DIFFERS FROM write_color");
+    std::cout << "\n";
+  }
+
+  char path[] = "/tmp/bench_outputXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return;
+  close(fd);
+  image_writer writer;
+  start = bench_clock::now();
+  writer.write(std::move(image), image_format::p3, path);
+  auto queued = seconds_since(start);
+  writer.finish();
+  auto total = seconds_since(start);
+  std::cout << "  image_writer: queued in " << queued * 1e3 << " ms, written after "
+            << total * 1e3 << " ms\n";
+  std::remove(path);
+}
+
+std::vector<color> image_pixels(const float_image& image) {
+  std::vector<color> out(size_t(image.width) * image.height);
+  for (int y = 0; y < image.height; y++)
+    for (int x = 0; x < image.width; x++)
+      out[size_t(y) * image.width + x] = image.get(x, y);
+  return out;
+}
+
+// random_scene rendered once with every tile recording its touches, then
+// edited: the material of the brown sphere, then a small sphere and the
+// mirror sphere moved. Each edit re-renders the tiles it invalidates, against a full
+// render of the edited scene; two full renders give the noise floor.
+void bench_incremental(int width, int height, int spp) {
+  auto scene = random_scene();
+  track_objects(scene);
+  compile_scene(scene);
+  auto bvh = make_shared<bvh_node>(scene, 0, 1);
+  light_tree lights(scene, 0, 1);
+  environment background(color(0.70, 0.80, 1.00));
+  aabb bounds(point3(-13, -1, -13), point3(13, 3, 13));
+  auto world = make_shared<tracked_world>(*bvh, bounds);
+  auto context = make_shared<render_context>(background, *world, lights);
+  auto cam = camera_at(point3(13,2,3), point3(0,0,0), double(width) / height, 20.0, 0.1);
+
+  auto new_sampler = [&]() { return make_sampler("sobol", spp); };
+  auto sample = [&](int i, int j, int index, sampler& s) {
+    return sample_pixel(i, j, index, width, height, cam, *context, 50, s);
+  };
+  auto full_render = [&](double& time) {
+    incremental_render full(width, height);
+    auto start = bench_clock::now();
+    full.render(spp, new_sampler, sample);
+    time = seconds_since(start);
+    return image_pixels(full.result());
+  };
+
+  incremental_render view(width, height);
+  auto start = bench_clock::now();
+  view.render(spp, new_sampler, sample);
+  std::cout << "random_scene " << width << "x" << height << " at " << spp << " spp on "
+            << thread_count() << " threads: " << view.tile_count() << " tiles in "
+            << seconds_since(start) << "s\n";
+
+  auto report = [&](const char* edit) {
+    auto dirty = view.dirty_tiles();
+    auto start = bench_clock::now();
+    view.render(spp, new_sampler, sample);
+    auto time = seconds_since(start);
+    double full_time, other_time;
+    auto reference = full_render(full_time);
+    auto other = full_render(other_time);
+    std::cout << "  " << edit << ": " << dirty << " tiles (" << 100.0 * dirty / view.tile_count()
+              << "%) in " << time << "s, full render " << full_time << "s; display rmse "
+              << display_rmse(image_pixels(view.result()), reference) << ", between full renders "
+              << display_rmse(other, reference) << "\n";
+  };
+
+  auto n = scene.objects.size();
+  auto brown = std::static_pointer_cast<tracked_object>(scene.objects[n-2])->ptr;
+  std::vector<shared_ptr<material>*> slots;
+  brown->material_slots(slots);
+  *slots[0] = make_shared<lambertian>(color(0.1, 0.3, 0.7));
+  compile_scene(*brown);
+  view.invalidate(brown.get());
+  report("material of the brown sphere");
+
+  // A moved object is a new one: the tiles that hit the old one, and those
+  // with rays through where the new one is.
+  auto move = [&](size_t index, const vec3& offset) {
+    auto old = std::static_pointer_cast<sphere>(
+      std::static_pointer_cast<tracked_object>(scene.objects[index])->ptr);
+    auto moved = make_shared<sphere>(old->center + offset, old->radius, old->mat_ptr);
+    scene.objects[index] = make_shared<tracked_object>(moved);
+    bvh = make_shared<bvh_node>(scene, 0, 1);
+    world = make_shared<tracked_world>(*bvh, bounds);
+    context = make_shared<render_context>(background, *world, lights);
+
+    aabb box;
+    moved->bounding_box(0, 1, box);
+    view.invalidate(old.get());
+    view.invalidate(box, *world);
+  };
+
+  size_t small = 1;
+  while (!std::dynamic_pointer_cast<sphere>(
+           std::static_pointer_cast<tracked_object>(scene.objects[small])->ptr))
+    small++;
+  move(small, vec3(0.3, 0, 0));
+  report("small sphere moved");
+
+  move(n-1, vec3(0, 0, 1.5));
+  report("mirror sphere moved");
+}
+
+// A camera moving from one point to another over frames of a still scene,
+// every frame rendered from scratch at spp against temporal accumulation
+// taking reuse_spp where history holds; the error is that of the last
+// frame against a reference.
+void bench_temporal(const char* name, const hittable_list& objects, const color& sky,
+                    const point3& from, const point3& to, const point3& at, double vfov,
+                    int width, int height, int frames, int spp, int reuse_spp, int reference_spp) {
+  auto scene = objects;
+  compile_scene(scene);
+  bvh_node world(scene, 0, 1);
+  light_tree lights(scene, 0, 1);
+  environment background(sky);
+  render_context context(background, world, lights);
+  auto camera_for = [&](int frame) {
+    auto t = double(frame) / (frames - 1);
+    return camera_at(from + t * (to - from), at, double(width) / height, vfov, 0.0);
+  };
+
+  auto render = [&](const camera& cam, int samples) {
+    float_image image(width, height);
+    parallel_for(0, height, [&](int y) {
+      auto s = make_sampler("sobol", samples);
+      for (int i = 0; i < width; i++) {
+        color sum(0,0,0);
+        for (int k = 0; k < samples; k++)
+          sum += sample_pixel(i, height-1 - y, k, width, height, cam, context, 8, *s);
+        image.set(i, y, sum / samples);
+      }
+    });
+    return image_pixels(image);
+  };
+  auto reference = render(camera_for(frames - 1), reference_spp);
+  std::cout << name << " " << width << "x" << height << ", " << frames << " frames on "
+            << thread_count() << " threads\n";
+
+  for (int samples : { spp, reuse_spp }) {
+    auto start = bench_clock::now();
+    std::vector<color> last;
+    for (int f = 0; f < frames; f++)
+      last = render(camera_for(f), samples);
+    std::cout << "  " << samples << " spp every frame: " << seconds_since(start)
+              << "s, display rmse " << display_rmse(last, reference) << "\n";
+  }
+
+  auto start = bench_clock::now();
+  temporal_accumulator history(width, height, reuse_spp, spp, 4 * spp);
+  std::vector<color> last;
+  double reused = 0, average = 0;
+  for (int f = 0; f < frames; f++) {
+    auto cam = camera_for(f);
+    last = image_pixels(history.render(
+      cam, world, [&]() { return make_sampler("sobol", spp); },
+      [&](int i, int j, int index, sampler& s, aov_sample* aov) {
+        return sample_pixel(i, j, index, width, height, cam, context, 8, s, aov);
+      }));
+    if (f > 0) {
+      reused += history.reused_fraction() / (frames - 1);
+      average += history.average_spp() / (frames - 1);
+    }
+  }
+  std::cout << "  temporal, " << reuse_spp << " spp where reused: " << seconds_since(start)
+            << "s, display rmse " << display_rmse(last, reference) << ", " << 100 * reused
+            << "% reused, " << average << " spp after the first frame\n";
+}
+
+bool selected(int argc, char** argv, const char* name) {
+  if (argc < 2)
+    return true;
+  for (int a = 1; a < argc; a++) {
+    if (strcmp(argv[a], name) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Usage: bench [section...], running every section by default. Sections are
+// lights, refit, occluded, media, noise, textures, mipmap, texture_cache, paging,
+// fastmath, output, samplers, denoise, irradiance, caustics, guiding,
+// incremental and temporal.
+int main(int argc, char** argv) {
+  if (selected(argc, argv, "lights")) {
+    auto many = many_lights();
+    std::cout << "many_lights: " << scene_lights(many).size() << " emitters\n";
+    bench_light_sampler("  light_list", light_list(many), 50, 2000);
+    bench_light_sampler("  light_tree", light_tree(many, 0, 1), 50, 2000);
+  }
+
+  if (selected(argc, argv, "refit")) {
+    bench_refit(200000, 50, 2000);
+  }
+
+  if (selected(argc, argv, "occluded")) {
+    const int rays = 200000;
+    bench_occluded("random_scene", bvh_node(random_scene(), 0, 1), rays);
+    bench_occluded("cornell_box", bvh_node(cornell_box(), 0, 1), rays);
+    bench_occluded("final_scene", bvh_node(final_scene(), 0, 1), rays);
+  }
+
+  if (selected(argc, argv, "media")) {
+    bench_media(200000);
+  }
+
+  if (selected(argc, argv, "noise")) {
+    bench_noise(1000000);
+  }
+
+  if (selected(argc, argv, "textures")) {
+    bench_textures("random_scene", random_scene(), 4000000);
+    bench_textures("two_spheres", two_spheres(), 4000000);
+  }
+
+  if (selected(argc, argv, "mipmap")) {
+    bench_mipmap(96, 256, 16000000);
+  }
+
+  if (selected(argc, argv, "texture_cache")) {
+    bench_texture_cache(4096);
+  }
+
+  if (selected(argc, argv, "paging")) {
+    bench_paging(4096, 4000000);
+  }
+
+  if (selected(argc, argv, "fastmath")) {
+    bench_fast_math(4000000, 96, 16);
+  }
+
+  if (selected(argc, argv, "output")) {
+    bench_output(3840, 2160);
+  }
+
+  if (selected(argc, argv, "samplers")) {
+    bench_samplers(48, 2048);
+  }
+
+  if (selected(argc, argv, "denoise")) {
+    bench_denoise(128, 2048);
+  }
+
+  if (selected(argc, argv, "irradiance")) {
+    bench_irradiance_cache(64, 1024);
+  }
+
+  if (selected(argc, argv, "caustics")) {
+    bench_caustics(64, 2048, 400000);
+  }
+
+  if (selected(argc, argv, "guiding")) {
+    bench_guiding(64, 2048, 7);
+  }
+
+  if (selected(argc, argv, "incremental")) {
+    bench_incremental(160, 90, 16);
+  }
+
+  if (selected(argc, argv, "temporal")) {
+    bench_temporal("cornell_box dolly", cornell_box(), color(0,0,0), point3(278, 278, -800),
+                   point3(258, 278, -700), point3(278, 278, 0), 40.0, 64, 64, 8, 16, 4, 1024);
+    bench_temporal("random_scene dolly", random_scene(), color(0.70, 0.80, 1.00),
+                   point3(13, 2, 3), point3(12, 2, 4.5), point3(0, 0, 0), 20.0, 120, 67, 8, 16, 4,
+                   256);
+  }
+}
@@ -13,11 +13,35 @@ public:
 
   virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+    return sides.occluded(r, t_min, t_max);
+  }
+
   virtual bool bounding_box(double _time0, double _time1, aabb& output_box) const override {
     output_box = aabb(box_min, box_max);
     return true;
   }
 
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    sides.material_slots(slots);
+  }
+
+  // The slab test, with the near and far planes of all three axes.
+  virtual bool inside(const ray& r, double& t_enter, double& t_exit) const override {
+    t_enter = -infinity;
+    t_exit = infinity;
+    for (int a = 0; a < 3; a++) {
+      auto inv_d = 1.0 / r.direction()[a];
+      auto t0 = (box_min[a] - r.origin()[a]) * inv_d;
+      auto t1 = (box_max[a] - r.origin()[a]) * inv_d;
+      if (inv_d < 0.0)
+        std::swap(t0, t1);
+      t_enter = fmax(t_enter, t0);
+      t_exit = fmin(t_exit, t1);
+    }
+    return t_enter < t_exit;
+  }
+
 public:
   point3 box_min;
   point3 box_max;
@@ -43,6 +43,17 @@ public:
     const override;
   virtual bool bounding_box(double time0, double time1, aabb& output_box)
     const override;
+  virtual bool occluded(const ray& r, double t_min, double t_max)
+    const override;
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    left->material_slots(slots);
+    if (right != left)
+      right->material_slots(slots);
+  }
+
+  // Recompute the boxes bottom up after objects moved, keeping the topology.
+  void refit(double time0, double time1);
 
 public:
   shared_ptr<hittable> left;
@@ -91,6 +102,18 @@ bvh_node::bvh_node(
   box = surrounding_box(box_left, box_right);
 }
 
+void bvh_node::refit(double time0, double time1) {
+  auto left_node = std::dynamic_pointer_cast<bvh_node>(left);
+  auto right_node = std::dynamic_pointer_cast<bvh_node>(right);
+  if (left_node) left_node->refit(time0, time1);
+  if (right_node && right != left) right_node->refit(time0, time1);
+
+  aabb box_left, box_right;
+  left->bounding_box(time0, time1, box_left);
+  right->bounding_box(time0, time1, box_right);
+  box = surrounding_box(box_left, box_right);
+}
+
 bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const {
   output_box = box;
   return true;
@@ -106,4 +129,12 @@ bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
   return hit_left || hit_right;
 }
 
+bool bvh_node::occluded(const ray& r, double t_min, double t_max) const {
+  if (!box.hit(r, t_min, t_max))
+    return false;
+
+  return left->occluded(r, t_min, t_max)
+    || (right != left && right->occluded(r, t_min, t_max));
+}
+
 #endif
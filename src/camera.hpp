@@ -35,12 +35,38 @@ public:
   }
 
   ray get_ray(double s, double t) const {
-    vec3 rd = lens_radius * random_in_unit_disk();
+    return get_ray(s, t, random_double(), random_double(), random_double());
+  }
+
+  // Like get_ray(s, t), with the lens position and shutter time chosen by
+  // uniform numbers in [0,1) from a sampler.
+  ray get_ray(double s, double t, double lens_u, double lens_v, double shutter) const {
+    vec3 rd = lens_radius * concentric_disk(lens_u, lens_v);
     vec3 offset = u * rd.x() + v * rd.y();
     //std::cerr << u << v << "offset: " << offset << "rd: " << rd << std::endl;
     return ray(origin + offset,
                lower_left_corner + s * horizontal + t * vertical - origin - offset,
-               random_double(time0, time1));
+               time0 + shutter*(time1 - time0));
+  }
+
+  // How the direction of a ray changes from one pixel to the next, across and
+  // up, for an image of the given size. Ignores the lens.
+  ray_differential differentials(int image_width, int image_height) const {
+    return { horizontal / (image_width-1), vertical / (image_height-1) };
+  }
+
+  // Where p appears in the image through the center of the lens, as the s
+  // and t get_ray() takes; false for points behind the camera.
+  bool project(const point3& p, double& s, double& t) const {
+    auto d = p - origin;
+    auto ahead = -dot(d, w);
+    if (ahead <= 0)
+      return false;
+    // Onto the plane of the image, focus_dist ahead.
+    auto q = origin + d * (-dot(lower_left_corner - origin, w) / ahead) - lower_left_corner;
+    s = dot(q, horizontal) / horizontal.length_squared();
+    t = dot(q, vertical) / vertical.length_squared();
+    return true;
   }
 
 private:
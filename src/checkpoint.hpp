@@ -0,0 +1,258 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "rtweekend.hpp"
+
+#include "framebuffer.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// random_double() draws from rand(), which glibc, like the BSDs, runs on
+// random()'s state. adopt() moves that state into an array of ours, seeded
+// as it is when nothing has called srand(), so a checkpoint can copy it.
+namespace rand_state {
+
+const int size = 128;
+
+inline std::int32_t* active() {
+  static std::int32_t state[size / 4];
+  return state;
+}
+
+// Before anything draws a random number.
+inline void adopt() {
+  initstate(1, reinterpret_cast<char*>(active()), size);
+}
+
+inline void save(char* out) {
+  // Switching to the array it is already on stores the position in it.
+  setstate(reinterpret_cast<char*>(active()));
+  memcpy(out, active(), size);
+}
+
+inline void load(const char* in) {
+  // Leave the array first, or switching back would store the position over
+  // the one loaded.
+  static std::int32_t scratch[size / 4];
+  initstate(1, reinterpret_cast<char*>(scratch), size);
+  memcpy(active(), in, size);
+  setstate(reinterpret_cast<char*>(active()));
+}
+
+}
+
+// Where a render is: samples [first_sample, last_sample) are being added to
+// every pixel, and the first rows_done rows from the top have them.
+struct render_progress {
+  std::uint32_t first_sample;
+  std::uint32_t last_sample;
+  std::uint32_t rows_done;
+  std::uint32_t reserved;
+  char random[rand_state::size];
+};
+
+// A mapped file holding the last checkpoint of a framebuffer render: a
+// header page, then two slots, each a render_progress with the sums and
+// sample counts of every pixel. A checkpoint is written to the slot not in
+// use and synced before the header switches to it, so a render stopped at
+// any point, even mid-write, resumes from a whole checkpoint.
+class checkpoint_file {
+public:
+  checkpoint_file() : fd(-1), map(nullptr), length(0) {}
+  ~checkpoint_file() { close(); }
+
+  checkpoint_file(const checkpoint_file&) = delete;
+  checkpoint_file& operator=(const checkpoint_file&) = delete;
+
+  // Creates or truncates path for a width x height render. settings names
+  // everything besides the sample count that the image depends on.
+  bool create(const std::string& path, int width, int height, const std::string& settings);
+
+  // Opens a file create() made with the same size and settings; otherwise
+  // says why not and returns false.
+  bool open(const std::string& path, int width, int height, const std::string& settings);
+
+  // The last checkpoint, into fb and progress.
+  void restore(framebuffer& fb, render_progress& progress) const;
+
+  bool save(const framebuffer& fb, const render_progress& progress);
+
+private:
+  struct header {
+    char magic[8];
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t active;   // slot of the last checkpoint
+    std::uint32_t valid;    // 0 until the first one
+    char settings[1000];
+  };
+
+  static size_t slot_bytes(int width, int height) {
+    auto bytes = sizeof(render_progress) + size_t(width) * height * (sizeof(color) + sizeof(int));
+    return (bytes + 4095) / 4096 * 4096;
+  }
+
+  bool map_file(const std::string& path, int flags, int width, int height);
+  void close();
+
+  header* top() const { return static_cast<header*>(map); }
+  unsigned char* slot(int index) const {
+    return static_cast<unsigned char*>(map) + 4096 + index * slot_bytes(top()->width, top()->height);
+  }
+
+  int fd;
+  void* map;
+  size_t length;
+};
+
+const char checkpoint_magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '1', 0 };
+
+bool checkpoint_file::map_file(const std::string& path, int flags, int width, int height) {
+  close();
+  fd = ::open(path.c_str(), flags, 0666);
+  if (fd < 0)
+    return false;
+
+  length = 4096 + 2 * slot_bytes(width, height);
+  struct stat info;
+  if ((flags & O_CREAT) && ftruncate(fd, length) != 0)
+    return false;
+  if (fstat(fd, &info) != 0 || size_t(info.st_size) != length)
+    return false;
+
+  map = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    map = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void checkpoint_file::close() {
+  if (map)
+    munmap(map, length);
+  if (fd >= 0)
+    ::close(fd);
+  map = nullptr;
+  fd = -1;
+}
+
+bool checkpoint_file::create(const std::string& path, int width, int height,
+                             const std::string& settings) {
+  if (settings.size() >= sizeof(header::settings)
+      || !map_file(path, O_RDWR | O_CREAT | O_TRUNC, width, height))
+    return false;
+
+  auto h = top();
+  memcpy(h->magic, checkpoint_magic, sizeof(checkpoint_magic));
+  h->width = width;
+  h->height = height;
+  h->active = 0;
+  h->valid = 0;
+  memset(h->settings, 0, sizeof(h->settings));
+  memcpy(h->settings, settings.data(), settings.size());
+  return msync(map, 4096, MS_SYNC) == 0;
+}
+
+bool checkpoint_file::open(const std::string& path, int width, int height,
+                           const std::string& settings) {
+  if (!map_file(path, O_RDWR, width, height)) {
+    std::cerr << "ERROR: '" << path << "' is not a checkpoint of a " << width << "x" << height
+              << " render.\n";
+    return false;
+  }
+
+  auto h = top();
+  if (memcmp(h->magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0
+      || h->width != unsigned(width) || h->height != unsigned(height) || !h->valid) {
+    std::cerr << "ERROR: '" << path << "' holds no checkpoint of a " << width << "x" << height
+              << " render.\n";
+    return false;
+  }
+  if (settings != std::string(h->settings, strnlen(h->settings, sizeof(h->settings)))) {
+    std::cerr << "ERROR: '" << path << "' was rendered with other settings: "
+              << std::string(h->settings, strnlen(h->settings, sizeof(h->settings))) << "\n";
+    return false;
+  }
+  return true;
+}
+
+void checkpoint_file::restore(framebuffer& fb, render_progress& progress) const {
+  auto at = slot(top()->active);
+  memcpy(&progress, at, sizeof(progress));
+  at += sizeof(progress);
+  memcpy(fb.sum.data(), at, fb.sum.size() * sizeof(color));
+  at += fb.sum.size() * sizeof(color);
+  memcpy(fb.samples.data(), at, fb.samples.size() * sizeof(int));
+}
+
+bool checkpoint_file::save(const framebuffer& fb, const render_progress& progress) {
+  static_assert(sizeof(color) == 3 * sizeof(double), "colors are copied as three doubles");
+
+  auto h = top();
+  int next = h->valid ? 1 - h->active : 0;
+  auto at = slot(next);
+  memcpy(at, &progress, sizeof(progress));
+  memcpy(at + sizeof(progress), fb.sum.data(), fb.sum.size() * sizeof(color));
+  memcpy(at + sizeof(progress) + fb.sum.size() * sizeof(color), fb.samples.data(),
+         fb.samples.size() * sizeof(int));
+  if (msync(at, slot_bytes(h->width, h->height), MS_SYNC) != 0)
+    return false;
+
+  h->active = next;
+  h->valid = 1;
+  return msync(map, 4096, MS_SYNC) == 0;
+}
+
+// Adds samples [first_sample, last_sample) of progress to every pixel of fb
+// from row rows_done on, a row at a time from the top, as main() renders.
+// Checkpoints after a row once interval seconds have passed since the last
+// one, and when done. The random state goes into every checkpoint and is
+// loaded from progress first, so a resumed render is bit for bit the render
+// that was stopped. sample(i, j, index) traces sample number index of pixel
+// (i, j), with row 0 at the bottom.
+bool render_with_checkpoints(framebuffer& fb, render_progress& progress, checkpoint_file& file,
+                             double interval, const std::function<color(int, int, int)>& sample) {
+  using clock = std::chrono::steady_clock;
+  auto last = clock::now();
+  auto checkpoint = [&]() {
+    rand_state::save(progress.random);
+    last = clock::now();
+    if (file.save(fb, progress))
+      return true;
+    std::cerr << "\nERROR: Could not write checkpoint.\n";
+    return false;
+  };
+
+  rand_state::load(progress.random);
+  for (; progress.rows_done < unsigned(fb.height); ) {
+    int j = fb.height-1 - progress.rows_done;
+    std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
+    for (int i = 0; i < fb.width; ++i) {
+      color pixel_color(0,0,0);
+      for (auto s = progress.first_sample; s < progress.last_sample; ++s)
+        pixel_color += sample(i, j, s);
+      fb.sum[j*fb.width + i] += pixel_color;
+      fb.samples[j*fb.width + i] += progress.last_sample - progress.first_sample;
+    }
+    progress.rows_done++;
+
+    if (std::chrono::duration<double>(clock::now() - last).count() >= interval
+        && progress.rows_done < unsigned(fb.height) && !checkpoint())
+      return false;
+  }
+  return checkpoint();
+}
+
+#endif
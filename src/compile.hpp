@@ -0,0 +1,68 @@
+#ifndef COMPILE_HPP
+#define COMPILE_HPP
+
+#include "rtweekend.hpp"
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "texture.hpp"
+
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+struct compile_stats {
+  size_t objects = 0;           // material slots visited
+  size_t materials = 0;         // distinct material objects found
+  size_t unique_materials = 0;  // left after merging equivalent ones
+  size_t texture_nodes = 0;
+};
+
+// Prepares a scene for rendering: compiles the textures of every material
+// into one shared texture_code, then points all objects whose materials are
+// equivalent at a single copy. Run it on the object list before building a
+// bvh_node or light sampler from it.
+compile_stats compile_scene(hittable& world) {
+  std::vector<shared_ptr<material>*> slots;
+  world.material_slots(slots);
+
+  auto code = make_shared<texture_code>();
+  std::unordered_map<const material*, shared_ptr<material>> replacement;
+  std::unordered_map<std::type_index, std::vector<shared_ptr<material>>> unique;
+
+  compile_stats stats;
+  for (auto slot : slots) {
+    if (!*slot)
+      continue;
+    stats.objects++;
+
+    auto found = replacement.find(slot->get());
+    if (found == replacement.end()) {
+      auto m = *slot;
+      m->compile(code);
+
+      auto& same_type = unique[std::type_index(typeid(*m))];
+      shared_ptr<material> shared;
+      for (const auto& u : same_type) {
+        if (u->equivalent(*m)) {
+          shared = u;
+          break;
+        }
+      }
+      if (!shared) {
+        shared = m;
+        same_type.push_back(m);
+        stats.unique_materials++;
+      }
+
+      stats.materials++;
+      found = replacement.emplace(m.get(), shared).first;
+    }
+    *slot = found->second;
+  }
+
+  stats.texture_nodes = code->size();
+  return stats;
+}
+
+#endif
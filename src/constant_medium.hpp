@@ -28,47 +28,56 @@ public:
     return boundary->bounding_box(time0, time1, output_box);
   }
 
+  // Scattering inside the medium is stochastic, so a shadow ray is blocked
+  // exactly when a regular hit would have scattered it.
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+    hit_record rec;
+    return hit(r, t_min, t_max, rec);
+  }
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    slots.push_back(&phase_function);
+  }
+
 public:
   shared_ptr<hittable> boundary;
   shared_ptr<material> phase_function;
   double neg_inv_density;
 };
 
+// The boundary is solved for its entry and exit once per ray, and rays that
+// leave before t_min or enter after t_max are rejected without drawing a
+// free-flight distance.
 bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-  hit_record rec1, rec2;
-
-  // Check to see if the we hit the boundary
-  if (!boundary->hit(r, -infinity, infinity, rec1))
-    return false;
-
-  // Check to see if we exit the boundary
-  if (!boundary->hit(r, rec1.t+0.0001, infinity, rec2))
+  double t_enter, t_exit;
+  if (!boundary->inside(r, t_enter, t_exit))
     return false;
 
   // Respect t_min & t_max
-  if (rec1.t < t_min) rec1.t = t_min;
-  if (rec2.t > t_max) rec2.t = t_max;
+  if (t_enter < t_min) t_enter = t_min;
+  if (t_exit > t_max) t_exit = t_max;
 
-  if (rec1.t >= rec2.t)
+  if (t_enter >= t_exit)
     return false;
 
-  if (rec1.t < 0)
-    rec1.t = 0;
+  if (t_enter < 0)
+    t_enter = 0;
 
   // How far in to the boundary do we get?
   const auto ray_length = r.direction().length();
-  const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-  const auto hit_distance = neg_inv_density * log(random_double());
+  const auto distance_inside_boundary = (t_exit - t_enter) * ray_length;
+  const auto hit_distance = neg_inv_density * shading_log(random_double());
 
   // We passed through the volume without scattering
   if (hit_distance > distance_inside_boundary)
     return false;
 
-  rec.t = rec1.t + hit_distance / ray_length;
+  rec.t = t_enter + hit_distance / ray_length;
   rec.p = r.at(rec.t);
 
   rec.normal = vec3(1,0,0);  // arbitrary
   rec.front_face = true;     // also arbitrary
+  rec.dpdu = rec.dpdv = vec3(0,0,0);
   rec.mat_ptr = phase_function;
 
   return true;
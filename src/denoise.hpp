@@ -0,0 +1,250 @@
+#ifndef DENOISE_HPP
+#define DENOISE_HPP
+
+#include "rtweekend.hpp"
+
+#include "aov.hpp"
+#include "color.hpp"
+#include "framebuffer.hpp"
+#include "parallel.hpp"
+
+#include <chrono>
+#include <vector>
+
+struct denoise_settings {
+  int iterations = 4;
+  float sigma_luminance = 4;   // in standard deviations of the pixel estimate
+  float sigma_depth = 0.02;    // relative depth change per pixel of distance
+};
+
+struct denoise_timings {
+  double prepare = 0;
+  double filter = 0;
+  double resolve = 0;
+};
+
+// A cheap stand-in for exp(-x), x >= 0: (1 - x/16)^16, clamped at zero.
+// It stays within 0.018 of exp(-x) and is only multiplies and a max, so
+// the filter loops vectorize. Edge-stopping weights do not need more.
+inline float edge_stop(float x) {
+  float y = 1.0f - x * (1.0f / 16);
+  y = y > 0 ? y : 0;
+  y *= y; y *= y; y *= y; y *= y;
+  return y;
+}
+
+// cosine^128 between two normals, by repeated squaring.
+inline float normal_stop(float cosine) {
+  float y = cosine;
+  y *= y; y *= y; y *= y; y *= y; y *= y; y *= y; y *= y;
+  return y;
+}
+
+// Accumulates one kernel tap for count pixels of a row: p* are the features
+// of the center pixels, q* the planes at the tap, s* the running weighted
+// sums, all from the first pixel. Kept free of branches and aliasing so it
+// vectorizes.
+inline void filter_taps(int count, float h, float inv_depth_scale,
+                        const float* __restrict pnx, const float* __restrict pny,
+                        const float* __restrict pnz, const float* __restrict pz,
+                        const float* __restrict pinvz, const float* __restrict pl,
+                        const float* __restrict pinvl,
+                        const float* __restrict qr, const float* __restrict qg,
+                        const float* __restrict qb, const float* __restrict qv,
+                        const float* __restrict qnx, const float* __restrict qny,
+                        const float* __restrict qnz, const float* __restrict qz,
+                        float* __restrict sr, float* __restrict sg, float* __restrict sb,
+                        float* __restrict sw, float* __restrict sv) {
+  for (int x = 0; x < count; x++) {
+    float cosine = pnx[x]*qnx[x] + pny[x]*qny[x] + pnz[x]*qnz[x];
+    float w_normal = normal_stop(cosine > 0 ? cosine : 0);
+
+    float w_depth = edge_stop(std::fabs(pz[x] - qz[x]) * pinvz[x] * inv_depth_scale);
+
+    float ql = 0.2126f*qr[x] + 0.7152f*qg[x] + 0.0722f*qb[x];
+    float w_luminance = edge_stop(std::fabs(pl[x] - ql) * pinvl[x]);
+
+    float w = h * w_normal * w_depth * w_luminance;
+    sr[x] += w * qr[x];
+    sg[x] += w * qg[x];
+    sb[x] += w * qb[x];
+    sw[x] += w;
+    sv[x] += w * w * qv[x];
+  }
+}
+
+// Feature-guided edge-avoiding à-trous wavelet filter, after Dammertz et al.
+// "Edge-Avoiding À-Trous Wavelet Transform for fast Global Illumination
+// Filtering" (2010), with the variance-driven luminance weight of SVGF
+// (Schied et al. 2017).
+//
+// Radiance is divided by the first-hit albedo before filtering and multiplied
+// back afterwards, so texture detail survives. Each iteration applies a 5x5
+// B3-spline kernel with taps spread 2^i pixels apart, weighted down across
+// normal, depth and luminance edges. Rows are filtered in parallel and the
+// inner loops run over contiguous float planes, so the compiler vectorizes
+// them.
+class denoiser {
+public:
+  denoiser(const framebuffer& fb, const aov_buffer& aovs) : width(fb.width), height(fb.height) {
+    auto n = width * height;
+    for (auto plane : { &r, &g, &b, &variance, &nx, &ny, &nz, &depth, &inv_depth, &ar, &ag, &ab })
+      plane->resize(n);
+
+    for (int p = 0; p < n; p++) {
+      double count = std::max(fb.samples[p], 1);
+      auto a = aovs.albedo[p] / count;
+      auto normal = aovs.normal[p] / count;
+      auto length = normal.length();
+      if (length > 0)
+        normal /= length;
+
+      ar[p] = demodulation(a.x());
+      ag[p] = demodulation(a.y());
+      ab[p] = demodulation(a.z());
+
+      auto c = fb.sum[p] / count;
+      r[p] = c.x() / ar[p];
+      g[p] = c.y() / ag[p];
+      b[p] = c.z() / ab[p];
+
+      // Variance of the pixel mean, scaled into demodulated units.
+      auto mean = aovs.luminance[p] / count;
+      auto var = std::max(0.0, aovs.luminance_squared[p] / count - mean*mean) / count;
+      auto albedo_luminance = 0.2126f*ar[p] + 0.7152f*ag[p] + 0.0722f*ab[p];
+      variance[p] = var / (albedo_luminance * albedo_luminance);
+
+      nx[p] = normal.x();
+      ny[p] = normal.y();
+      nz[p] = normal.z();
+      depth[p] = aovs.depth[p] / count;
+      inv_depth[p] = 1.0f / std::max(depth[p], 1e-3f);
+    }
+  }
+
+  std::vector<color> run(const denoise_settings& settings, denoise_timings& timings);
+
+private:
+  // Albedo to divide out; near black albedo is left alone.
+  static float demodulation(double a) {
+    return a < 1e-3 ? 1.0f : float(a);
+  }
+
+  void filter_row(int y, int step, const denoise_settings& settings,
+                  std::vector<float>& out_r, std::vector<float>& out_g,
+                  std::vector<float>& out_b, std::vector<float>& out_variance) const;
+
+  int width, height;
+  std::vector<float> r, g, b, variance;
+  std::vector<float> nx, ny, nz, depth, inv_depth;
+  std::vector<float> ar, ag, ab;
+};
+
+void denoiser::filter_row(int y, int step, const denoise_settings& settings,
+                          std::vector<float>& out_r, std::vector<float>& out_g,
+                          std::vector<float>& out_b, std::vector<float>& out_variance) const {
+  static const float kernel[5] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+
+  std::vector<float> sum_r(width, 0.0f), sum_g(width, 0.0f), sum_b(width, 0.0f);
+  std::vector<float> sum_w(width, 0.0f), sum_variance(width, 0.0f);
+  std::vector<float> inv_sigma_l(width), lum(width);
+
+  // The luminance edge-stop is scaled by the standard deviation of the center
+  // pixel, from a 3x3 blur of the variance since single pixels estimate it
+  // poorly.
+  const int row = y*width;
+  for (int x = 0; x < width; x++) {
+    auto p = row + x;
+    lum[x] = 0.2126f*r[p] + 0.7152f*g[p] + 0.0722f*b[p];
+
+    float blurred = 0, weight = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dx = -1; dx <= 1; dx++) {
+        int xx = x + dx, yy = y + dy;
+        if (xx < 0 || xx >= width || yy < 0 || yy >= height)
+          continue;
+        float k = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+        blurred += k * variance[yy*width + xx];
+        weight += k;
+      }
+    }
+    inv_sigma_l[x] = 1.0f / (settings.sigma_luminance * sqrt(blurred / weight) + 1e-4f);
+  }
+
+  for (int dy = -2; dy <= 2; dy++) {
+    int yy = y + dy*step;
+    if (yy < 0 || yy >= height)
+      continue;
+
+    for (int dx = -2; dx <= 2; dx++) {
+      const int offset = dx*step;
+      const float h = kernel[dx+2] * kernel[dy+2];
+      const float inv_depth_scale =
+        1.0f / (settings.sigma_depth * step * sqrt(float(dx*dx + dy*dy)) + 1e-4f);
+
+      // Taps outside the image are skipped, only the interior span is walked,
+      // from its first pixel so no pointer leaves the planes.
+      const int x0 = std::max(0, -offset);
+      const int x1 = std::min(width, width - offset);
+      if (x1 <= x0)
+        continue;
+
+      const int p = row + x0, q = yy*width + x0 + offset;
+      filter_taps(x1 - x0, h, inv_depth_scale,
+                  &nx[p], &ny[p], &nz[p], &depth[p], &inv_depth[p],
+                  &lum[x0], &inv_sigma_l[x0],
+                  &r[q], &g[q], &b[q], &variance[q], &nx[q], &ny[q], &nz[q], &depth[q],
+                  &sum_r[x0], &sum_g[x0], &sum_b[x0], &sum_w[x0], &sum_variance[x0]);
+    }
+  }
+
+  for (int x = 0; x < width; x++) {
+    auto p = row + x;
+    if (sum_w[x] > 0) {
+      out_r[p] = sum_r[x] / sum_w[x];
+      out_g[p] = sum_g[x] / sum_w[x];
+      out_b[p] = sum_b[x] / sum_w[x];
+      out_variance[p] = sum_variance[x] / (sum_w[x] * sum_w[x]);
+    } else {
+      out_r[p] = r[p];
+      out_g[p] = g[p];
+      out_b[p] = b[p];
+      out_variance[p] = variance[p];
+    }
+  }
+}
+
+std::vector<color> denoiser::run(const denoise_settings& settings, denoise_timings& timings) {
+  using clock = std::chrono::steady_clock;
+  auto seconds = [](clock::time_point start) {
+    return std::chrono::duration<double>(clock::now() - start).count();
+  };
+
+  auto start = clock::now();
+  auto n = width * height;
+  std::vector<float> next_r(n), next_g(n), next_b(n), next_variance(n);
+  timings.prepare += seconds(start);
+
+  start = clock::now();
+  for (int i = 0; i < settings.iterations; i++) {
+    int step = 1 << i;
+    parallel_for(0, height, [&](int y) {
+      filter_row(y, step, settings, next_r, next_g, next_b, next_variance);
+    });
+    r.swap(next_r);
+    g.swap(next_g);
+    b.swap(next_b);
+    variance.swap(next_variance);
+  }
+  timings.filter += seconds(start);
+
+  start = clock::now();
+  std::vector<color> result(n);
+  for (int p = 0; p < n; p++)
+    result[p] = color(r[p]*ar[p], g[p]*ag[p], b[p]*ab[p]);
+  timings.resolve += seconds(start);
+
+  return result;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef DISTRIBUTION_HPP
+#define DISTRIBUTION_HPP
+
+#include "rtweekend.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// A piecewise-constant density over [0,1) built from n non-negative function
+// values, sampled by inverting its cumulative distribution.
+class distribution_1d {
+public:
+  distribution_1d() : integral(0) {}
+
+  distribution_1d(const double* f, int n) : func(f, f + n), cdf(n + 1) {
+    cdf[0] = 0;
+    for (int i = 1; i <= n; i++)
+      cdf[i] = cdf[i-1] + func[i-1] / n;
+
+    integral = cdf[n];
+    if (integral <= 0) {
+      // Nothing to importance sample, fall back to uniform.
+      for (int i = 1; i <= n; i++)
+        cdf[i] = double(i) / n;
+    } else {
+      for (int i = 1; i <= n; i++)
+        cdf[i] /= integral;
+    }
+  }
+
+  int count() const { return func.size(); }
+
+  // Returns a point in [0,1) distributed by the density, along with its pdf
+  // and the index of the segment it fell in.
+  double sample(double u, double& pdf, int& offset) const {
+    offset = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin() - 1;
+    offset = std::max(0, std::min(count() - 1, offset));
+
+    auto du = u - cdf[offset];
+    auto width = cdf[offset+1] - cdf[offset];
+    if (width > 0)
+      du /= width;
+
+    pdf = segment_pdf(offset);
+    return (offset + du) / count();
+  }
+
+  double segment_pdf(int offset) const {
+    return integral > 0 ? func[offset] / integral : 1.0;
+  }
+
+public:
+  std::vector<double> func;
+  std::vector<double> cdf;
+  double integral;
+};
+
+// A piecewise-constant density over [0,1)^2 from a grid of nu x nv values:
+// a marginal distribution picks the row, then that row's conditional picks u.
+class distribution_2d {
+public:
+  distribution_2d() {}
+
+  distribution_2d(const double* f, int nu, int nv) {
+    std::vector<double> row_integrals;
+    for (int v = 0; v < nv; v++) {
+      conditional.push_back(distribution_1d(f + v*nu, nu));
+      row_integrals.push_back(conditional.back().integral);
+    }
+    marginal = distribution_1d(row_integrals.data(), nv);
+  }
+
+  void sample(double u1, double u2, double& u, double& v, double& pdf) const {
+    double pdf_u, pdf_v;
+    int row, column;
+    v = marginal.sample(u2, pdf_v, row);
+    u = conditional[row].sample(u1, pdf_u, column);
+    pdf = pdf_u * pdf_v;
+  }
+
+  double pdf(double u, double v) const {
+    int nu = conditional[0].count();
+    int nv = marginal.count();
+    int iu = std::max(0, std::min(static_cast<int>(u * nu), nu - 1));
+    int iv = std::max(0, std::min(static_cast<int>(v * nv), nv - 1));
+    return marginal.segment_pdf(iv) * conditional[iv].segment_pdf(iu);
+  }
+
+public:
+  std::vector<distribution_1d> conditional;
+  distribution_1d marginal;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef ENVIRONMENT_HPP
+#define ENVIRONMENT_HPP
+
+#include "rtweekend.hpp"
+#include "rtw_stb_image.hpp"
+
+#include "color.hpp"
+#include "distribution.hpp"
+#include "lights.hpp"
+
+#include <iostream>
+#include <vector>
+
+// What a ray sees when it leaves the scene. Either a constant color, as the
+// background always was, or an HDR equirectangular image. Images carry a
+// luminance distribution over their texels so they can be sampled as a light.
+class environment {
+public:
+  environment(color c = color(0,0,0)) : constant(c), width(0), height(0) {}
+
+  environment(const char* filename, double intensity = 1.0) : constant(0,1,1), width(0), height(0) {
+    int components_per_pixel = 3;
+    float* data = stbi_loadf(filename, &width, &height, &components_per_pixel, 3);
+
+    if (!data) {
+      // Solid cyan for debug, like a missing image_texture.
+      std::cerr << "ERROR: Could not load environment image file '" << filename << "'.\n";
+      width = height = 0;
+      return;
+    }
+
+    texels.resize(width * height);
+    for (int i = 0; i < width * height; i++)
+      texels[i] = intensity * color(data[3*i], data[3*i+1], data[3*i+2]);
+    stbi_image_free(data);
+
+    build_distribution();
+  }
+
+  // An environment from already decoded linear texels, in rows from the top.
+  environment(const std::vector<color>& pixels, int w, int h)
+    : constant(0,0,0), texels(pixels), width(w), height(h) {
+    build_distribution();
+  }
+
+  // A daylight sky without an image file: blue overhead, white at the
+  // horizon, dim ground below it, and a small sun towards sun_direction that
+  // lights most of the scene.
+  static environment daylight(const vec3& sun_direction, int w = 512, int h = 256);
+
+  // Only image environments are worth sampling explicitly, constant colors
+  // are left to BSDF sampling as before.
+  bool sampled() const { return !texels.empty(); }
+
+  color value(const vec3& direction) const {
+    if (texels.empty())
+      return constant;
+
+    double u, v;
+    direction_to_uv(unit_vector(direction), u, v);
+    auto i = std::min(static_cast<int>(u * width), width - 1);
+    auto j = std::min(static_cast<int>(v * height), height - 1);
+    return texels[j*width + i];
+  }
+
+  // Picks a direction in proportion to the brightness of the environment.
+  vec3 sample(double& pdf) const {
+    double u, v, uv_pdf;
+    distribution.sample(random_double(), random_double(), u, v, uv_pdf);
+
+    auto theta = v * pi;
+    auto sin_theta = sin(theta);
+    pdf = sin_theta > 0 ? uv_pdf / (2*pi*pi*sin_theta) : 0;
+    return uv_to_direction(u, v);
+  }
+
+  // A light sample towards the environment, which is infinitely far away.
+  bool sample(light_sample& ls) const {
+    if (texels.empty())
+      return false;
+
+    ls.direction = sample(ls.pdf);
+    ls.distance = infinity;
+    ls.emitted = value(ls.direction);
+    return ls.pdf > 0;
+  }
+
+  // Solid angle density of sample() returning direction.
+  double pdf_value(const vec3& direction) const {
+    if (texels.empty())
+      return 0;
+
+    double u, v;
+    auto d = unit_vector(direction);
+    direction_to_uv(d, u, v);
+    auto sin_theta = sqrt(fmax(0.0, 1 - d.y()*d.y()));
+    if (sin_theta <= 0)
+      return 0;
+    return distribution.pdf(u, v) / (2*pi*pi*sin_theta);
+  }
+
+private:
+  // Same longitude convention as sphere::get_sphere_uv, but v runs from the
+  // top row of the image (+Y) down.
+  static void direction_to_uv(const vec3& d, double& u, double& v) {
+    auto theta = acos(clamp(d.y(), -1.0, 1.0));
+    auto phi = atan2(-d.z(), d.x()) + pi;
+    u = phi / (2*pi);
+    v = theta / pi;
+  }
+
+  static vec3 uv_to_direction(double u, double v) {
+    auto theta = v * pi;
+    auto phi = u * 2*pi - pi;
+    return vec3(sin(theta)*cos(phi), cos(theta), -sin(theta)*sin(phi));
+  }
+
+  void build_distribution() {
+    // Weight each texel by the solid angle it covers, which shrinks towards
+    // the poles of the equirectangular mapping.
+    std::vector<double> weights(width * height);
+    for (int j = 0; j < height; j++) {
+      auto sin_theta = sin(pi * (j + 0.5) / height);
+      for (int i = 0; i < width; i++) {
+        weights[j*width + i] = luminance(texels[j*width + i]) * sin_theta;
+      }
+    }
+    distribution = distribution_2d(weights.data(), width, height);
+  }
+
+private:
+  color constant;
+  std::vector<color> texels;
+  int width, height;
+  distribution_2d distribution;
+};
+
+environment environment::daylight(const vec3& sun_direction, int w, int h) {
+  auto sun = unit_vector(sun_direction);
+  auto sun_cos = cos(degrees_to_radians(2.0));
+  std::vector<color> pixels(size_t(w) * h);
+  for (int j = 0; j < h; j++) {
+    for (int i = 0; i < w; i++) {
+      auto d = uv_to_direction((i + 0.5) / w, (j + 0.5) / h);
+      auto c = d.y() > 0 ? 0.6*((1 - d.y())*color(1, 1, 1) + d.y()*color(0.3, 0.5, 1.0))
+                         : color(0.3, 0.3, 0.3);
+      if (dot(d, sun) > sun_cos)
+        c += color(1.0, 0.95, 0.85) * 300;
+      pixels[size_t(j) * w + i] = c;
+    }
+  }
+  return environment(pixels, w, h);
+}
+
+#endif
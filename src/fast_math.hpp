@@ -0,0 +1,203 @@
+#ifndef FAST_MATH_HPP
+#define FAST_MATH_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Polynomial replacements for the libm calls of the shading hot path. They
+// are branch free, so loops over them vectorize (see the *_lanes kernels),
+// and the error bounds below hold for all finite inputs in range, as
+// measured by `bench fastmath`:
+//
+//   poly_sincos  |x| < 1.6e6   absolute error < 3e-14
+//   poly_log     x > 0, normal relative error < 2e-15, absolute below x = e
+//   poly_acos    |x| <= 1      absolute error < 3e-8
+//   poly_atan2   finite y, x   absolute error < 1e-11
+//
+// Past 1.6e6 poly_sincos degrades as k * pi/2 stops being exact; poly_log(0)
+// is -infinity.
+
+namespace fast_math_detail {
+
+// Adding then subtracting 1.5 * 2^52 rounds to the nearest integer, which
+// is left in the low bits of the sum.
+const double round_shift = 6755399441055744.0;
+
+inline std::uint64_t bits_of(double x) {
+  std::uint64_t b;
+  memcpy(&b, &x, sizeof(b));
+  return b;
+}
+
+inline double from_bits(std::uint64_t b) {
+  double x;
+  memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+}
+
+// sin and cos of x together: x reduced by multiples of pi/2 into
+// [-pi/4, pi/4], where Taylor series to r^13 and r^14 are exact to 1e-14.
+inline void poly_sincos(double x, double& s, double& c) {
+  using namespace fast_math_detail;
+
+  // pi/2 in three parts of 33 bits, so k times each is exact for k < 2^20
+  // (fdlibm's pio2_1, pio2_2, pio2_3).
+  const double pi_2_hi = 1.57079632673412561417e+00;
+  const double pi_2_mid = 6.07710050630396597660e-11;
+  const double pi_2_lo = 2.02226624871116645580e-21;
+
+  auto shifted = x * 0.63661977236758134 + round_shift;
+  auto k = shifted - round_shift;
+  auto quadrant = bits_of(shifted) & 3;
+  auto r = ((x - k * pi_2_hi) - k * pi_2_mid) - k * pi_2_lo;
+  auto r2 = r * r;
+
+  auto sin_r = r + r * r2 * (-1.0/6 + r2 * (1.0/120 + r2 * (-1.0/5040
+    + r2 * (1.0/362880 + r2 * (-1.0/39916800 + r2 * (1.0/6227020800))))));
+  auto cos_r = 1 + r2 * (-0.5 + r2 * (1.0/24 + r2 * (-1.0/720 + r2 * (1.0/40320
+    + r2 * (-1.0/3628800 + r2 * (1.0/479001600 + r2 * (-1.0/87178291200)))))));
+
+  // Quadrants 1 and 3 swap sin and cos; 2 and 3 negate sin, 1 and 2 cos.
+  // Done on the bits, as the vectorizer will not select doubles by integers.
+  auto swap = ~(quadrant & 1) + 1;
+  auto sin_bits = bits_of(sin_r), cos_bits = bits_of(cos_r);
+  auto sa = (swap & cos_bits) | (~swap & sin_bits);
+  auto ca = (swap & sin_bits) | (~swap & cos_bits);
+  s = from_bits(sa ^ ((quadrant & 2) << 62));
+  c = from_bits(ca ^ (((quadrant + 1) & 2) << 62));
+}
+
+inline double poly_sin(double x) {
+  double s, c;
+  poly_sincos(x, s, c);
+  return s;
+}
+
+inline double poly_cos(double x) {
+  double s, c;
+  poly_sincos(x, s, c);
+  return c;
+}
+
+// x = m * 2^e with m in [sqrt(1/2), sqrt(2)), log(m) = 2 atanh((m-1)/(m+1))
+// by its series to the 17th power.
+inline double poly_log(double x) {
+  using namespace fast_math_detail;
+
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+
+  auto b = bits_of(x);
+  auto e = double(int((b >> 52) & 0x7ff) - 1023);
+  auto m = from_bits((b & 0x000fffffffffffffull) | 0x3ff0000000000000ull);
+  auto big = m > 1.4142135623730951;
+  m = big ? 0.5 * m : m;
+  e = big ? e + 1 : e;
+
+  auto s = (m - 1) / (m + 1);
+  auto s2 = s * s;
+  auto series = 2 * s * (1 + s2 * (1.0/3 + s2 * (1.0/5 + s2 * (1.0/7 + s2 * (1.0/9
+    + s2 * (1.0/11 + s2 * (1.0/13 + s2 * (1.0/15 + s2 * (1.0/17)))))))));
+  auto result = e * ln2_hi + (series + e * ln2_lo);
+  return x > 0 ? result : -HUGE_VAL;
+}
+
+// Abramowitz and Stegun 4.4.46, for |x| <= 1.
+inline double poly_acos(double x) {
+  auto a = fabs(x);
+  auto r = sqrt(1 - a) * (1.5707963050 + a * (-0.2145988016 + a * (0.0889789874
+    + a * (-0.0501743046 + a * (0.0308918810 + a * (-0.0170881256
+    + a * (0.0066700901 + a * -0.0012624911)))))));
+  return x < 0 ? 3.14159265358979323846 - r : r;
+}
+
+// The ratio of the smaller to the larger of |y| and |x| is brought below
+// tan(pi/8) by atan(a) = pi/4 + atan((a-1)/(a+1)), then Taylor to t^23.
+inline double poly_atan2(double y, double x) {
+  const double pi = 3.14159265358979323846;
+
+  auto ax = fabs(x), ay = fabs(y);
+  auto large = ax > ay ? ax : ay, small = ax > ay ? ay : ax;
+  auto a = large > 0 ? small / large : 0.0;
+
+  auto reduce = a > 0.41421356237309503;
+  auto t = reduce ? (a - 1) / (a + 1) : a;
+  auto t2 = t * t;
+  auto atan_t = t + t * t2 * (-1.0/3 + t2 * (1.0/5 + t2 * (-1.0/7 + t2 * (1.0/9
+    + t2 * (-1.0/11 + t2 * (1.0/13 + t2 * (-1.0/15 + t2 * (1.0/17 + t2 * (-1.0/19
+    + t2 * (1.0/21 + t2 * (-1.0/23)))))))))));
+  auto r = reduce ? pi/4 + atan_t : atan_t;
+
+  r = ay > ax ? pi/2 - r : r;
+  r = x < 0 ? pi - r : r;
+  return y < 0 ? -r : r;
+}
+
+// The polynomials over arrays, for callers with a batch of arguments. Kept
+// free of aliasing so the loops vectorize.
+inline void poly_sincos_lanes(int n, const double* __restrict x, double* __restrict s,
+                              double* __restrict c) {
+  for (int i = 0; i < n; i++)
+    poly_sincos(x[i], s[i], c[i]);
+}
+
+inline void poly_log_lanes(int n, const double* __restrict x, double* __restrict out) {
+  for (int i = 0; i < n; i++)
+    out[i] = poly_log(x[i]);
+}
+
+inline void poly_acos_lanes(int n, const double* __restrict x, double* __restrict out) {
+  for (int i = 0; i < n; i++)
+    out[i] = poly_acos(x[i]);
+}
+
+inline void poly_atan2_lanes(int n, const double* __restrict y, const double* __restrict x,
+                             double* __restrict out) {
+  for (int i = 0; i < n; i++)
+    out[i] = poly_atan2(y[i], x[i]);
+}
+
+// Which of the two the shading code calls through the shading_* functions.
+// Exact renders are bit for bit those of libm.
+enum class math_mode { exact, fast };
+
+math_mode shading_math = math_mode::exact;
+
+inline void shading_sincos(double x, double& s, double& c) {
+  if (shading_math == math_mode::fast) {
+    poly_sincos(x, s, c);
+  } else {
+    s = sin(x);
+    c = cos(x);
+  }
+}
+
+inline double shading_sin(double x) {
+  return shading_math == math_mode::fast ? poly_sin(x) : sin(x);
+}
+
+inline double shading_log(double x) {
+  return shading_math == math_mode::fast ? poly_log(x) : log(x);
+}
+
+inline double shading_acos(double x) {
+  return shading_math == math_mode::fast ? poly_acos(x) : acos(x);
+}
+
+inline double shading_atan2(double y, double x) {
+  return shading_math == math_mode::fast ? poly_atan2(y, x) : atan2(y, x);
+}
+
+// x^5, which pow() takes the general path for.
+inline double shading_pow5(double x) {
+  if (shading_math == math_mode::fast) {
+    auto x2 = x * x;
+    return x2 * x2 * x;
+  }
+  return pow(x, 5);
+}
+
+#endif
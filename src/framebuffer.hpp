@@ -0,0 +1,49 @@
+#ifndef FRAMEBUFFER_HPP
+#define FRAMEBUFFER_HPP
+
+#include "rtweekend.hpp"
+
+#include "color.hpp"
+#include "image_output.hpp"
+
+#include <iostream>
+#include <vector>
+
+// Accumulated radiance and sample count per pixel, for renders that visit
+// pixels more than once. Row 0 is the bottom of the image, as in main().
+struct framebuffer {
+  framebuffer(int w, int h) : width(w), height(h), sum(w*h), samples(w*h, 0) {}
+
+  void add(int i, int j, const color& c) {
+    sum[j*width + i] += c;
+    samples[j*width + i]++;
+  }
+
+  long total_samples() const {
+    long total = 0;
+    for (int n : samples)
+      total += n;
+    return total;
+  }
+
+  // Each pixel normalized by the samples it received.
+  float_image resolve() const {
+    float_image image(width, height);
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i)
+        image.set(i, height-1 - j, sum[j*width + i] * (1.0 / std::max(samples[j*width + i], 1)));
+    }
+    return image;
+  }
+
+  // Writes a P3 image of resolve().
+  void write_ppm(std::ostream& out) const {
+    write_image(out, resolve(), image_format::p3);
+  }
+
+  int width, height;
+  std::vector<color> sum;
+  std::vector<int> samples;
+};
+
+#endif
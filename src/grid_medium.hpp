@@ -0,0 +1,348 @@
+#ifndef GRID_MEDIUM_HPP
+#define GRID_MEDIUM_HPP
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "texture.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// Densities on a grid of voxels, interpolated trilinearly between the voxel
+// centers. Grid coordinates run from 0 to the voxel count along each axis.
+class density_grid {
+public:
+  density_grid(int x, int y, int z) : nx(x), ny(y), nz(z) {}
+  virtual ~density_grid() {}
+
+  // Value of voxel (x, y, z), which must lie inside the grid.
+  virtual float voxel(int x, int y, int z) const = 0;
+
+  double density(const point3& g) const {
+    auto x = g.x() - 0.5, y = g.y() - 0.5, z = g.z() - 0.5;
+    int i = int(floor(x)), j = int(floor(y)), k = int(floor(z));
+    auto fx = x - i, fy = y - j, fz = z - k;
+
+    double sum = 0;
+    for (int dk = 0; dk < 2; dk++) {
+      for (int dj = 0; dj < 2; dj++) {
+        for (int di = 0; di < 2; di++) {
+          auto w = (di ? fx : 1 - fx) * (dj ? fy : 1 - fy) * (dk ? fz : 1 - fz);
+          sum += w * voxel(std::min(std::max(i + di, 0), nx - 1),
+                           std::min(std::max(j + dj, 0), ny - 1),
+                           std::min(std::max(k + dk, 0), nz - 1));
+        }
+      }
+    }
+    return sum;
+  }
+
+public:
+  int nx, ny, nz;
+};
+
+typedef std::function<float(int, int, int)> voxel_function;
+
+// Every voxel stored, x fastest.
+class dense_grid : public density_grid {
+public:
+  dense_grid(int x, int y, int z, std::vector<float> v)
+    : density_grid(x, y, z), values(std::move(v)) {}
+
+  dense_grid(int x, int y, int z, const voxel_function& f)
+    : density_grid(x, y, z), values(size_t(x) * y * z) {
+    for (int k = 0; k < nz; k++)
+      for (int j = 0; j < ny; j++)
+        for (int i = 0; i < nx; i++)
+          values[(size_t(k) * ny + j) * nx + i] = f(i, j, k);
+  }
+
+  virtual float voxel(int x, int y, int z) const override {
+    return values[(size_t(z) * ny + y) * nx + x];
+  }
+
+public:
+  std::vector<float> values;
+};
+
+// Voxels stored in 8x8x8 bricks, keeping only bricks with a nonzero voxel,
+// for media that fill a small part of their bounds.
+class brick_grid : public density_grid {
+public:
+  static const int brick = 8;
+
+  brick_grid(int x, int y, int z, const voxel_function& f);
+
+  virtual float voxel(int x, int y, int z) const override {
+    auto b = bricks[brick_index(x / brick, y / brick, z / brick)];
+    if (b < 0)
+      return 0;
+    return values[size_t(b) + ((z % brick) * brick + y % brick) * brick + x % brick];
+  }
+
+  size_t stored_bricks() const { return values.size() / (brick*brick*brick); }
+
+private:
+  int brick_index(int bx, int by, int bz) const {
+    return (bz * bricks_y + by) * bricks_x + bx;
+  }
+
+  int bricks_x, bricks_y, bricks_z;
+  std::vector<int> bricks;    // offset of each brick's voxels, -1 when empty
+  std::vector<float> values;
+};
+
+brick_grid::brick_grid(int x, int y, int z, const voxel_function& f)
+  : density_grid(x, y, z) {
+  bricks_x = (nx + brick - 1) / brick;
+  bricks_y = (ny + brick - 1) / brick;
+  bricks_z = (nz + brick - 1) / brick;
+  bricks.assign(size_t(bricks_x) * bricks_y * bricks_z, -1);
+
+  std::vector<float> block(brick*brick*brick);
+  for (int bz = 0; bz < bricks_z; bz++) {
+    for (int by = 0; by < bricks_y; by++) {
+      for (int bx = 0; bx < bricks_x; bx++) {
+        bool empty = true;
+        for (int k = 0; k < brick; k++) {
+          for (int j = 0; j < brick; j++) {
+            for (int i = 0; i < brick; i++) {
+              int gx = bx*brick + i, gy = by*brick + j, gz = bz*brick + k;
+              auto v = gx < nx && gy < ny && gz < nz ? f(gx, gy, gz) : 0.0f;
+              block[(k * brick + j) * brick + i] = v;
+              empty = empty && v == 0;
+            }
+          }
+        }
+        if (empty)
+          continue;
+        bricks[brick_index(bx, by, bz)] = values.size();
+        values.insert(values.end(), block.begin(), block.end());
+      }
+    }
+  }
+}
+
+// A heterogeneous medium filling an axis-aligned box, with the density of a
+// voxel grid stretched over it and scattering by the isotropic phase function.
+//
+// Free flights are sampled by delta tracking ("Woodcock" tracking) and shadow
+// rays estimate transmittance by ratio tracking, after Novák et al., "Monte
+// Carlo Methods for Volumetric Light Transport Simulation" (2018). Both walk a
+// coarse grid of majorants, the largest density within each 8^3 block of
+// voxels, with a 3D DDA: blocks with no density are stepped over without a
+// single lookup, and the others draw tentative collisions at their own
+// majorant rather than the global one.
+class grid_medium : public hittable {
+public:
+  grid_medium(shared_ptr<density_grid> g, const aabb& box, double density_scale,
+              shared_ptr<texture> a)
+    : grid(g), bounds(box), scale(density_scale), phase_function(make_shared<isotropic>(a)) {
+    build_majorants();
+  }
+
+  grid_medium(shared_ptr<density_grid> g, const aabb& box, double density_scale, color c)
+    : grid(g), bounds(box), scale(density_scale), phase_function(make_shared<isotropic>(c)) {
+    build_majorants();
+  }
+
+  virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+  virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+    output_box = bounds;
+    return true;
+  }
+
+  // Blocked with probability one minus the ratio tracking transmittance,
+  // which is what delta tracking would give, with fewer lookups on average.
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+    return random_double() >= transmittance(r, t_min, t_max);
+  }
+
+  double transmittance(const ray& r, double t_min, double t_max) const;
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    slots.push_back(&phase_function);
+  }
+
+public:
+  shared_ptr<density_grid> grid;
+  aabb bounds;
+  double scale;
+  shared_ptr<material> phase_function;
+
+private:
+  static const int block = 8;
+
+  void build_majorants();
+  bool clip(const ray& r, double& t_min, double& t_max) const;
+
+  // Calls visit(t0, t1, majorant) for the blocks r crosses between t_min and
+  // t_max, in order, until visit returns false.
+  template <class F>
+  void walk(const ray& r, double t_min, double t_max, F visit) const;
+
+  point3 to_grid(const point3& p) const {
+    return point3((p.x() - bounds.min().x()) * grid_scale.x(),
+                  (p.y() - bounds.min().y()) * grid_scale.y(),
+                  (p.z() - bounds.min().z()) * grid_scale.z());
+  }
+
+  vec3 grid_scale;            // voxels per world unit
+  int blocks[3];
+  std::vector<float> majorants;
+};
+
+void grid_medium::build_majorants() {
+  auto extent = bounds.max() - bounds.min();
+  grid_scale = vec3(grid->nx / extent.x(), grid->ny / extent.y(), grid->nz / extent.z());
+  int n[3] = { grid->nx, grid->ny, grid->nz };
+  for (int a = 0; a < 3; a++)
+    blocks[a] = (n[a] + block - 1) / block;
+  majorants.assign(size_t(blocks[0]) * blocks[1] * blocks[2], 0);
+
+  // Interpolation reaches one voxel past a block on each side.
+  for (int bz = 0; bz < blocks[2]; bz++) {
+    for (int by = 0; by < blocks[1]; by++) {
+      for (int bx = 0; bx < blocks[0]; bx++) {
+        float m = 0;
+        for (int z = std::max(0, bz*block - 1); z < std::min(n[2], (bz+1)*block + 1); z++)
+          for (int y = std::max(0, by*block - 1); y < std::min(n[1], (by+1)*block + 1); y++)
+            for (int x = std::max(0, bx*block - 1); x < std::min(n[0], (bx+1)*block + 1); x++)
+              m = std::max(m, grid->voxel(x, y, z));
+        majorants[(size_t(bz) * blocks[1] + by) * blocks[0] + bx] = m * scale;
+      }
+    }
+  }
+}
+
+bool grid_medium::clip(const ray& r, double& t_min, double& t_max) const {
+  for (int a = 0; a < 3; a++) {
+    auto inv_d = 1.0 / r.direction()[a];
+    auto t0 = (bounds.min()[a] - r.origin()[a]) * inv_d;
+    auto t1 = (bounds.max()[a] - r.origin()[a]) * inv_d;
+    if (inv_d < 0.0)
+      std::swap(t0, t1);
+    t_min = fmax(t_min, t0);
+    t_max = fmin(t_max, t1);
+  }
+  return t_min < t_max;
+}
+
+template <class F>
+void grid_medium::walk(const ray& r, double t_min, double t_max, F visit) const {
+  if (!clip(r, t_min, t_max))
+    return;
+
+  // Work in block units, where every block is a unit cube.
+  auto origin = to_grid(r.origin()) / block;
+  vec3 direction(r.direction().x() * grid_scale.x() / block,
+                 r.direction().y() * grid_scale.y() / block,
+                 r.direction().z() * grid_scale.z() / block);
+
+  auto start = origin + t_min * direction;
+  int cell[3], step[3];
+  double t_next[3], t_delta[3];
+  for (int a = 0; a < 3; a++) {
+    cell[a] = std::min(std::max(int(floor(start[a])), 0), blocks[a] - 1);
+    if (direction[a] > 0) {
+      step[a] = 1;
+      t_next[a] = (cell[a] + 1 - origin[a]) / direction[a];
+      t_delta[a] = 1 / direction[a];
+    } else if (direction[a] < 0) {
+      step[a] = -1;
+      t_next[a] = (cell[a] - origin[a]) / direction[a];
+      t_delta[a] = -1 / direction[a];
+    } else {
+      step[a] = 0;
+      t_next[a] = t_delta[a] = infinity;
+    }
+  }
+
+  auto t = t_min;
+  for (;;) {
+    int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2)
+                                     : (t_next[1] < t_next[2] ? 1 : 2);
+    auto t_end = fmin(t_next[axis], t_max);
+    auto majorant = majorants[(size_t(cell[2]) * blocks[1] + cell[1]) * blocks[0] + cell[0]];
+    if (t_end > t && !visit(t, t_end, double(majorant)))
+      return;
+    if (t_end >= t_max)
+      return;
+
+    t = t_end;
+    cell[axis] += step[axis];
+    if (cell[axis] < 0 || cell[axis] >= blocks[axis])
+      return;
+    t_next[axis] += t_delta[axis];
+  }
+}
+
+bool grid_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+  const auto ray_length = r.direction().length();
+  bool scattered = false;
+
+  walk(r, fmax(t_min, 0.0), t_max, [&](double t0, double t1, double majorant) {
+    if (majorant <= 0)
+      return true;
+
+    // Exponential flights are memoryless, so each block starts afresh.
+    auto t = t0;
+    for (;;) {
+      t -= shading_log(1 - random_double()) / (majorant * ray_length);
+      if (t >= t1)
+        return true;
+      // A real collision with probability density / majorant, else a null one.
+      if (random_double() * majorant < scale * grid->density(to_grid(r.at(t)))) {
+        rec.t = t;
+        scattered = true;
+        return false;
+      }
+    }
+  });
+
+  if (!scattered)
+    return false;
+
+  rec.p = r.at(rec.t);
+  rec.normal = vec3(1,0,0);  // arbitrary
+  rec.front_face = true;     // also arbitrary
+  rec.dpdu = rec.dpdv = vec3(0,0,0);
+  rec.u = rec.v = 0;
+  rec.mat_ptr = phase_function;
+  return true;
+}
+
+double grid_medium::transmittance(const ray& r, double t_min, double t_max) const {
+  const auto ray_length = r.direction().length();
+  double result = 1;
+
+  walk(r, fmax(t_min, 0.0), t_max, [&](double t0, double t1, double majorant) {
+    if (majorant <= 0)
+      return true;
+
+    auto t = t0;
+    for (;;) {
+      t -= shading_log(1 - random_double()) / (majorant * ray_length);
+      if (t >= t1)
+        return true;
+      result *= 1 - scale * grid->density(to_grid(r.at(t))) / majorant;
+      // Russian roulette once little light is left.
+      if (result < 0.1) {
+        if (random_double() >= result * 10) {
+          result = 0;
+          return false;
+        }
+        result = 0.1;
+      }
+    }
+  });
+
+  return result;
+}
+
+#endif
@@ -0,0 +1,414 @@
+#ifndef GUIDE_HPP
+#define GUIDE_HPP
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "pdf.hpp"
+
+#include <atomic>
+#include <vector>
+
+inline void atomic_add(std::atomic<double>& target, double value) {
+  auto current = target.load(std::memory_order_relaxed);
+  while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {}
+}
+
+// Equal-area mapping between the unit square and the sphere of directions,
+// u from cos(theta) and v from phi, so areas on the square are proportional
+// to solid angles.
+inline vec3 square_to_direction(double u, double v) {
+  auto z = 2*u - 1;
+  auto r = sqrt(fmax(0.0, 1 - z*z));
+  auto phi = 2*pi*v;
+  return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+inline void direction_to_square(const vec3& d, double& u, double& v) {
+  u = clamp(0.5 * (d.z() + 1), 0.0, 1.0);
+  auto phi = atan2(d.y(), d.x());
+  v = (phi < 0 ? phi + 2*pi : phi) / (2*pi);
+  v = clamp(v, 0.0, 1.0);
+}
+
+// A quadtree over the square of directions holding how much light arrived
+// from each region, from "Practical Path Guiding for Efficient Light-Transport
+// Simulation" (Müller, Gross & Novák 2017). Recording is lock-free and may run
+// on many threads; everything else must not overlap with it.
+class direction_tree {
+public:
+  direction_tree() : nodes(1) {}
+
+  // Adds value at (u, v) to the leaf cell containing it.
+  void record(double u, double v, double value);
+
+  // Fills in the sums of the inner nodes from their children after recording.
+  void build() { build(0); }
+
+  double total() const {
+    const auto& root = nodes[0];
+    return root.sum[0] + root.sum[1] + root.sum[2] + root.sum[3];
+  }
+
+  // Solid angle density of sample() returning direction d.
+  double pdf(const vec3& d) const;
+  vec3 sample(double u1, double u2) const;
+
+  // An empty tree for the next pass, subdividing the cells that received more
+  // than threshold of the total here and collapsing the others.
+  direction_tree refined(double threshold, int max_depth) const;
+
+private:
+  struct node {
+    node() {
+      for (int q = 0; q < 4; q++) {
+        sum[q] = 0;
+        child[q] = -1;
+      }
+    }
+    node(const node& other) { *this = other; }
+    node& operator=(const node& other) {
+      for (int q = 0; q < 4; q++) {
+        sum[q].store(other.sum[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        child[q] = other.child[q];
+      }
+      return *this;
+    }
+
+    double total() const { return sum[0] + sum[1] + sum[2] + sum[3]; }
+
+    std::atomic<double> sum[4];
+    int child[4];
+  };
+
+  // Quadrant of (u, v), rescaling both into that quadrant.
+  static int quadrant(double& u, double& v) {
+    int q = 0;
+    if (u >= 0.5) { q |= 1; u = 2*u - 1; } else { u *= 2; }
+    if (v >= 0.5) { q |= 2; v = 2*v - 1; } else { v *= 2; }
+    return q;
+  }
+
+  double build(int index);
+  void refine(direction_tree& out, int out_index, int index, double energy, double total,
+              double threshold, int depth, int max_depth) const;
+
+  std::vector<node> nodes;
+};
+
+void direction_tree::record(double u, double v, double value) {
+  int index = 0;
+  for (;;) {
+    int q = quadrant(u, v);
+    int child = nodes[index].child[q];
+    if (child < 0) {
+      atomic_add(nodes[index].sum[q], value);
+      return;
+    }
+    index = child;
+  }
+}
+
+double direction_tree::build(int index) {
+  auto& n = nodes[index];
+  for (int q = 0; q < 4; q++) {
+    if (n.child[q] >= 0)
+      n.sum[q] = build(n.child[q]);
+  }
+  return n.total();
+}
+
+double direction_tree::pdf(const vec3& d) const {
+  double u, v;
+  direction_to_square(d, u, v);
+
+  double density = 1;
+  int index = 0;
+  for (;;) {
+    const auto& n = nodes[index];
+    auto total = n.total();
+    if (total <= 0)
+      break;
+    int q = quadrant(u, v);
+    density *= 4 * n.sum[q] / total;
+    if (n.child[q] < 0)
+      break;
+    index = n.child[q];
+  }
+  return density / (4*pi);
+}
+
+vec3 direction_tree::sample(double u1, double u2) const {
+  double x = 0, y = 0, size = 1;
+  int index = 0;
+  for (;;) {
+    const auto& n = nodes[index];
+    auto total = n.total();
+    if (total <= 0)
+      break;
+
+    // Choose a quadrant with u1 and reuse what is left of it.
+    int q = 0;
+    double before = 0;
+    while (q < 3 && u1 * total >= before + n.sum[q]) {
+      before += n.sum[q];
+      q++;
+    }
+    u1 = clamp((u1 * total - before) / n.sum[q], 0.0, 1 - 1e-12);
+
+    size /= 2;
+    x += (q & 1) ? size : 0;
+    y += (q & 2) ? size : 0;
+    if (n.child[q] < 0)
+      break;
+    index = n.child[q];
+  }
+  return square_to_direction(x + size*u1, y + size*u2);
+}
+
+void direction_tree::refine(direction_tree& out, int out_index, int index, double energy,
+                            double total, double threshold, int depth, int max_depth) const {
+  for (int q = 0; q < 4; q++) {
+    // Leaves of this tree spread their energy evenly over their quadrants.
+    auto quadrant_energy = index >= 0 ? nodes[index].sum[q].load() : energy / 4;
+    if (depth >= max_depth || quadrant_energy <= threshold * total)
+      continue;
+
+    int child = out.nodes.size();
+    out.nodes[out_index].child[q] = child;
+    out.nodes.push_back(node());
+    refine(out, child, index >= 0 ? nodes[index].child[q] : -1, quadrant_energy, total,
+           threshold, depth + 1, max_depth);
+  }
+}
+
+direction_tree direction_tree::refined(double threshold, int max_depth) const {
+  direction_tree out;
+  auto energy = total();
+  if (energy > 0)
+    refine(out, 0, 0, energy, energy, threshold, 1, max_depth);
+  return out;
+}
+
+struct guide_settings {
+  double spatial_threshold = 4000;  // records before a cell splits, times sqrt(2^pass)
+  double energy_threshold = 0.01;   // fraction of a cell's light that splits a direction node
+  int max_direction_depth = 20;
+  double learning_rate = 0.01;      // for the BSDF sampling fraction
+};
+
+// A region of space with its incident light distributions and its learned
+// probability of sampling the BSDF rather than the guide.
+struct guide_cell {
+  guide_cell() : samples(0), theta(0), adam_m(0), adam_v(0), adam_steps(0) { lock.clear(); }
+  guide_cell(const guide_cell& other) { *this = other; }
+  guide_cell& operator=(const guide_cell& other) {
+    sampling = other.sampling;
+    building = other.building;
+    samples = other.samples.load();
+    theta = other.theta;
+    adam_m = other.adam_m;
+    adam_v = other.adam_v;
+    adam_steps = other.adam_steps;
+    lock.clear();
+    return *this;
+  }
+
+  double bsdf_fraction() const { return 1 / (1 + exp(-theta)); }
+
+  direction_tree sampling;   // learned in the previous passes
+  direction_tree building;   // recording the current pass
+  std::atomic<long> samples;
+
+  // Parameter of the BSDF fraction, a logistic of theta, and its Adam state.
+  double theta, adam_m, adam_v;
+  int adam_steps;
+  std::atomic_flag lock;
+};
+
+// Mixes BSDF sampling with sampling a cell's incident light distribution.
+class guided_pdf : public pdf {
+public:
+  guided_pdf(shared_ptr<pdf> bsdf_pdf, const direction_tree& guide_tree, double fraction)
+    : bsdf(bsdf_pdf), tree(guide_tree), bsdf_fraction(fraction) {}
+
+  virtual double value(const vec3& direction) const override {
+    return bsdf_fraction * bsdf->value(direction)
+      + (1 - bsdf_fraction) * tree.pdf(unit_vector(direction));
+  }
+
+  virtual vec3 generate() const override {
+    return generate(random_double(), random_double());
+  }
+
+  virtual vec3 generate(double u1, double u2) const override {
+    if (u1 < bsdf_fraction)
+      return bsdf->generate(u1 / bsdf_fraction, u2);
+    return tree.sample((u1 - bsdf_fraction) / (1 - bsdf_fraction), u2);
+  }
+
+public:
+  shared_ptr<pdf> bsdf;
+  const direction_tree& tree;
+  double bsdf_fraction;
+};
+
+// Online path guiding with an SD-tree: a binary tree splitting space, cycling
+// through the axes, with a direction_tree pair in every leaf. Rendering passes
+// record the light arriving along sampled directions; update() between passes
+// refines both trees and makes the recorded light the new sampling density.
+//
+// The BSDF sampling fraction of every cell is learned during recording by
+// gradient descent on the KL divergence between the sampling density and the
+// light reflected along it, as in "Practical Path Guiding in Production"
+// (Müller 2019).
+class path_guide {
+public:
+  path_guide(const aabb& bounds, const guide_settings& s = guide_settings())
+    : settings(s), training(true), passes(0), origin(bounds.min()), nodes(1), cells(1) {
+    auto extent = bounds.max() - bounds.min();
+    extent_size = fmax(extent.x(), fmax(extent.y(), extent.z())) * 1.001;
+    nodes[0].cell = 0;
+  }
+
+  int cell_index(const point3& p) const;
+
+  // The density to sample a scattered direction at cell with, the BSDF's
+  // own until the cell has learned something.
+  shared_ptr<pdf> sampling_pdf(int cell, shared_ptr<pdf> bsdf) const {
+    const auto& c = cells[cell];
+    if (c.sampling.total() <= 0)
+      return bsdf;
+    return make_shared<guided_pdf>(bsdf, c.sampling, c.bsdf_fraction());
+  }
+
+  // Records incoming radiance luminance arriving along direction, sampled
+  // with density used, and the luminance of the light it reflected. Safe to
+  // call from any number of threads.
+  void record(int cell, const vec3& direction, double radiance, const pdf& used,
+              double reflected);
+
+  // Ends a training pass.
+  void update();
+
+  size_t size() const { return cells.size(); }
+
+public:
+  guide_settings settings;
+  bool training;
+  int passes;
+
+private:
+  struct node {
+    node() : cell(-1), depth(0) { child[0] = child[1] = -1; }
+    int child[2];
+    int cell;  // for leaves
+    int depth;
+  };
+
+  void learn_fraction(guide_cell& c, const guided_pdf& used, const vec3& direction,
+                      double reflected);
+
+  point3 origin;
+  double extent_size;  // of the cube the spatial tree divides
+  std::vector<node> nodes;
+  std::vector<guide_cell> cells;
+};
+
+int path_guide::cell_index(const point3& p) const {
+  double x[3];
+  for (int a = 0; a < 3; a++)
+    x[a] = clamp((p[a] - origin[a]) / extent_size, 0.0, 1.0);
+
+  int index = 0;
+  while (nodes[index].cell < 0) {
+    int axis = nodes[index].depth % 3;
+    int side = x[axis] >= 0.5 ? 1 : 0;
+    x[axis] = side ? 2*x[axis] - 1 : 2*x[axis];
+    index = nodes[index].child[side];
+  }
+  return nodes[index].cell;
+}
+
+void path_guide::record(int cell, const vec3& direction, double radiance, const pdf& used,
+                        double reflected) {
+  auto& c = cells[cell];
+  auto density = used.value(direction);
+  if (density <= 0 || !std::isfinite(radiance))
+    return;
+
+  double u, v;
+  direction_to_square(unit_vector(direction), u, v);
+  c.building.record(u, v, radiance / density);
+  c.samples++;
+
+  auto guided = dynamic_cast<const guided_pdf*>(&used);
+  if (guided && std::isfinite(reflected))
+    learn_fraction(c, *guided, direction, reflected);
+}
+
+// One Adam step on theta with the gradient of the KL divergence between the
+// light reflected along direction, F, and the mixture density p:
+//   d/dalpha = -(F/p) (p_bsdf - p_guide) / p,  dalpha/dtheta = alpha (1 - alpha)
+// Adam's normalization makes the scale of F irrelevant.
+void path_guide::learn_fraction(guide_cell& c, const guided_pdf& used, const vec3& direction,
+                                double reflected) {
+  const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8, regularization = 0.01;
+
+  auto p_bsdf = used.bsdf->value(direction);
+  auto p_guide = used.tree.pdf(unit_vector(direction));
+  auto alpha = used.bsdf_fraction;
+  auto p = alpha * p_bsdf + (1 - alpha) * p_guide;
+  if (p <= 0)
+    return;
+
+  while (c.lock.test_and_set(std::memory_order_acquire)) {}
+
+  auto gradient = -(reflected / p) * (p_bsdf - p_guide) / p * alpha * (1 - alpha)
+    + regularization * c.theta;
+  c.adam_steps++;
+  c.adam_m = beta1 * c.adam_m + (1 - beta1) * gradient;
+  c.adam_v = beta2 * c.adam_v + (1 - beta2) * gradient * gradient;
+  auto m = c.adam_m / (1 - pow(beta1, c.adam_steps));
+  auto v = c.adam_v / (1 - pow(beta2, c.adam_steps));
+  c.theta = clamp(c.theta - settings.learning_rate * m / (sqrt(v) + epsilon), -10.0, 10.0);
+
+  c.lock.clear(std::memory_order_release);
+}
+
+void path_guide::update() {
+  for (auto& c : cells)
+    c.building.build();
+
+  // Split cells that received many records, halving their count each time.
+  auto threshold = settings.spatial_threshold * sqrt(pow(2.0, passes));
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].cell < 0 || cells[nodes[i].cell].samples < threshold || nodes[i].depth >= 48)
+      continue;
+
+    int cell = nodes[i].cell;
+    cells[cell].samples = cells[cell].samples / 2;
+
+    int first = nodes.size();
+    for (int side = 0; side < 2; side++) {
+      node child;
+      child.depth = nodes[i].depth + 1;
+      child.cell = side == 0 ? cell : int(cells.size());
+      if (side == 1)
+        cells.push_back(cells[cell]);
+      nodes.push_back(child);
+    }
+    nodes[i].child[0] = first;
+    nodes[i].child[1] = first + 1;
+    nodes[i].cell = -1;
+  }
+
+  for (auto& c : cells) {
+    c.sampling = c.building;
+    c.building = c.sampling.refined(settings.energy_threshold, settings.max_direction_depth);
+    c.samples = 0;
+  }
+  passes++;
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include "rtweekend.hpp"
 #include "ray.hpp"
 
+#include <vector>
+
 class material;
 
 struct hit_record {
@@ -14,6 +16,8 @@ struct hit_record {
   double t;
   double u;
   double v;
+  vec3 dpdu, dpdv;  // change of p with u and v, zero for surfaces without them
+  texture_footprint footprint;
   bool front_face;
 
   inline void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -22,10 +26,83 @@ struct hit_record {
   }
 };
 
+// Fills in rec.footprint from where the neighbouring rays of r meet the tangent
+// plane at rec.p, by least squares on dpdu and dpdv, after pbrt's
+// SurfaceInteraction::ComputeDifferentials.
+inline void compute_footprint(const ray& r, const ray_differential& d, hit_record& rec) {
+  auto uu = dot(rec.dpdu, rec.dpdu);
+  auto uv = dot(rec.dpdu, rec.dpdv);
+  auto vv = dot(rec.dpdv, rec.dpdv);
+  auto determinant = uu*vv - uv*uv;
+  if (determinant <= 1e-12 * uu * vv)
+    return;
+
+  auto distance = dot(rec.normal, rec.p - r.origin());
+  auto offset = [&](const vec3& direction_change, double& du, double& dv) {
+    auto direction = r.direction() + direction_change;
+    auto denominator = dot(rec.normal, direction);
+    if (fabs(denominator) < 1e-12)
+      return;
+    auto dp = r.origin() + (distance / denominator) * direction - rec.p;
+    auto a = dot(rec.dpdu, dp), b = dot(rec.dpdv, dp);
+    du = (vv*a - uv*b) / determinant;
+    dv = (uu*b - uv*a) / determinant;
+  };
+  offset(d.dx, rec.footprint.du_dx, rec.footprint.dv_dx);
+  offset(d.dy, rec.footprint.du_dy, rec.footprint.dv_dy);
+}
+
 class hittable {
   public:
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
     virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
+
+    // Any-hit query for shadow and visibility rays. Returns true as soon as any
+    // intersection in (t_min, t_max) is found, skipping the closest-hit search
+    // and the normal, uv and material setup that hit() performs.
+    virtual bool occluded(const ray& r, double t_min, double t_max) const = 0;
+
+    // Light sampling interface from "Ray Tracing: The Rest of Your Life".
+    // random() returns a vector from o to a random point on the surface, and
+    // pdf_value() is the solid angle density of choosing direction v that way.
+    virtual double pdf_value(const point3& o, const vec3& v) const {
+      return 0.0;
+    }
+
+    virtual vec3 random(const point3& o) const {
+      return vec3(1, 0, 0);
+    }
+
+    // True for emissive surfaces that implement random() and pdf_value(), so
+    // they can be sampled directly as lights.
+    virtual bool is_light() const { return false; }
+
+    // Surface area, used to weight light selection.
+    virtual double area() const { return 0.0; }
+
+    // Fills rec for a point picked uniformly by area from u1, u2 in [0,1),
+    // with the outward normal, so lights can emit photons. False for shapes
+    // that cannot be sampled this way.
+    virtual bool sample_surface(double u1, double u2, double time, hit_record& rec) const {
+      return false;
+    }
+
+    // The range of t over which r is inside this closed, convex shape, for
+    // participating media bounded by it. t_enter is negative when the origin
+    // is inside. The default finds both crossings with hit(); shapes that can
+    // solve for the range directly override it.
+    virtual bool inside(const ray& r, double& t_enter, double& t_exit) const {
+      hit_record enter, exit;
+      if (!hit(r, -infinity, infinity, enter) || !hit(r, enter.t + 0.0001, infinity, exit))
+        return false;
+      t_enter = enter.t;
+      t_exit = exit.t;
+      return true;
+    }
+
+    // Appends the material pointers this object and its children hold, so
+    // compile_scene can swap in shared copies.
+    virtual void material_slots(std::vector<shared_ptr<material>*>& slots) {}
 };
 
 class translate : public hittable {
@@ -37,6 +114,38 @@ class translate : public hittable {
 
   virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+    ray moved_r(r.origin() - offset, r.direction(), r.time());
+    return ptr->occluded(moved_r, t_min, t_max);
+  }
+
+  virtual double pdf_value(const point3& o, const vec3& v) const override {
+    return ptr->pdf_value(o - offset, v);
+  }
+
+  virtual vec3 random(const point3& o) const override {
+    return ptr->random(o - offset);
+  }
+
+  virtual bool is_light() const override { return ptr->is_light(); }
+  virtual double area() const override { return ptr->area(); }
+
+  virtual bool sample_surface(double u1, double u2, double time, hit_record& rec) const override {
+    if (!ptr->sample_surface(u1, u2, time, rec))
+      return false;
+    rec.p += offset;
+    return true;
+  }
+
+  virtual bool inside(const ray& r, double& t_enter, double& t_exit) const override {
+    ray moved_r(r.origin() - offset, r.direction(), r.time());
+    return ptr->inside(moved_r, t_enter, t_exit);
+  }
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    ptr->material_slots(slots);
+  }
+
   public:
     shared_ptr<hittable> ptr;
     vec3 offset;
@@ -72,6 +181,53 @@ public:
     return hasbox;
   }
 
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+    return ptr->occluded(rotated(r), t_min, t_max);
+  }
+
+  virtual double pdf_value(const point3& o, const vec3& v) const override {
+    return ptr->pdf_value(to_object(o), to_object(v));
+  }
+
+  virtual vec3 random(const point3& o) const override {
+    return to_world(ptr->random(to_object(o)));
+  }
+
+  virtual bool is_light() const override { return ptr->is_light(); }
+  virtual double area() const override { return ptr->area(); }
+
+  virtual bool sample_surface(double u1, double u2, double time, hit_record& rec) const override {
+    if (!ptr->sample_surface(u1, u2, time, rec))
+      return false;
+    rec.p = to_world(rec.p);
+    rec.normal = to_world(rec.normal);
+    return true;
+  }
+
+  virtual bool inside(const ray& r, double& t_enter, double& t_exit) const override {
+    return ptr->inside(rotated(r), t_enter, t_exit);
+  }
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    ptr->material_slots(slots);
+  }
+
+  // Rotate a world space point or vector into the object space of ptr, and back.
+  vec3 to_object(const vec3& p) const {
+    return vec3(cos_theta*p[0] - sin_theta*p[2], p[1], sin_theta*p[0] + cos_theta*p[2]);
+  }
+
+  vec3 to_world(const vec3& p) const {
+    return vec3(cos_theta*p[0] + sin_theta*p[2], p[1], -sin_theta*p[0] + cos_theta*p[2]);
+  }
+
+  // Moves a world space ray into the object space of ptr.
+  ray rotated(const ray& r) const {
+    // This is checking for intersection in world coordinates and inverts the rotation logic.
+    // See https://github.com/RayTracing/raytracing.github.io/issues/544 for explanation.
+    return ray(to_object(r.origin()), to_object(r.direction()), r.time());
+  }
+
 public:
   shared_ptr<hittable> ptr;
   double sin_theta;
@@ -117,35 +273,17 @@ rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
 // x′=cos(θ)⋅x+sin(θ)⋅z
 // z′=−sin(θ)⋅x+cos(θ)⋅z
 bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record &rec) const {
-  auto origin = r.origin();
-  auto direction = r.direction();
-
-  // This is checking for intersection in world coordinates and inverts the rotation logic.
-  // See https://github.com/RayTracing/raytracing.github.io/issues/544 for explanation.
-  origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
-  origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
-
-  direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
-  direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
-
-  ray rotated_r(origin,direction, r.time());
+  ray rotated_r = rotated(r);
 
   if (!ptr->hit(rotated_r, t_min, t_max, rec)) {
     return false;
   }
 
-  auto p = rec.p;
-  auto normal = rec.normal;
-
   // rotate around the y-axis, so update X and Z
-  p[0] = cos_theta*rec.p[0] + sin_theta*rec.p[2];
-  p[2] = - sin_theta*rec.p[0] + cos_theta*rec.p[2];
-
-  normal[0] = cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
-  normal[2] = - sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
-
-  rec.p = p;
-  rec.set_face_normal(rotated_r, normal);
+  rec.p = to_world(rec.p);
+  rec.dpdu = to_world(rec.dpdu);
+  rec.dpdv = to_world(rec.dpdv);
+  rec.set_face_normal(rotated_r, to_world(rec.normal));
 
   return true;
 }
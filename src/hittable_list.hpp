@@ -20,6 +20,12 @@ public:
 
   virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const override;
   virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    for (auto& object : objects)
+      object->material_slots(slots);
+  }
 
 public:
   std::vector<shared_ptr<hittable>> objects;
@@ -43,6 +49,15 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
   return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, double t_min, double t_max) const {
+  for (const auto& object : objects) {
+    if (object->occluded(r, t_min, t_max))
+      return true;
+  }
+
+  return false;
+}
+
 bool hittable_list::bounding_box(double time0, double time1, aabb& output_box) const {
   if (objects.empty()) return false;
 
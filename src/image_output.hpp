@@ -0,0 +1,340 @@
+#ifndef IMAGE_OUTPUT_HPP
+#define IMAGE_OUTPUT_HPP
+
+#include "rtweekend.hpp"
+
+#include "color.hpp"
+#include "rtw_stb_image_write.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A finished image in linear radiance, samples already averaged, rows from
+// the top. Single precision, as every format it is written in is at most.
+struct float_image {
+  float_image() : width(0), height(0) {}
+  float_image(int w, int h) : width(w), height(h), rgb(size_t(w) * h * 3, 0.0f) {}
+
+  void set(int x, int y, const color& c) {
+    auto p = &rgb[(size_t(y) * width + x) * 3];
+    p[0] = float(c.x());
+    p[1] = float(c.y());
+    p[2] = float(c.z());
+  }
+
+  color get(int x, int y) const {
+    auto p = &rgb[(size_t(y) * width + x) * 3];
+    return color(p[0], p[1], p[2]);
+  }
+
+  int width, height;
+  std::vector<float> rgb;
+};
+
+// p3 is the ASCII PPM main() has always written, byte for byte. p6 and png
+// hold the same 8 bit gamma 2 values; pfm and hdr keep linear radiance.
+enum class image_format { p3, p6, png, pfm, hdr };
+
+bool parse_image_format(const std::string& name, image_format& format) {
+  const char* names[] = { "p3", "p6", "png", "pfm", "hdr" };
+  for (int f = 0; f < 5; f++) {
+    if (name == names[f]) {
+      format = image_format(f);
+      return true;
+    }
+  }
+  return false;
+}
+
+// The format a file name asks for: .png, .pfm and .hdr by extension, binary
+// PPM for other files, and P3 for standard output.
+image_format format_for_path(const std::string& path) {
+  auto dot = path.rfind('.');
+  auto extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+  if (extension == "png")
+    return image_format::png;
+  if (extension == "pfm")
+    return image_format::pfm;
+  if (extension == "hdr")
+    return image_format::hdr;
+  return path.empty() || path == "-" ? image_format::p3 : image_format::p6;
+}
+
+// The value write_color() gives a linear component.
+inline int display_value(float linear) {
+  return static_cast<int>(256 * clamp(sqrt(double(linear)), 0.0, 0.999));
+}
+
+inline unsigned char display_byte(float linear) {
+  return static_cast<unsigned char>(std::min(std::max(display_value(linear), 0), 255));
+}
+
+// Writes an image in any format but png a row at a time, so images too
+// large to hold can be encoded as they are assembled; png fails the stream.
+// Rows go in file order: from the top, except for pfm, which from_bottom() is
+// true for.
+class scanline_encoder {
+public:
+  scanline_encoder(std::ostream& o, image_format f, int w, int h)
+    : out(o), format(f), width(w) {
+    switch (format) {
+    case image_format::png:
+      out.setstate(std::ios::failbit);
+      break;
+    case image_format::p3:
+      out << "P3\n" << width << ' ' << h << "\n255\n";
+      // At most 12 characters a value, for a NaN that gives INT_MIN.
+      buffer.resize(size_t(width) * 3 * 12);
+      break;
+    case image_format::p6:
+      out << "P6\n" << width << ' ' << h << "\n255\n";
+      buffer.resize(size_t(width) * 3);
+      break;
+    case image_format::pfm: {
+      // Little endian floats say so by a negative scale.
+      const std::uint16_t probe = 1;
+      auto little_endian = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+      out << "PF\n" << width << ' ' << h << '\n' << (little_endian ? "-1.0" : "1.0") << '\n';
+      break;
+    }
+    case image_format::hdr:
+      out << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << h << " +X " << width << '\n';
+      buffer.resize(size_t(width) * 4);
+      break;
+    }
+  }
+
+  static bool from_bottom(image_format format) { return format == image_format::pfm; }
+
+  // Writes width pixels of rgb.
+  bool write_row(const float* rgb) {
+    switch (format) {
+    case image_format::p3:
+      write_p3(rgb);
+      break;
+    case image_format::png:
+      break;
+    case image_format::p6:
+      for (size_t i = 0; i < buffer.size(); i++)
+        buffer[i] = display_byte(rgb[i]);
+      out.write(buffer.data(), buffer.size());
+      break;
+    case image_format::pfm:
+      out.write(reinterpret_cast<const char*>(rgb), size_t(width) * 3 * sizeof(float));
+      break;
+    case image_format::hdr:
+      write_rgbe(rgb);
+      break;
+    }
+    return bool(out);
+  }
+
+private:
+  // Formats the integers itself; write_color() through an ostream per pixel
+  // is most of the time of a large P3.
+  void write_p3(const float* rgb) {
+    auto end = buffer.data();
+    for (int i = 0; i < width * 3; i++) {
+      auto value = display_value(rgb[i]);
+      if (value >= 0 && value < 1000) {
+        if (value >= 100)
+          *end++ = char('0' + value / 100);
+        if (value >= 10)
+          *end++ = char('0' + value / 10 % 10);
+        *end++ = char('0' + value % 10);
+      } else {
+        auto digits = std::to_string(value);
+        end = std::copy(digits.begin(), digits.end(), end);
+      }
+      *end++ = i % 3 == 2 ? '\n' : ' ';
+    }
+    out.write(buffer.data(), end - buffer.data());
+  }
+
+  // Radiance RGBE, a shared 8 bit exponent for each pixel, with flat rather
+  // than run length encoded scanlines.
+  void write_rgbe(const float* rgb) {
+    for (int x = 0; x < width; x++, rgb += 3) {
+      auto q = reinterpret_cast<unsigned char*>(&buffer[size_t(x) * 4]);
+      float r = std::max(rgb[0], 0.0f), g = std::max(rgb[1], 0.0f), b = std::max(rgb[2], 0.0f);
+      auto largest = std::max(r, std::max(g, b));
+      if (!(largest >= 1e-32f)) {
+        q[0] = q[1] = q[2] = q[3] = 0;
+        continue;
+      }
+      int exponent;
+      auto scale = std::frexp(largest, &exponent) * 256.0f / largest;
+      q[0] = static_cast<unsigned char>(r * scale);
+      q[1] = static_cast<unsigned char>(g * scale);
+      q[2] = static_cast<unsigned char>(b * scale);
+      q[3] = static_cast<unsigned char>(exponent + 128);
+    }
+    out.write(buffer.data(), buffer.size());
+  }
+
+  std::ostream& out;
+  image_format format;
+  int width;
+  std::vector<char> buffer;
+};
+
+// stb_image_write takes the whole image at once.
+bool write_png(std::ostream& out, const float_image& image) {
+  std::vector<unsigned char> bytes(image.rgb.size());
+  for (size_t i = 0; i < bytes.size(); i++)
+    bytes[i] = display_byte(image.rgb[i]);
+
+  auto append = [](void* context, void* data, int size) {
+    static_cast<std::ostream*>(context)->write(static_cast<const char*>(data), size);
+  };
+  return stbi_write_png_to_func(append, &out, image.width, image.height, 3, bytes.data(),
+                                image.width * 3) && out;
+}
+
+bool write_image(std::ostream& out, const float_image& image, image_format format) {
+  if (format == image_format::png)
+    return write_png(out, image);
+
+  scanline_encoder encoder(out, format, image.width, image.height);
+  auto bottom_up = scanline_encoder::from_bottom(format);
+  for (int row = 0; row < image.height; row++) {
+    auto y = bottom_up ? image.height - 1 - row : row;
+    if (!encoder.write_row(&image.rgb[size_t(y) * image.width * 3]))
+      return false;
+  }
+  return bool(out);
+}
+
+// Writes to path, or to standard output for "" or "-".
+bool save_image(const float_image& image, image_format format, const std::string& path) {
+  if (path.empty() || path == "-")
+    return write_image(std::cout, image, format) && std::cout.flush();
+
+  std::ofstream out(path, std::ios::binary);
+  if (out && write_image(out, image, format) && out.flush())
+    return true;
+  out.close();
+  std::remove(path.c_str());
+  return false;
+}
+
+// Encodes and writes images on a thread of its own, in the order they were
+// queued, so the render goes on while the last image is written. write()
+// waits only when max_pending images are already queued, which bounds the
+// memory a renderer faster than the disk can take; with drop_stale it drops
+// the oldest of them instead, for previews where only the latest matters.
+class image_writer {
+public:
+  image_writer(size_t max_pending = 4, bool drop_stale = false)
+    : limit(std::max<size_t>(max_pending, 1)), dropping(drop_stale), stopping(false),
+      failures(0), dropped(0), worker(&image_writer::run, this) {}
+
+  ~image_writer() { finish(); }
+
+  image_writer(const image_writer&) = delete;
+  image_writer& operator=(const image_writer&) = delete;
+
+  typedef std::function<bool(const float_image&)> encoder;
+
+  void write(float_image image, image_format format, const std::string& path) {
+    write(std::move(image), [format, path](const float_image& image) {
+      return save_image(image, format, path);
+    }, path);
+  }
+
+  // Appends the image to out, which has to outlive the writer or the next
+  // finish(); name is for errors.
+  void write(float_image image, image_format format, std::ostream& out,
+             const std::string& name = "-") {
+    write(std::move(image), [format, &out](const float_image& image) {
+      return write_image(out, image, format) && out.flush();
+    }, name);
+  }
+
+  // Writes the image with encode, for what is not one image in one format.
+  void write(float_image image, encoder encode, const std::string& name) {
+    add(job{ std::move(image), std::move(encode), name });
+  }
+
+  // Images dropped as stale so far.
+  size_t dropped_images() {
+    std::lock_guard<std::mutex> hold(lock);
+    return dropped;
+  }
+
+  // Waits for every queued image to be written and stops the thread. False
+  // if any of them could not be.
+  bool finish() {
+    {
+      std::lock_guard<std::mutex> hold(lock);
+      stopping = true;
+      changed.notify_all();
+    }
+    if (worker.joinable())
+      worker.join();
+    return failures == 0;
+  }
+
+private:
+  struct job {
+    float_image image;
+    encoder encode;
+    std::string name;
+  };
+
+  void add(job j) {
+    std::unique_lock<std::mutex> hold(lock);
+    if (dropping) {
+      for (; queue.size() >= limit; dropped++)
+        queue.pop_front();
+    } else {
+      changed.wait(hold, [this] { return queue.size() < limit; });
+    }
+    queue.push_back(std::move(j));
+    changed.notify_all();
+  }
+
+  void run() {
+    for (;;) {
+      job next;
+      {
+        std::unique_lock<std::mutex> hold(lock);
+        changed.wait(hold, [this] { return stopping || !queue.empty(); });
+        if (queue.empty())
+          return;
+        next = std::move(queue.front());
+        queue.pop_front();
+        changed.notify_all();
+      }
+
+      if (!next.encode(next.image)) {
+        std::cerr << "ERROR: Could not write image '"
+                  << (next.name.empty() ? "-" : next.name) << "'.\n";
+        failures++;
+      }
+    }
+  }
+
+  size_t limit;
+  bool dropping;
+  std::deque<job> queue;
+  std::mutex lock;
+  std::condition_variable changed;
+  bool stopping;
+  int failures;   // only touched by the thread until it is joined
+  size_t dropped;
+  std::thread worker;
+};
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+#include "rtweekend.hpp"
+
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "image_output.hpp"
+#include "parallel.hpp"
+#include "sampler.hpp"
+#include "tiled_image.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Incremental re-rendering after scene edits, after "Incremental Raytracing"
+// (Murakami & Hirota): every tile remembers what its paths touched, and an
+// edit re-renders only the tiles whose paths could have changed. A path that
+// touched neither the edited object or material nor the space the object
+// now fills traces the same way in the edited scene, so the pixels kept are
+// as good an estimate of it as a full re-render would give.
+
+// What the paths of one tile touched: a Bloom filter of the objects and
+// materials they hit, and the cells of a grid over the scene their rays
+// crossed, shadow rays included.
+struct tile_touches {
+  static const int id_bits = 1024;
+  static const int grid = 16;
+  typedef std::bitset<grid * grid * grid> cell_set;
+
+  void clear() {
+    ids.reset();
+    cells.reset();
+  }
+
+  void add(const void* id) {
+    auto h = hash(id);
+    for (int k = 0; k < 3; k++)
+      ids.set((h >> (20 * k)) % id_bits);
+  }
+
+  // False only if id was never added.
+  bool may_contain(const void* id) const {
+    auto h = hash(id);
+    for (int k = 0; k < 3; k++) {
+      if (!ids.test((h >> (20 * k)) % id_bits))
+        return false;
+    }
+    return true;
+  }
+
+  std::bitset<id_bits> ids;
+  cell_set cells;
+
+private:
+  static std::uint64_t hash(const void* id) {
+    auto x = std::uint64_t(reinterpret_cast<std::uintptr_t>(id));
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    return x ^ (x >> 33);
+  }
+};
+
+// The record of the tile this thread is rendering, if it is recording.
+thread_local tile_touches* touch_record = nullptr;
+
+// An object of the scene that notes itself and the material it was hit
+// with in touch_record. The id of the object is the one wrapped.
+class tracked_object : public hittable {
+public:
+  tracked_object(shared_ptr<hittable> p) : ptr(p) {}
+
+  virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+    if (!ptr->hit(r, t_min, t_max, rec))
+      return false;
+    if (touch_record) {
+      touch_record->add(ptr.get());
+      touch_record->add(rec.mat_ptr.get());
+    }
+    return true;
+  }
+
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+    if (!ptr->occluded(r, t_min, t_max))
+      return false;
+    if (touch_record)
+      touch_record->add(ptr.get());
+    return true;
+  }
+
+  virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+    return ptr->bounding_box(time0, time1, output_box);
+  }
+  virtual double pdf_value(const point3& o, const vec3& v) const override {
+    return ptr->pdf_value(o, v);
+  }
+  virtual vec3 random(const point3& o) const override { return ptr->random(o); }
+  virtual bool is_light() const override { return ptr->is_light(); }
+  virtual double area() const override { return ptr->area(); }
+  // Light samples count as touches too, for the emitter edits they see.
+  virtual bool sample_surface(double u1, double u2, double time, hit_record& rec) const override {
+    if (!ptr->sample_surface(u1, u2, time, rec))
+      return false;
+    if (touch_record) {
+      touch_record->add(ptr.get());
+      touch_record->add(rec.mat_ptr.get());
+    }
+    return true;
+  }
+  virtual bool inside(const ray& r, double& t_enter, double& t_exit) const override {
+    return ptr->inside(r, t_enter, t_exit);
+  }
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    ptr->material_slots(slots);
+  }
+
+  shared_ptr<hittable> ptr;
+};
+
+// Wraps every object of list, before materials are compiled and the bvh and
+// lights are built from it.
+void track_objects(hittable_list& list) {
+  for (auto& object : list.objects)
+    object = make_shared<tracked_object>(object);
+}
+
+// The whole scene, marking the grid cells every ray through it crosses in
+// touch_record, up to its hit or, for misses, out of bounds.
+class tracked_world : public hittable {
+public:
+  tracked_world(const hittable& w, const aabb& b) : world(w), bounds(b) {}
+
+  virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+    bool found = world.hit(r, t_min, t_max, rec);
+    if (touch_record)
+      mark(*touch_record, r, t_min, found ? rec.t : t_max);
+    return found;
+  }
+
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+    if (touch_record)
+      mark(*touch_record, r, t_min, t_max);
+    return world.occluded(r, t_min, t_max);
+  }
+
+  virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+    return world.bounding_box(time0, time1, output_box);
+  }
+
+  // Sets the cells overlapping region; false if it reaches outside bounds,
+  // where rays are not followed.
+  bool cells_overlapping(const aabb& region, tile_touches::cell_set& cells) const;
+
+  // Sets the cells r crosses between t0 and t1.
+  void mark(tile_touches& touches, const ray& r, double t0, double t1) const;
+
+private:
+  int cell(double x, int axis) const {
+    auto extent = bounds.max()[axis] - bounds.min()[axis];
+    auto c = int((x - bounds.min()[axis]) / extent * tile_touches::grid);
+    return std::min(std::max(c, 0), tile_touches::grid - 1);
+  }
+
+  static int index(int x, int y, int z) {
+    return (z * tile_touches::grid + y) * tile_touches::grid + x;
+  }
+
+  const hittable& world;
+  aabb bounds;
+};
+
+bool tracked_world::cells_overlapping(const aabb& region, tile_touches::cell_set& cells) const {
+  for (int a = 0; a < 3; a++) {
+    if (region.min()[a] < bounds.min()[a] || region.max()[a] > bounds.max()[a])
+      return false;
+  }
+  for (int z = cell(region.min().z(), 2); z <= cell(region.max().z(), 2); z++)
+    for (int y = cell(region.min().y(), 1); y <= cell(region.max().y(), 1); y++)
+      for (int x = cell(region.min().x(), 0); x <= cell(region.max().x(), 0); x++)
+        cells.set(index(x, y, z));
+  return true;
+}
+
+// Clips the segment to the bounds, then steps through the cells along it
+// as in Amanatides & Woo's "A Fast Voxel Traversal Algorithm".
+void tracked_world::mark(tile_touches& touches, const ray& r, double t0, double t1) const {
+  const auto& o = r.origin();
+  const auto& d = r.direction();
+  for (int a = 0; a < 3; a++) {
+    if (d[a] == 0) {
+      if (o[a] < bounds.min()[a] || o[a] > bounds.max()[a])
+        return;
+      continue;
+    }
+    auto near = (bounds.min()[a] - o[a]) / d[a], far = (bounds.max()[a] - o[a]) / d[a];
+    if (near > far)
+      std::swap(near, far);
+    t0 = std::max(t0, near);
+    t1 = std::min(t1, far);
+  }
+  if (t0 > t1)
+    return;
+
+  int c[3], step[3];
+  double next[3], delta[3];
+  auto start = r.at(t0);
+  for (int a = 0; a < 3; a++) {
+    c[a] = cell(start[a], a);
+    auto size = (bounds.max()[a] - bounds.min()[a]) / tile_touches::grid;
+    if (d[a] == 0) {
+      step[a] = 0;
+      next[a] = delta[a] = infinity;
+      continue;
+    }
+    step[a] = d[a] > 0 ? 1 : -1;
+    auto boundary = bounds.min()[a] + (c[a] + (d[a] > 0)) * size;
+    next[a] = (boundary - o[a]) / d[a];
+    delta[a] = size / fabs(d[a]);
+  }
+
+  for (;;) {
+    touches.cells.set(index(c[0], c[1], c[2]));
+    int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+    if (next[a] > t1)
+      return;
+    c[a] += step[a];
+    if (c[a] < 0 || c[a] >= tile_touches::grid)
+      return;
+    next[a] += delta[a];
+  }
+}
+
+// An image rendered in tiles that keeps each tile's touches, so that after
+// an edit only the tiles it could have changed are rendered again.
+class incremental_render {
+public:
+  incremental_render(int width, int height, int tile_size = 8)
+    : layout(width, height, tile_size), image(width, height), touches(layout.count()),
+      dirty(layout.count(), true) {}
+
+  // Renders every tile not rendered since it was invalidated, each with a
+  // sampler of its own from make_sampler(), on all threads. sample(i, j,
+  // index, s) traces a sample of pixel (i, j), row 0 at the bottom, through
+  // the tracked_world. Returns the number of tiles rendered.
+  int render(int samples_per_pixel, const std::function<shared_ptr<sampler>()>& make_sampler,
+             const std::function<color(int, int, int, sampler&)>& sample);
+
+  // An edited material, as the scene holds it after compile_scene(), or an
+  // object track_objects() wrapped: every tile whose paths hit it.
+  void invalidate(const void* id) {
+    for (size_t t = 0; t < touches.size(); t++)
+      dirty[t] = dirty[t] || touches[t].may_contain(id);
+  }
+
+  // Geometry that now fills region: every tile with a ray through it. A
+  // moved object invalidates its id as well as its new bounds.
+  void invalidate(const aabb& region, const tracked_world& world) {
+    tile_touches::cell_set cells;
+    if (!world.cells_overlapping(region, cells)) {
+      std::fill(dirty.begin(), dirty.end(), true);
+      return;
+    }
+    for (size_t t = 0; t < touches.size(); t++)
+      dirty[t] = dirty[t] || (touches[t].cells & cells).any();
+  }
+
+  int dirty_tiles() const { return int(std::count(dirty.begin(), dirty.end(), true)); }
+  int tile_count() const { return int(dirty.size()); }
+
+  // Rows from the top, as written out.
+  const float_image& result() const { return image; }
+
+private:
+  tile_layout layout;
+  float_image image;
+  std::vector<tile_touches> touches;
+  std::vector<bool> dirty;
+};
+
+int incremental_render::render(int samples_per_pixel,
+                               const std::function<shared_ptr<sampler>()>& make_sampler,
+                               const std::function<color(int, int, int, sampler&)>& sample) {
+  std::vector<int> work;
+  for (int t = 0; t < int(dirty.size()); t++) {
+    if (dirty[t])
+      work.push_back(t);
+  }
+
+  parallel_for(0, int(work.size()), [&](int w) {
+    int t = work[w];
+    auto s = make_sampler();
+    touches[t].clear();
+    touch_record = &touches[t];
+
+    int x0 = layout.x0(t), y0 = layout.y0(t);
+    for (int y = y0; y < y0 + layout.tile_height(t); y++) {
+      for (int x = x0; x < x0 + layout.tile_width(t); x++) {
+        color pixel_color(0,0,0);
+        for (int k = 0; k < samples_per_pixel; k++)
+          pixel_color += sample(x, layout.height-1 - y, k, *s);
+        image.set(x, y, pixel_color * (1.0 / samples_per_pixel));
+      }
+    }
+    touch_record = nullptr;
+  });
+
+  for (int t : work)
+    dirty[t] = false;
+  return int(work.size());
+}
+
+#endif
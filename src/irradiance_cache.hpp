@@ -0,0 +1,267 @@
+#ifndef IRRADIANCE_CACHE_HPP
+#define IRRADIANCE_CACHE_HPP
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "color.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Indirect irradiance arriving at a surface point, with its rotational and
+// translational gradients per color channel (Ward & Heckbert 1992), and the
+// harmonic mean distance to the surfaces around it, which sets how far the
+// record can be reused.
+struct irradiance_record {
+  point3 p;
+  vec3 normal;
+  color irradiance;
+  double radius;
+  vec3 rotational[3];
+  vec3 translational[3];
+};
+
+struct irradiance_settings {
+  double accuracy = 0.3;      // Ward's a, the largest interpolation error accepted
+  int theta_samples = 8;      // gather rays per record are theta_samples * phi_samples
+  int phi_samples = 24;
+  double min_spacing = 0.002; // record radius limits, relative to the scene diagonal
+  double max_spacing = 0.1;
+};
+
+// World-space irradiance records in an octree, after "A Ray Tracing Solution
+// for Diffuse Interreflection" (Ward, Rubinstein & Clear 1988). Each record is
+// stored in the nodes its region of validity overlaps, at the depth where the
+// nodes are about its size, so a lookup only visits the nodes containing the
+// query point.
+//
+// Lookups never modify the cache and may run on any number of threads, as
+// long as no insert runs at the same time. Records only depend on the scene,
+// so a cache can be kept, or saved and loaded, across frames of an animation
+// whose geometry and lights do not change.
+class irradiance_cache {
+public:
+  irradiance_cache(const aabb& scene_bounds, const irradiance_settings& s = irradiance_settings())
+    : settings(s), bounds(scene_bounds), nodes(1) {
+    diagonal = (bounds.max() - bounds.min()).length();
+  }
+
+  size_t size() const { return records.size(); }
+
+  // Interpolated irradiance at p, from the records whose validity covers it.
+  // Returns false when there are none and the caller must compute it.
+  bool lookup(const point3& p, const vec3& normal, color& irradiance) const;
+
+  // Adds a record, clamping its radius to the configured spacing.
+  void insert(irradiance_record record);
+
+  // Files name the scene they were saved for, a number of the caller's, and
+  // hold its bounds and the settings; load() takes the records of no other.
+  bool save(const char* filename, int scene) const;
+  bool load(const char* filename, int scene);
+
+public:
+  irradiance_settings settings;
+
+private:
+  struct node {
+    node() { for (auto& c : children) c = -1; }
+    int children[8];
+    std::vector<int> records;
+  };
+
+  static const int key_size = 12;
+  void key(int scene, double* out) const;
+
+  double weight(const irradiance_record& r, const point3& p, const vec3& normal) const;
+  void insert(int index, const aabb& box, int record, const aabb& record_box, int depth);
+
+  static aabb child_box(const aabb& box, int octant) {
+    auto mid = 0.5*(box.min() + box.max());
+    point3 lo, hi;
+    for (int a = 0; a < 3; a++) {
+      bool upper = octant & (1 << a);
+      lo[a] = upper ? mid[a] : box.min()[a];
+      hi[a] = upper ? box.max()[a] : mid[a];
+    }
+    return aabb(lo, hi);
+  }
+
+  aabb bounds;
+  double diagonal;
+  std::vector<irradiance_record> records;
+  std::vector<node> nodes;
+};
+
+// Ward's weight, offset so it falls smoothly to zero at the edge of the region
+// of validity instead of cutting off. Records in front of p are skipped, they
+// would see geometry p is hidden from.
+double irradiance_cache::weight(const irradiance_record& r, const point3& p,
+                                const vec3& normal) const {
+  auto offset = p - r.p;
+  if (dot(offset, normal + r.normal) < -0.01 * r.radius)
+    return 0;
+
+  auto error = offset.length() / r.radius + sqrt(fmax(0.0, 1 - dot(normal, r.normal)));
+  if (error >= settings.accuracy)
+    return 0;
+  return 1 / fmax(error, 1e-6) - 1 / settings.accuracy;
+}
+
+bool irradiance_cache::lookup(const point3& p, const vec3& normal, color& irradiance) const {
+  color sum(0,0,0);
+  double total = 0;
+
+  int index = 0;
+  aabb box = bounds;
+  for (;;) {
+    for (int i : nodes[index].records) {
+      const auto& r = records[i];
+      auto w = weight(r, p, normal);
+      if (w <= 0)
+        continue;
+
+      auto rotation = cross(r.normal, normal);
+      auto offset = p - r.p;
+      color e = r.irradiance;
+      for (int c = 0; c < 3; c++)
+        e[c] += dot(rotation, r.rotational[c]) + dot(offset, r.translational[c]);
+      sum += w * e;
+      total += w;
+    }
+
+    auto mid = 0.5*(box.min() + box.max());
+    int octant = (p.x() > mid.x() ? 1 : 0) | (p.y() > mid.y() ? 2 : 0) | (p.z() > mid.z() ? 4 : 0);
+    int child = nodes[index].children[octant];
+    if (child < 0)
+      break;
+    box = child_box(box, octant);
+    index = child;
+  }
+
+  if (total <= 0)
+    return false;
+
+  irradiance = sum / total;
+  for (int c = 0; c < 3; c++)
+    irradiance[c] = fmax(0.0, irradiance[c]);
+  return true;
+}
+
+void irradiance_cache::insert(irradiance_record record) {
+  record.radius = clamp(record.radius, settings.min_spacing * diagonal,
+                        settings.max_spacing * diagonal);
+
+  int index = records.size();
+  records.push_back(record);
+
+  auto reach = settings.accuracy * record.radius;
+  aabb record_box(record.p - vec3(reach, reach, reach), record.p + vec3(reach, reach, reach));
+  insert(0, bounds, index, record_box, 0);
+}
+
+void irradiance_cache::insert(int index, const aabb& box, int record, const aabb& record_box,
+                              int depth) {
+  // Store the record here once the children would be smaller than its region.
+  auto node_diagonal = (box.max() - box.min()).length();
+  auto record_diagonal = (record_box.max() - record_box.min()).length();
+  if (depth == 16 || node_diagonal < 2 * record_diagonal) {
+    nodes[index].records.push_back(record);
+    return;
+  }
+
+  auto mid = 0.5*(box.min() + box.max());
+  for (int octant = 0; octant < 8; octant++) {
+    bool overlaps = true;
+    for (int a = 0; a < 3; a++) {
+      bool upper = octant & (1 << a);
+      overlaps = overlaps && (upper ? record_box.max()[a] > mid[a] : record_box.min()[a] <= mid[a]);
+    }
+    if (!overlaps)
+      continue;
+
+    if (nodes[index].children[octant] < 0) {
+      nodes[index].children[octant] = nodes.size();
+      nodes.push_back(node());
+    }
+    insert(nodes[index].children[octant], child_box(box, octant), record, record_box, depth + 1);
+  }
+}
+
+// Records are written as raw doubles, the file is only meant to be read back
+// by the same build on the same machine.
+static const char irradiance_cache_magic[8] = { 'I', 'R', 'R', 'C', 'A', 'C', 'H', '2' };
+
+void irradiance_cache::key(int scene, double* out) const {
+  const double values[key_size] = {
+    double(scene), bounds.min().x(), bounds.min().y(), bounds.min().z(),
+    bounds.max().x(), bounds.max().y(), bounds.max().z(), settings.accuracy,
+    double(settings.theta_samples), double(settings.phi_samples), settings.min_spacing,
+    settings.max_spacing
+  };
+  std::copy(values, values + key_size, out);
+}
+
+bool irradiance_cache::save(const char* filename, int scene) const {
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+    return false;
+
+  double saved_key[key_size];
+  key(scene, saved_key);
+  uint64_t count = records.size();
+  out.write(irradiance_cache_magic, sizeof(irradiance_cache_magic));
+  out.write(reinterpret_cast<const char*>(saved_key), sizeof(saved_key));
+  out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  out.write(reinterpret_cast<const char*>(records.data()), count * sizeof(irradiance_record));
+  return bool(out);
+}
+
+bool irradiance_cache::load(const char* filename, int scene) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    return false;
+
+  char magic[sizeof(irradiance_cache_magic)];
+  double saved_key[key_size], expected_key[key_size];
+  uint64_t count;
+  if (!in.read(magic, sizeof(magic))
+      || memcmp(magic, irradiance_cache_magic, sizeof(magic)) != 0
+      || !in.read(reinterpret_cast<char*>(saved_key), sizeof(saved_key))
+      || !in.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+    std::cerr << "ERROR: '" << filename << "' is not an irradiance cache.\n";
+    return false;
+  }
+
+  key(scene, expected_key);
+  if (memcmp(saved_key, expected_key, sizeof(saved_key)) != 0) {
+    std::cerr << "ERROR: Irradiance cache '" << filename << "' was saved for another scene"
+              << " or settings.\n";
+    return false;
+  }
+
+  // The records have to fill the rest of the file exactly.
+  auto start = in.tellg();
+  in.seekg(0, std::ios::end);
+  auto remaining = uint64_t(in.tellg() - start);
+  in.seekg(start);
+  if (remaining % sizeof(irradiance_record) != 0 || count != remaining / sizeof(irradiance_record)) {
+    std::cerr << "ERROR: Irradiance cache '" << filename << "' is truncated or corrupt.\n";
+    return false;
+  }
+
+  std::vector<irradiance_record> loaded(count);
+  if (!in.read(reinterpret_cast<char*>(loaded.data()), count * sizeof(irradiance_record)))
+    return false;
+
+  for (const auto& r : loaded)
+    insert(r);
+  return true;
+}
+
+#endif
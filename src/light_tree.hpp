@@ -0,0 +1,289 @@
+#ifndef LIGHT_TREE_HPP
+#define LIGHT_TREE_HPP
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "color.hpp"
+#include "hittable_list.hpp"
+#include "lights.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Bounds on the emission of a group of lights: where they are, how much power
+// they emit, and an orientation cone around axis containing every emitter
+// normal (theta_o) plus the spread of emission around each normal (theta_e).
+struct light_bounds {
+  aabb box;
+  double power;
+  vec3 axis;
+  double theta_o;
+  double theta_e;
+};
+
+// Smallest cone containing the cones around a and b, after "Importance
+// Sampling of Many Lights with Adaptive Tree Splitting" (Conty & Kulla 2018).
+inline void union_cone(const vec3& axis_a, double theta_a, const vec3& axis_b, double theta_b,
+                       vec3& axis, double& theta_o) {
+  if (theta_b > theta_a) {
+    union_cone(axis_b, theta_b, axis_a, theta_a, axis, theta_o);
+    return;
+  }
+
+  auto theta_d = acos(clamp(dot(axis_a, axis_b), -1.0, 1.0));
+  if (fmin(theta_d + theta_b, pi) <= theta_a) {
+    axis = axis_a;
+    theta_o = theta_a;
+    return;
+  }
+
+  theta_o = (theta_a + theta_d + theta_b) / 2;
+  if (theta_o >= pi) {
+    axis = axis_a;
+    theta_o = pi;
+    return;
+  }
+
+  // Rotate axis_a towards axis_b by the angle that centers the new cone.
+  auto theta_r = theta_o - theta_a;
+  auto ortho = axis_b - dot(axis_a, axis_b)*axis_a;
+  if (ortho.length_squared() < 1e-12) {
+    axis = axis_a;
+    theta_o = pi;
+    return;
+  }
+  axis = cos(theta_r)*axis_a + sin(theta_r)*unit_vector(ortho);
+}
+
+inline light_bounds union_bounds(const light_bounds& a, const light_bounds& b) {
+  light_bounds u;
+  u.box = surrounding_box(a.box, b.box);
+  u.power = a.power + b.power;
+  union_cone(a.axis, a.theta_o, b.axis, b.theta_o, u.axis, u.theta_o);
+  u.theta_e = fmax(a.theta_e, b.theta_e);
+  return u;
+}
+
+// A bounding volume hierarchy over the lights of a scene, annotated with
+// light_bounds. Every shading point walks it from the root, choosing a child
+// in proportion to its estimated importance, so picking a light is O(log n)
+// in the number of emitters.
+class light_tree : public light_sampler {
+public:
+  light_tree() {}
+
+  light_tree(const hittable_list& scene, double time0, double time1)
+    : lights(scene_lights(scene)) {
+    if (lights.empty())
+      return;
+
+    std::vector<int> order(lights.size());
+    for (size_t i = 0; i < lights.size(); i++)
+      order[i] = i;
+
+    nodes.reserve(2*lights.size());
+    build(order, 0, order.size(), time0, time1);
+  }
+
+  virtual bool empty() const override { return lights.empty(); }
+
+  virtual bool sample(const point3& o, double time, light_sample& ls) const override;
+  virtual double pdf_value(const point3& o, const vec3& v) const override;
+
+  // Recompute the boxes bottom up after lights moved, without changing the
+  // topology. Call this together with bvh_node::refit for the scene geometry.
+  void refit(double time0, double time1);
+
+private:
+  struct node {
+    light_bounds bounds;
+    int left;   // child node indices, both -1 for a leaf
+    int right;
+    int light;  // index into lights for a leaf
+  };
+
+  int build(std::vector<int>& order, size_t start, size_t end, double time0, double time1);
+  light_bounds leaf_bounds(const hittable& light, double time0, double time1) const;
+  double importance(const node& n, const point3& o) const;
+  double left_probability(const node& n, const point3& o) const;
+  double pdf_value(int index, const point3& o, const ray& r, double pmf) const;
+
+public:
+  std::vector<shared_ptr<hittable>> lights;
+
+private:
+  std::vector<node> nodes;
+};
+
+light_bounds light_tree::leaf_bounds(const hittable& light, double time0, double time1) const {
+  light_bounds b;
+  light.bounding_box(time0, time1, b.box);
+
+  // Estimate the average radiance from a few samples seen from outside the
+  // light, since emission is only available through the material at a hit.
+  auto center = 0.5*(b.box.min() + b.box.max());
+  auto diagonal = b.box.max() - b.box.min();
+  auto viewpoint = center + diagonal.length() * vec3(1, 1, 1);
+
+  const int samples = 8;
+  color radiance(0,0,0);
+  for (int i = 0; i < samples; i++) {
+    light_sample ls;
+    if (sample_light(light, viewpoint, time0, ls))
+      radiance += ls.emitted;
+  }
+
+  b.power = luminance(radiance / samples) * light.area() * pi;
+
+  // diffuse_light emits from both sides of every surface, so each emitter
+  // covers the full sphere of normals.
+  b.axis = vec3(0, 1, 0);
+  b.theta_o = pi;
+  b.theta_e = pi/2;
+  return b;
+}
+
+int light_tree::build(std::vector<int>& order, size_t start, size_t end,
+                      double time0, double time1) {
+  int index = nodes.size();
+  nodes.push_back(node());
+
+  if (end - start == 1) {
+    nodes[index].bounds = leaf_bounds(*lights[order[start]], time0, time1);
+    nodes[index].left = nodes[index].right = -1;
+    nodes[index].light = order[start];
+    return index;
+  }
+
+  // Split at the median along the longest axis of the light centroids.
+  std::vector<point3> centers(end - start);
+  point3 lo(infinity, infinity, infinity), hi(-infinity, -infinity, -infinity);
+  for (size_t i = start; i < end; i++) {
+    aabb box;
+    lights[order[i]]->bounding_box(time0, time1, box);
+    auto c = 0.5*(box.min() + box.max());
+    for (int a = 0; a < 3; a++) {
+      lo[a] = fmin(lo[a], c[a]);
+      hi[a] = fmax(hi[a], c[a]);
+    }
+    centers[i - start] = c;
+  }
+
+  auto extent = hi - lo;
+  int axis = extent.x() > extent.y()
+    ? (extent.x() > extent.z() ? 0 : 2)
+    : (extent.y() > extent.z() ? 1 : 2);
+
+  std::vector<int> ranked(end - start);
+  for (size_t i = 0; i < ranked.size(); i++)
+    ranked[i] = i;
+  auto mid = ranked.begin() + ranked.size()/2;
+  std::nth_element(ranked.begin(), mid, ranked.end(), [&](int a, int b) {
+    return centers[a][axis] < centers[b][axis];
+  });
+
+  std::vector<int> sorted(ranked.size());
+  for (size_t i = 0; i < ranked.size(); i++)
+    sorted[i] = order[start + ranked[i]];
+  std::copy(sorted.begin(), sorted.end(), order.begin() + start);
+
+  auto split = start + (end - start)/2;
+  int left = build(order, start, split, time0, time1);
+  int right = build(order, split, end, time0, time1);
+
+  nodes[index].left = left;
+  nodes[index].right = right;
+  nodes[index].light = -1;
+  nodes[index].bounds = union_bounds(nodes[left].bounds, nodes[right].bounds);
+  return index;
+}
+
+void light_tree::refit(double time0, double time1) {
+  // Children are always stored after their parent.
+  for (int i = nodes.size() - 1; i >= 0; i--) {
+    auto& n = nodes[i];
+    if (n.light >= 0) {
+      lights[n.light]->bounding_box(time0, time1, n.bounds.box);
+    } else {
+      n.bounds.box = surrounding_box(nodes[n.left].bounds.box, nodes[n.right].bounds.box);
+    }
+  }
+}
+
+double light_tree::importance(const node& n, const point3& o) const {
+  const auto& b = n.bounds;
+  auto center = 0.5*(b.box.min() + b.box.max());
+  auto radius = 0.5*(b.box.max() - b.box.min()).length();
+
+  auto to_point = o - center;
+  auto distance_squared = to_point.length_squared();
+
+  // Inside the bounds every direction is possible and distance is meaningless.
+  if (distance_squared <= radius*radius)
+    return b.power / fmax(radius*radius, 1e-12);
+
+  // Cones covering every direction cannot cull, skip the trigonometry.
+  if (b.theta_o >= pi)
+    return b.power / distance_squared;
+
+  auto distance = sqrt(distance_squared);
+  auto cos_theta = dot(b.axis, to_point) / distance;
+  auto theta = acos(clamp(cos_theta, -1.0, 1.0));
+  auto theta_u = asin(radius / distance);
+
+  auto theta_prime = fmax(0.0, theta - b.theta_o - theta_u);
+  if (theta_prime >= b.theta_e)
+    return 0;
+
+  return b.power * cos(theta_prime) / distance_squared;
+}
+
+double light_tree::left_probability(const node& n, const point3& o) const {
+  auto l = importance(nodes[n.left], o);
+  auto r = importance(nodes[n.right], o);
+  if (l + r <= 0)
+    return 0.5;
+  return l / (l + r);
+}
+
+bool light_tree::sample(const point3& o, double time, light_sample& ls) const {
+  if (nodes.empty())
+    return false;
+
+  int index = 0;
+  while (nodes[index].light < 0) {
+    const auto& n = nodes[index];
+    index = random_double() < left_probability(n, o) ? n.left : n.right;
+  }
+
+  if (!sample_light(*lights[nodes[index].light], o, time, ls))
+    return false;
+
+  ls.pdf = pdf_value(o, ls.direction);
+  return ls.pdf > 0;
+}
+
+double light_tree::pdf_value(const point3& o, const vec3& v) const {
+  if (nodes.empty())
+    return 0;
+
+  return pdf_value(0, o, ray(o, v), 1.0);
+}
+
+// Only lights whose boxes the ray passes through can have produced it, so the
+// traversal follows those, multiplying the selection probabilities on the way.
+double light_tree::pdf_value(int index, const point3& o, const ray& r, double pmf) const {
+  const auto& n = nodes[index];
+  if (pmf <= 0 || !n.bounds.box.hit(r, 0.001, infinity))
+    return 0;
+
+  if (n.light >= 0)
+    return pmf * lights[n.light]->pdf_value(o, r.direction());
+
+  auto p_left = left_probability(n, o);
+  return pdf_value(n.left, o, r, pmf * p_left)
+    + pdf_value(n.right, o, r, pmf * (1 - p_left));
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef LIGHTS_HPP
+#define LIGHTS_HPP
+
+#include "rtweekend.hpp"
+
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "material.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// A direction towards a light picked by next event estimation. The light lies
+// at t = distance along direction, pdf is the solid angle density of picking
+// the direction and emitted is the radiance arriving from the light.
+struct light_sample {
+  vec3 direction;
+  double distance;
+  double pdf;
+  color emitted;
+};
+
+// Picks lights for next event estimation. pdf_value() must return the solid
+// angle density that sample() produces direction v from o with, summed over
+// every light that could have been picked, so it can weight BSDF samples.
+class light_sampler {
+public:
+  virtual ~light_sampler() {}
+
+  virtual bool empty() const = 0;
+  virtual bool sample(const point3& o, double time, light_sample& ls) const = 0;
+  virtual double pdf_value(const point3& o, const vec3& v) const = 0;
+};
+
+// Collects the lights at the top level of a scene. Lights nested inside
+// aggregates are still found by BSDF sampling, just not sampled directly.
+std::vector<shared_ptr<hittable>> scene_lights(const hittable_list& scene) {
+  std::vector<shared_ptr<hittable>> lights;
+  for (const auto& object : scene.objects) {
+    if (object->is_light())
+      lights.push_back(object);
+  }
+  return lights;
+}
+
+// Fills in everything but the pdf for a sample towards a chosen light.
+bool sample_light(const hittable& light, const point3& o, double time, light_sample& ls) {
+  ls.direction = light.random(o);
+
+  hit_record rec;
+  if (!light.hit(ray(o, ls.direction, time), 0.001, infinity, rec))
+    return false;
+
+  ls.distance = rec.t;
+  ls.emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+  return true;
+}
+
+// The emissive primitives of a scene. A light is chosen with probability
+// proportional to its area and then sampled with its own random().
+class light_list : public light_sampler {
+public:
+  light_list() : total_area(0) {}
+
+  light_list(const hittable_list& scene) : total_area(0) {
+    for (const auto& light : scene_lights(scene))
+      add(light);
+  }
+
+  void add(shared_ptr<hittable> light) {
+    objects.push_back(light);
+    total_area += light->area();
+    cdf.push_back(total_area);
+  }
+
+  virtual bool empty() const override { return objects.empty(); }
+
+  virtual bool sample(const point3& o, double time, light_sample& ls) const override;
+  virtual double pdf_value(const point3& o, const vec3& v) const override;
+
+public:
+  std::vector<shared_ptr<hittable>> objects;
+  std::vector<double> cdf;
+  double total_area;
+};
+
+bool light_list::sample(const point3& o, double time, light_sample& ls) const {
+  if (objects.empty() || total_area <= 0)
+    return false;
+
+  auto pick = std::upper_bound(cdf.begin(), cdf.end(), random_double() * total_area) - cdf.begin();
+  if (pick >= static_cast<long>(objects.size()))
+    pick = objects.size() - 1;
+  if (!sample_light(*objects[pick], o, time, ls))
+    return false;
+
+  ls.pdf = pdf_value(o, ls.direction);
+
+  return ls.pdf > 0;
+}
+
+double light_list::pdf_value(const point3& o, const vec3& v) const {
+  auto sum = 0.0;
+
+  for (const auto& light : objects)
+    sum += light->area() / total_area * light->pdf_value(o, v);
+
+  return sum;
+}
+
+// Multiple importance sampling weight for a sample drawn from the density f
+// when g could also have produced it.
+inline double power_heuristic(double f, double g) {
+  return (f*f) / (f*f + g*g);
+}
+
+#endif
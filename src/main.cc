@@ -1,429 +1,59 @@
 #include "rtweekend.hpp"
 
+#include "adaptive.hpp"
+#include "animation.hpp"
+#include "checkpoint.hpp"
 #include "color.hpp"
-#include "hittable_list.hpp"
-#include "sphere.hpp"
-#include "moving_sphere.hpp"
-#include "triangle.hpp"
-#include "camera.hpp"
-#include "material.hpp"
-#include "bvh.hpp"
-#include "aarect.hpp"
-#include "box.hpp"
-#include "constant_medium.hpp"
-
+#include "compile.hpp"
+#include "denoise.hpp"
+#include "environment.hpp"
+#include "lights.hpp"
+#include "light_tree.hpp"
+#include "framebuffer.hpp"
+#include "image_output.hpp"
+#include "options.hpp"
+#include "preview.hpp"
+#include "progressive.hpp"
+#include "render.hpp"
+#include "sampler.hpp"
+#include "scenes.hpp"
+#include "temporal.hpp"
+#include "tiled_image.hpp"
+
+#include <chrono>
+#include <fstream>
 #include <iostream>
-
-color ray_color(const ray& r, const color& background, const hittable& world, int depth) {
-  hit_record rec;
-
-  // If we've exceeded the ray bounce limit, no more light is gathered.
-  if(depth <= 0) {
-    return color(0,0,0);
-  }
-
-  // If the ray hits nothing, return the background color
-  if (!world.hit(r, 0.001, infinity, rec)) {
-    return background;
-  }
-
-  ray scattered;
-  color attenuation;
-  color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-  if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-    return emitted;
-  }
-
-  return emitted + attenuation * ray_color(scattered, background, world, depth-1);
-}
-
-hittable_list refractive_dielectrics() {
-  hittable_list world;
-
-  // This looks funny on reflection and the dielectric isn't being reflected, why?
-  auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-  auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-  auto material_left   = make_shared<dielectric>(1.5);
-  auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
-
-  world.add(make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
-  world.add(make_shared<sphere>(point3( 0.0,    0.0, -1.0),   0.5, material_center));
-  world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
-  world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),  -0.45, material_left));
-  world.add(make_shared<sphere>(point3( 1.0,    0.0, -1.0),   0.5, material_right));
-
-  return world;
-}
-
-hittable_list camera_fov_test() {
-  hittable_list world;
-
-  auto R = cos(pi/4);
-  auto material_left  = make_shared<lambertian>(color(0,0,1));
-  auto material_right = make_shared<lambertian>(color(1,0,0));
-
-  world.add(make_shared<sphere>(point3(-R, 0, -1), R, material_left));
-  world.add(make_shared<sphere>(point3( R, 0, -1), R, material_right));
-
-  return world;
-}
-
-hittable_list two_spheres() {
-  hittable_list objects;
-
-  auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-
-  objects.add(make_shared<sphere>(point3(0,-10, 0), 10, make_shared<lambertian>(checker)));
-  objects.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-
-  return objects;
-}
-
-hittable_list two_perlin_spheres() {
-  hittable_list objects;
-
-  auto perlin_text = make_shared<noise_texture>(4);
-
-  objects.add(make_shared<sphere>(point3(0,-1000,0), 1000,
-                                  make_shared<lambertian>(perlin_text)));
-  objects.add(make_shared<sphere>(point3(0,2,0), 2,
-                                  make_shared<lambertian>(perlin_text)));
-
-  return objects;
-}
-
-hittable_list random_scene() {
-  hittable_list world;
-
-  auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9,0.9,0.9));
-  auto ground_material = make_shared<lambertian>(checker);
-  world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-  for (int a = -11; a < 11; a++) {
-    for (int b = -11; b < 11; b++) {
-      auto choose_mat = random_double();
-      point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-      if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-        shared_ptr<material> sphere_material;
-
-        if (choose_mat < 0.8) {
-          // diffuse
-          auto albedo = color::random() * color::random();
-          sphere_material = make_shared<lambertian>(albedo);
-          auto center2 = center + vec3(0, random_double(0, 0.5), 0);
-          world.add(make_shared<moving_sphere>(center, center2, 0.0, 1.0,
-                                               0.2, sphere_material));
-        } else if (choose_mat < 0.95) {
-          // metal
-          auto albedo = color::random(0.5, 1);
-          auto fuzz = random_double(0, 0.5);
-          sphere_material = make_shared<metal>(albedo, fuzz);
-          world.add(make_shared<sphere>(center, 0.2, sphere_material));
-        } else {
-          // glass
-          sphere_material = make_shared<dielectric>(1.5);
-          world.add(make_shared<sphere>(center, 0.2, sphere_material));
-        }
-      }
-    }
-  }
-
-  auto material1 = make_shared<dielectric>(1.5);
-  world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-  auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-  world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-  auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-  world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-  return world;
-}
-
-hittable_list earth() {
-  auto earth_texture = make_shared<image_texture>("images/earthmap.jpg");
-  auto earth_surface = make_shared<lambertian>(earth_texture);
-  auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
-
-  return hittable_list(globe);
-}
-
-hittable_list simple_light() {
-  hittable_list objects;
-  auto pertext = make_shared<noise_texture>(4);
-
-  objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-  objects.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
-
-  auto difflight = make_shared<diffuse_light>(color(4.0,4.0,4.0));
-  objects.add(make_shared<xy_rect>(3,5,1,3,-2, difflight));
-  // optional overhead light
-  auto difflight2 = make_shared<diffuse_light>(color(0.5,0.0,0.0));
-  objects.add(make_shared<sphere>(point3(0,7,0), 1, difflight2));
-
-  return objects;
-}
-
-hittable_list cornell_box() {
-  hittable_list objects;
-
-  auto red   = make_shared<lambertian>(color(.65, .05, .05));
-  auto white = make_shared<lambertian>(color(.73, .73, .73));
-  auto green = make_shared<lambertian>(color(.12, .45, .15));
-  auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-  // X is the intuitive direction
-  // Y is up
-  // Z is in
-  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-  objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
-  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-  objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-  shared_ptr<hittable> back_box =
-    make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-  back_box = make_shared<rotate_y>(back_box, 15);
-  back_box = make_shared<translate>(back_box, point3(265, 0, 295));
-  objects.add(back_box);
-
-  shared_ptr<hittable> front_box =
-    make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-  front_box = make_shared<rotate_y>(front_box, -18);
-  front_box = make_shared<translate>(front_box, vec3(130,0,65));
-  objects.add(front_box);
-
-  return objects;
-}
-
-hittable_list cornell_smoke() {
-  hittable_list objects;
-
-  auto red   = make_shared<lambertian>(color(.65, .05, .05));
-  auto white = make_shared<lambertian>(color(.73, .73, .73));
-  auto green = make_shared<lambertian>(color(.12, .45, .15));
-  auto light = make_shared<diffuse_light>(color(7, 7, 7));
-
-  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-  objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-  objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-  shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
-  box1 = make_shared<rotate_y>(box1, 15);
-  box1 = make_shared<translate>(box1, vec3(265,0,295));
-
-  shared_ptr<hittable> box2 = make_shared<box>(point3(0,0,0), point3(165,165,165), white);
-  box2 = make_shared<rotate_y>(box2, -18);
-  box2 = make_shared<translate>(box2, vec3(130,0,65));
-
-  objects.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
-  objects.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
-
-  return objects;
-}
-
-hittable_list final_scene() {
-  hittable_list boxes1;
-  auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
-
-  // floor cubes, 20x20
-  const int boxes_per_side = 20;
-  for (int i = 0; i < boxes_per_side; i++) {
-    for (int j = 0; j < boxes_per_side; j++) {
-      auto w = 100.0;
-      auto x0 = -1000.0 + i*w;
-      auto z0 = -1000.0 + j*w;
-      auto y0 = 0.0;
-      auto x1 = x0 + w;
-      auto y1 = random_double(1,101);
-      auto z1 = z0 + w;
-
-      boxes1.add(make_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
-    }
-  }
-
-  hittable_list objects;
-
-  objects.add(make_shared<bvh_node>(boxes1, 0, 1));
-
-  // light up top
-  auto light = make_shared<diffuse_light>(color(7, 7, 7));
-  objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
-
-  // copper moving sphere
-  auto center1 = point3(400, 400, 200);
-  auto center2 = center1 + vec3(30,0,0);
-  auto moving_sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-  objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-
-  // transparent globe
-  objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-  // lower right metal sphere
-  objects.add(make_shared<sphere>(
-                                  point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
-                                  ));
-
-  // blue metal ball
-  auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
-  objects.add(boundary);
-  objects.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-  // unknown
-  boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-  objects.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
-
-  // earthglobe
-  auto emat = make_shared<lambertian>(make_shared<image_texture>("images/earthmap.jpg"));
-  objects.add(make_shared<sphere>(point3(400,200,400), 100, emat));
-  auto pertext = make_shared<noise_texture>(0.1);
-  objects.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
-
-  // cube of spheres
-  hittable_list boxes2;
-  auto white = make_shared<lambertian>(color(.73, .73, .73));
-  int ns = 1000;
-  for (int j = 0; j < ns; j++) {
-    boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
-  }
-
-  objects.add(make_shared<translate>(make_shared<rotate_y>(make_shared<bvh_node>(boxes2, 0.0, 1.0), 15), vec3(-100,270,395)));
-
-  return objects;
-}
-
-hittable_list ghost_scene() {
-  hittable_list boxes1;
-  auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
-
-  // floor cubes, 20x20
-  const int boxes_per_side = 20;
-  for (int i = 0; i < boxes_per_side; i++) {
-    for (int j = 0; j < boxes_per_side; j++) {
-      auto w = 100.0;
-      auto x0 = -1000.0 + i*w;
-      auto z0 = -1000.0 + j*w;
-      auto y0 = 0.0;
-      auto x1 = x0 + w;
-      auto y1 = random_double(1,101);
-      auto z1 = z0 + w;
-
-      boxes1.add(make_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
-    }
-  }
-
-  hittable_list objects;
-
-  objects.add(make_shared<bvh_node>(boxes1, 0, 1));
-
-  // light up top
-  auto light = make_shared<diffuse_light>(color(7, 7, 7));
-  objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
-
-  // transparent globe
-  // objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-
-  // unknown
-  auto boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-  objects.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
-
-  auto pertext = make_shared<noise_texture>(0.2);
-  objects.add(make_shared<sphere>(point3(220,360,300), 80, make_shared<lambertian>(pertext)));
-  auto head_cover = make_shared<sphere>(point3(220, 360, 300), 82, make_shared<dielectric>(1.5));
-  objects.add(make_shared<constant_medium>(head_cover, .0001, color(.33,.33,.66)));
-
-  // alternatively make smaller variations on the head as moving spheres of the same size to make a cylindrical body
-
-  // body
-  hittable_list boxes2;
-  int ns = 120;
-  for (int j = 0; j < ns; j++) {
-    auto c = make_shared<lambertian>(color(.33, .33, .66)*random_double(0.6,1.1));
-    auto pos = vec3(random_double(20, 140), random_double(0, 220), random_double(20, 140));
-    auto pos2 = pos + vec3(0,-random_double(5, 20),0);
-    boxes2.add(make_shared<moving_sphere>(pos,pos2, 0, 1, 20, c));
-  }
-
-  objects.add(make_shared<translate>(make_shared<rotate_y>(make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-                                     vec3(140,120,220)));
-
-  return objects;
-}
-
-hittable_list triangle_test() {
-  hittable_list world;
-
-  point3 origin = point3(0,0,0);
-  point3 a = point3(0,10,0);
-  point3 b = point3(-10,0,0);
-  point3 c = point3(0,0,-10);
-  point3 d = origin;
-
-  // auto ground = make_shared<lambertian>(color(0.5, 0.0, 0.0));
-  // world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground));
-
-  // Consider rendering the expected normal of the entire triangle as a box in the example?
-  auto a_color = make_shared<lambertian>(color(1.0,0.0,0.0));
-  auto b_color = make_shared<lambertian>(color(0.0,1.0,0.0));
-  auto c_color = make_shared<lambertian>(color(0.0,0.0,1.0));
-  auto d_color = make_shared<lambertian>(color(0.0,0.5,0.5));
-  world.add(make_shared<sphere>(a, 1, a_color));
-  world.add(make_shared<sphere>(b, 1, b_color));
-  world.add(make_shared<sphere>(c, 1, c_color));
-  world.add(make_shared<sphere>(d, 1, d_color));
-  auto tex0 = make_shared<lambertian>(color(0.0, 1.0, 0.0));
-  world.add(make_shared<triangle>(d,a,b, tex0)); // in z-plane
-  auto tex1 = make_shared<lambertian>(color(0.0, 0.0, 1.0));
-  world.add(make_shared<triangle>(d,c,b, tex1)); // in y-plane
-  auto tex2 = make_shared<lambertian>(color(0.5, 0.0, 1.0));
-  world.add(make_shared<triangle>(d,c,a, tex2)); // in x-plane
-
-  auto light = make_shared<diffuse_light>(color(1.0,1.0,1.0));
-  world.add(make_shared<sphere>(point3(-20,0,-20), 10, light));
-
-  return world;
-}
-
-hittable_list st_patricks_test() {
-  hittable_list world;
-
-  auto green = make_shared<lambertian>(color(0.1, 0.8, 0.2));
-  auto orange = make_shared<lambertian>(color(0.6, 0.3, 0.0));
-
-  auto light = make_shared<diffuse_light>(color(1.0,1.0,1.0));
-  world.add(make_shared<sphere>(point3(30,0,-20), 10, light));
-
-  point3 base = point3(0.0, 0.0, 0.0);
-  world.add(make_shared<sphere>(base, 0.5, green));
-
-  float r = 15.0;
-  float width = 0.7;
-  for(float theta = 0.0; theta < 1.5*pi; theta += pi/2) {
-    for(float t = theta; t <= (theta + width); t += width / 2) {
-      point3 start = point3(r * cos(t), r*sin(t), 0.0);
-      point3 end = point3(r * cos(t+width), r*sin(t+width), 5.0);
-      world.add(make_shared<triangle>(base, start, end, green));
-      world.add(make_shared<sphere>(start, 0.5, green));
-      world.add(make_shared<sphere>(end, 0.5, orange));
-    }
+#include <sstream>
+
+int main(int argc, char** argv) {
+  render_options options;
+  if (!parse_options(argc, argv, options))
+    return 1;
+
+  // Checkpoints save the state of rand(), so it has to be there from the
+  // first number the scene draws.
+  if (!options.checkpoint.empty())
+    rand_state::adopt();
+
+  if (!options.convert_from.empty())
+    return convert_to_paged_texture(options.convert_from.c_str(), options.convert_to) ? 0 : 1;
+
+  // Animations are streams of frames, in p6 or y4m.
+  auto format = format_for_path(options.output);
+  bool y4m = !options.animation.empty() && options.format == "y4m";
+  if (!options.format.empty() && !y4m && !parse_image_format(options.format, format)) {
+    std::cerr << "Unknown image format '" << options.format << "'.\n";
+    usage(argv[0]);
+    return 1;
   }
+  if (!options.assemble.empty())
+    return assemble_tiled_image(options.assemble, format, options.output) ? 0 : 1;
 
-  return world;
-}
-
-camera camera_at(const point3 &lookfrom, const point3 &lookat,
-                 double aspect_ratio, double fov, double aperture) {
-  vec3 vup(0,1,0);
-  auto dist_to_focus = 10.0;
-
-  return camera(lookfrom, lookat, vup, fov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
-}
-
-int main() {
+  // Encodes and writes the image while main() reports on the render.
+  image_writer output;
+  auto write_output = [&](float_image image) {
+    output.write(std::move(image), format, options.output);
+  };
 
   // Image
 
@@ -437,35 +67,40 @@ int main() {
   bvh_node world;
   hittable_list world_list;
   camera cam = camera_at(point3(13,2,3), point3(0,0,0), aspect_ratio, 20.0, 0.1);
-  color background(0,0,0);
-
-  switch(10) {
+  environment background(color(0,0,0));
+  bool use_bvh = true;
+  if (options.fast_math)
+    shading_math = math_mode::fast;
+  texture_cache::global().set_directory(options.texture_cache);
+  page_cache::global().set_budget(size_t(options.texture_memory) << 20);
+
+  switch(options.scene) {
   case 1:
-    world = bvh_node(random_scene(), 0, 1);
+    world_list = random_scene();
     background = color(0.70, 0.80, 1.00);
     break;
   case 2:
-    world = bvh_node(two_spheres(), 0, 1);
+    world_list = two_spheres();
     background = color(0.70, 0.80, 1.00);
     cam = camera_at(point3(13,2,3), point3(0,0,0), aspect_ratio, 20.0, 0.0);
     break;
   case 3:
-    world = bvh_node(two_perlin_spheres(), 0, 1);
+    world_list = two_perlin_spheres();
     background = color(0.70, 0.80, 1.00);
     break;
   case 4:
-    world = bvh_node(earth(), 0, 1);
+    world_list = earth();
     background = color(0.70, 0.80, 1.00);
     cam = camera_at(point3(13,2,3), point3(0,0,0), aspect_ratio, 20.0, 0.0);
     break;
   case 5:
-    world = bvh_node(simple_light(), 0, 1);
+    world_list = simple_light();
     samples_per_pixel = 400;
     background = color(0.0, 0.0, 0.0);
     cam = camera_at(point3(26,3,6), point3(0,2,0), aspect_ratio, 20.0, 0.0);
     break;
   case 6:
-    world = bvh_node(cornell_box(), 0, 1);
+    world_list = cornell_box();
     aspect_ratio = 1.0;
     image_width = 600;
     samples_per_pixel = 20;
@@ -473,14 +108,14 @@ int main() {
     cam = camera_at(point3(278, 278, -800), point3(278, 278, 0), aspect_ratio, 40.0, 0.0);
     break;
   case 7:
-    world = bvh_node(cornell_smoke(), 0, 1);
+    world_list = cornell_smoke();
     aspect_ratio = 1.0;
     image_width = 600;
     samples_per_pixel = 100;
     cam = camera_at(point3(278, 278, -800), point3(278, 278, 0), aspect_ratio, 40.0, 0.0);
     break;
   case 8:
-    world = bvh_node(final_scene(), 0, 1);
+    world_list = final_scene();
     aspect_ratio = 1.0;
     image_width = 800;
     samples_per_pixel = 1000;
@@ -488,7 +123,7 @@ int main() {
     cam = camera_at(point3(478, 278, -600), point3(278, 278, 0), aspect_ratio, 40.0, 0.0);
     break;
   case 9:
-    world = bvh_node(ghost_scene(), 0, 1);
+    world_list = ghost_scene();
     aspect_ratio = 1.0;
     image_width = 800;
     samples_per_pixel = 16;
@@ -496,39 +131,480 @@ int main() {
     cam = camera_at(point3(478, 278, -600), point3(278, 278, 0), aspect_ratio, 40.0, 0.0);
     break;
   case 10:
-    // world = bvh_node(triangle_test(), 0, 1);
+    // triangle bounding boxes are still broken, so skip the bvh
     world_list = triangle_test();
+    use_bvh = false;
     background = color(0.1, 0.1, 0.1);
     cam = camera_at(point3(-5, 5, -20), point3(0, 0, 0), aspect_ratio, 75.0, 0.0);
     break;
+  case 12:
+    world_list = many_lights();
+    aspect_ratio = 1.0;
+    image_width = 600;
+    samples_per_pixel = 20;
+    background = color(0,0,0);
+    cam = camera_at(point3(278, 278, -800), point3(278, 278, 0), aspect_ratio, 40.0, 0.0);
+    break;
+  case 13:
+    world_list = sunlit_spheres();
+    background = environment::daylight(vec3(-0.4, 0.6, 0.5));
+    cam = camera_at(point3(13,2,3), point3(0,0,0), aspect_ratio, 30.0, 0.0);
+    break;
+  case 14:
+    world_list = cornell_glass();
+    aspect_ratio = 1.0;
+    image_width = 600;
+    samples_per_pixel = 64;
+    background = color(0,0,0);
+    cam = camera_at(point3(278, 278, -800), point3(278, 278, 0), aspect_ratio, 40.0, 0.0);
+    break;
+  case 15:
+    world_list = light_through_door();
+    aspect_ratio = 1.0;
+    image_width = 600;
+    samples_per_pixel = 64;
+    background = color(0,0,0);
+    cam = camera_at(point3(278, 278, -800), point3(278, 278, 0), aspect_ratio, 40.0, 0.0);
+    break;
+  case 16:
+    world_list = cornell_clouds();
+    aspect_ratio = 1.0;
+    image_width = 600;
+    samples_per_pixel = 100;
+    background = color(0,0,0);
+    cam = camera_at(point3(278, 278, -800), point3(278, 278, 0), aspect_ratio, 40.0, 0.0);
+    break;
   default:
   case 11:
-    // world = bvh_node(st_patricks_test(), 0, 1);
     world_list = st_patricks_test();
+    use_bvh = false;
     background = color(0.1, 0.1, 0.1);
     cam = camera_at(point3(0, 0, -20), point3(0, 0, 0), aspect_ratio, 75.0, 0.0);
   }
 
+  if (options.width > 0)
+    image_width = options.width;
+  if (options.samples_per_pixel > 0)
+    samples_per_pixel = options.samples_per_pixel;
+  if (!options.environment.empty()) {
+    background = environment(options.environment.c_str(), options.environment_intensity);
+    if (!background.sampled())
+      return 1;
+  }
+
+  auto compiled = compile_scene(world_list);
+  std::cerr << "Materials: " << compiled.materials << " in " << compiled.objects << " objects, "
+            << compiled.unique_materials << " after merging, " << compiled.texture_nodes
+            << " texture nodes.\n";
+  if (texture_cache::global().stats().textures > 0)
+    texture_cache::global().report(std::cerr);
+
+  if (use_bvh)
+    world = bvh_node(world_list, 0, 1);
+  const hittable& scene = use_bvh ? static_cast<const hittable&>(world) : world_list;
+  light_tree lights(world_list, 0, 1);
+
   // Render
 
   const int image_height = static_cast<int>(image_width / aspect_ratio);
-  std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+  auto pixel_sampler = make_sampler(options.sampler, samples_per_pixel);
+
+  render_context context(background, scene, lights);
+
+  aabb scene_bounds;
+  scene.bounding_box(0, 1, scene_bounds);
+  auto scene_size = (scene_bounds.max() - scene_bounds.min()).length();
+
+  // Photon passes shrink the radius as in "Progressive Photon Mapping: A
+  // Probabilistic Approach" (Knaus & Zwicker 2011), each pass renders an
+  // equal share of the samples with its own photon map.
+  const int photon_passes = options.photons > 0 ? std::max(1, options.photon_passes) : 1;
+  double photon_radius = options.photon_radius > 0 ? options.photon_radius : 0.004 * scene_size;
+  photon_map caustics;
+  auto trace_photons = [&](int pass) {
+    auto start = std::chrono::steady_clock::now();
+    caustics = photon_map(lights.lights, scene, options.photons, photon_radius, max_depth, pass);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "Photon pass " << pass + 1 << ": " << caustics.size() << " caustic photons, radius "
+              << photon_radius << ", in " << elapsed.count() << "s on " << thread_count()
+              << " threads.\n";
+    photon_radius *= sqrt((pass + 1 + options.photon_alpha) / (pass + 2));
+  };
+  if (options.photons > 0) {
+    trace_photons(0);
+    context.caustics = &caustics;
+  }
+
+  // The guide learns over its own training passes and is frozen for the
+  // render.
+  path_guide guide(scene_bounds);
+  if (options.guide_passes > 0) {
+    auto start = std::chrono::steady_clock::now();
+    train_guide(guide, options.guide_passes, cam, image_width, image_height, context, max_depth);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "Path guide: " << guide.size() << " cells after " << options.guide_passes
+              << " passes in " << elapsed.count() << "s on " << thread_count() << " threads.\n";
+    context.guide = &guide;
+  }
+
+  irradiance_cache cache(scene_bounds);
+  if (options.irradiance_cache) {
+    auto start = std::chrono::steady_clock::now();
+    if (!options.cache_file.empty() && cache.load(options.cache_file.c_str(), options.scene))
+      std::cerr << "Loaded " << cache.size() << " irradiance records.\n";
+
+    auto loaded = cache.size();
+    populate_irradiance_cache(cache, cache_points(cam, image_width, image_height, 2, context,
+                                                  max_depth), context);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "Irradiance cache: " << cache.size() - loaded << " new records in "
+              << elapsed.count() << "s on " << thread_count() << " threads.\n";
+
+    if (!options.cache_file.empty() && !cache.save(options.cache_file.c_str(), options.scene))
+      std::cerr << "ERROR: Could not write irradiance cache '" << options.cache_file << "'.\n";
+    context.irradiance = &cache;
+  }
+
+  auto sample = [&](int i, int j, int index) {
+    return sample_pixel(i, j, index, image_width, image_height,
+                        cam, context, max_depth, *pixel_sampler);
+  };
+
+  if (!options.animation.empty()) {
+    animation keys;
+    if (!keys.load(options.animation))
+      return 1;
+    if (auto unknown = keys.unknown_objects(world_list)) {
+      std::cerr << "ERROR: " << unknown << " objects moved in '" << options.animation
+                << "' are not in scene " << options.scene << ".\n";
+      return 1;
+    }
+    if (keys.moves_objects() && (options.photons > 0 || options.guide_passes > 0
+                                 || options.irradiance_cache)) {
+      std::cerr << "ERROR: Photon maps, path guides and irradiance caches are built once, so"
+                << " only the camera can move.\n";
+      return 1;
+    }
+    if (options.temporal_spp > 0 && keys.moves_objects()) {
+      std::cerr << "ERROR: --temporal reuses samples of a still scene; only the camera can move.\n";
+      return 1;
+    }
+    if (!y4m && (options.format.empty() ? image_format::p6 : format) != image_format::p6) {
+      std::cerr << "ERROR: Animations are written as p6 or y4m.\n";
+      return 1;
+    }
+
+    int first = options.first_frame, last = options.last_frame;
+    if (last < first) {
+      first = keys.first_frame();
+      last = keys.last_frame();
+    }
 
+    std::ofstream file;
+    bool to_stdout = options.output.empty() || options.output == "-";
+    if (!to_stdout)
+      file.open(options.output, std::ios::binary);
+    std::ostream& stream = to_stdout ? std::cout : file;
+    if (!stream || (y4m && !write_y4m_header(stream, image_width, image_height, options.fps))) {
+      std::cerr << "ERROR: Could not write '" << (to_stdout ? "-" : options.output) << "'.\n";
+      return 1;
+    }
+
+    // A moving camera shares the scene; moving objects need a bvh and lights
+    // of their own in every frame.
+    struct frame {
+      camera cam;
+      shared_ptr<frame_world> world;
+      render_context context;
+    };
+    auto prepare = [&](int number) {
+      auto frame_cam = keys.camera_at_frame(number, aspect_ratio, cam);
+      if (!keys.moves_objects())
+        return make_shared<frame>(frame{ frame_cam, nullptr, context });
+      auto moved = make_shared<frame_world>(keys.scene_at_frame(world_list, number), use_bvh);
+      return make_shared<frame>(frame{ frame_cam, moved,
+                                       render_context(background, moved->scene(), moved->lights) });
+    };
+
+    tile_layout layout(image_width, image_height, options.tile_size);
+    auto render_tile = [&](const frame& f, int tile, float_image& image) {
+      auto tile_sampler = make_sampler(options.sampler, samples_per_pixel);
+      for (int y = layout.y0(tile); y < layout.y0(tile) + layout.tile_height(tile); ++y) {
+        for (int x = layout.x0(tile); x < layout.x0(tile) + layout.tile_width(tile); ++x) {
+          color pixel_color(0,0,0);
+          for (int s = 0; s < samples_per_pixel; ++s)
+            pixel_color += sample_pixel(x, image_height-1 - y, s, image_width, image_height,
+                                        f.cam, f.context, max_depth, *tile_sampler);
+          image.set(x, y, pixel_color * (1.0 / samples_per_pixel));
+        }
+      }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    image_writer frames;
+    auto write_frame = [&](int number, float_image image) {
+      std::cerr << "\rFrames remaining: " << last - number << ' ' << std::flush;
+      frames.write(std::move(image), [&](const float_image& image) {
+        return (y4m ? write_y4m_frame(stream, image)
+                    : write_image(stream, image, image_format::p6)) && stream.flush();
+      }, options.output);
+    };
+
+    if (options.temporal_spp > 0) {
+      // Each frame starts from the last, so frames render one at a time.
+      // History is worth at most four frames at --spp.
+      temporal_accumulator history(image_width, image_height, options.temporal_spp,
+                                   samples_per_pixel, 4 * samples_per_pixel);
+      double reused = 0, spp = 0;
+      for (int number = first; number <= last; number++) {
+        auto f = prepare(number);
+        write_frame(number, history.render(
+          f->cam, f->context.world, [&]() { return make_sampler(options.sampler, samples_per_pixel); },
+          [&](int i, int j, int index, sampler& s, aov_sample* aov) {
+            return sample_pixel(i, j, index, image_width, image_height, f->cam, f->context,
+                                max_depth, s, aov);
+          }));
+        reused += history.reused_fraction();
+        spp += history.average_spp();
+      }
+      std::cerr << "\nTemporal: " << 100 * reused / (last - first + 1) << "% of pixels reused, "
+                << spp / (last - first + 1) << " spp per frame on average.";
+    } else {
+      render_frames<frame>(first, last, layout, 3, prepare, render_tile, write_frame);
+    }
+    bool written = frames.finish();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "\n" << last - first + 1 << " frames in " << elapsed.count() << "s on "
+              << thread_count() << " threads.\nDone.\n";
+    return written ? 0 : 1;
+  }
+
+  if (options.preview) {
+    // One stream of frames, which may be a named pipe.
+    std::ofstream file;
+    bool to_stdout = options.output.empty() || options.output == "-";
+    if (!to_stdout)
+      file.open(options.output, std::ios::binary);
+    std::ostream& stream = to_stdout ? std::cout : file;
+    auto frame_format = options.format.empty() ? image_format::p6 : format;
+
+    // Frames the viewer has not taken by the time a newer one is done are
+    // skipped, so the render never waits for it.
+    image_writer frames(1, true);
+    render_preview(image_width, image_height, samples_per_pixel,
+                   [&]() { return make_sampler(options.sampler, samples_per_pixel); },
+                   [&](int i, int j, int index, sampler& s) {
+                     return sample_pixel(i, j, index, image_width, image_height, cam, context,
+                                         max_depth, s);
+                   },
+                   [&](float_image image) {
+                     frames.write(std::move(image), frame_format, stream, options.output);
+                   });
+    bool written = frames.finish();
+    std::cerr << frames.dropped_images() << " frames skipped.\nDone.\n";
+    return written ? 0 : 1;
+  }
+
+  if (!options.tiles.empty()) {
+    tile_layout layout(image_width, image_height, options.tile_size);
+    tiled_image_writer tiles;
+    if (!tiles.open(options.tiles, layout)) {
+      std::cerr << "ERROR: Could not create tile file '" << options.tiles << "'.\n";
+      return 1;
+    }
+
+    bool rendered = render_tiled(tiles, [&](int tile, float* rgb) {
+      auto tile_sampler = make_sampler(options.sampler, samples_per_pixel);
+      for (int y = 0; y < layout.tile_height(tile); ++y) {
+        for (int x = 0; x < layout.tile_width(tile); ++x) {
+          int i = layout.x0(tile) + x, j = image_height-1 - (layout.y0(tile) + y);
+          color pixel_color(0,0,0);
+          for (int s = 0; s < samples_per_pixel; ++s)
+            pixel_color += sample_pixel(i, j, s, image_width, image_height, cam, context,
+                                        max_depth, *tile_sampler);
+          pixel_color = pixel_color * (1.0 / samples_per_pixel);
+          for (int c = 0; c < 3; ++c)
+            *rgb++ = float(pixel_color[c]);
+        }
+      }
+    });
+    if (!tiles.close() || !rendered) {
+      std::cerr << "ERROR: Could not write tile file '" << options.tiles << "'.\n";
+      return 1;
+    }
+
+    bool assembled = assemble_tiled_image(options.tiles, format, options.output);
+    std::cerr << "Done.\n";
+    return assembled ? 0 : 1;
+  }
+
+  if (options.time_budget > 0) {
+    framebuffer fb(image_width, image_height);
+    auto result = render_until(fb, options.time_budget, sample);
+    write_output(fb.resolve());
+
+    auto samples = fb.total_samples();
+    std::cerr << "Rendered " << result.passes << " passes in " << result.seconds << "s: "
+              << double(samples) / (image_width * image_height) << " spp, "
+              << samples / result.seconds << " samples/s, "
+              << rays_traced / result.seconds << " rays/s\nDone.\n";
+    return output.finish() ? 0 : 1;
+  }
+
+  if (options.adaptive_threshold > 0) {
+    adaptive_settings settings;
+    settings.threshold = options.adaptive_threshold;
+    // The scene's spp is the average; pixels start with a quarter of it and
+    // the noisiest can take sixteen times as many.
+    settings.average_spp = samples_per_pixel;
+    settings.min_spp = std::max(2, std::min(settings.min_spp, samples_per_pixel / 4));
+    settings.max_spp = options.max_spp > 0 ? options.max_spp : 16 * samples_per_pixel;
+    settings.min_spp = std::min(settings.min_spp, settings.max_spp);
+
+    auto pixels = render_adaptive(image_width, image_height, settings, sample);
+
+    long total = 0;
+    float_image image(image_width, image_height);
+    for (int j = 0; j < image_height; ++j) {
+      for (int i = 0; i < image_width; ++i) {
+        const auto& pixel = pixels[j*image_width + i];
+        image.set(i, image_height-1 - j, pixel.sum * (1.0 / pixel.samples));
+        total += pixel.samples;
+      }
+    }
+    write_output(std::move(image));
+
+    if (!options.sample_map.empty())
+      write_sample_map(options.sample_map.c_str(), pixels, image_width, image_height);
+
+    std::cerr << "Average samples per pixel: "
+              << double(total) / (image_width * image_height) << "\nDone.\n";
+    return output.finish() ? 0 : 1;
+  }
+
+  if (options.denoise) {
+    using clock = std::chrono::steady_clock;
+    auto seconds = [](clock::time_point start) {
+      return std::chrono::duration<double>(clock::now() - start).count();
+    };
+
+    auto start = clock::now();
+    framebuffer fb(image_width, image_height);
+    aov_buffer aovs(image_width, image_height);
+    for (int j = image_height-1; j >= 0; --j) {
+      std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
+      for (int i = 0; i < image_width; ++i) {
+        for (int s = 0; s < samples_per_pixel; ++s) {
+          aov_sample aov;
+          auto c = sample_pixel(i, j, s, image_width, image_height, cam, context,
+                                max_depth, *pixel_sampler, &aov);
+          fb.add(i, j, c);
+          aovs.add(i, j, c, aov);
+        }
+      }
+    }
+    auto render_time = seconds(start);
+
+    start = clock::now();
+    denoiser filter(fb, aovs);
+    denoise_timings timings;
+    timings.prepare = seconds(start);
+    auto pixels = filter.run(denoise_settings(), timings);
+
+    start = clock::now();
+    float_image image(image_width, image_height);
+    for (int j = 0; j < image_height; ++j) {
+      for (int i = 0; i < image_width; ++i)
+        image.set(i, image_height-1 - j, pixels[j*image_width + i]);
+    }
+    write_output(std::move(image));
+    auto written = output.finish();
+    auto output_time = seconds(start);
+
+    std::cerr << "\nRender:  " << render_time << "s\n"
+              << "Prepare: " << timings.prepare << "s\n"
+              << "Filter:  " << timings.filter << "s on " << thread_count() << " threads\n"
+              << "Resolve: " << timings.resolve << "s\n"
+              << "Output:  " << output_time << "s\nDone.\n";
+    return written ? 0 : 1;
+  }
+
+  if (photon_passes > 1) {
+    framebuffer fb(image_width, image_height);
+    for (int pass = 0; pass < photon_passes; pass++) {
+      if (pass > 0)
+        trace_photons(pass);
+
+      int first = pass * samples_per_pixel / photon_passes;
+      int last = (pass + 1) * samples_per_pixel / photon_passes;
+      for (int j = 0; j < image_height; ++j) {
+        for (int i = 0; i < image_width; ++i) {
+          for (int s = first; s < last; ++s)
+            fb.add(i, j, sample(i, j, s));
+        }
+      }
+    }
+    write_output(fb.resolve());
+    std::cerr << "Done.\n";
+    return output.finish() ? 0 : 1;
+  }
+
+  if (!options.checkpoint.empty()) {
+    // Everything but the sample count the image depends on.
+    std::ostringstream settings;
+    settings << "scene " << options.scene << ", width " << image_width << ", sampler "
+             << options.sampler << ", fast math " << options.fast_math;
+
+    framebuffer fb(image_width, image_height);
+    render_progress progress;
+    checkpoint_file file;
+    if (options.resume) {
+      if (!file.open(options.checkpoint, image_width, image_height, settings.str()))
+        return 1;
+      file.restore(fb, progress);
+      // A finished render takes more samples, up to --spp.
+      if (progress.rows_done == unsigned(image_height)
+          && progress.last_sample < unsigned(samples_per_pixel)) {
+        progress.first_sample = progress.last_sample;
+        progress.last_sample = samples_per_pixel;
+        progress.rows_done = 0;
+      }
+      std::cerr << "Resuming samples " << progress.first_sample << " to " << progress.last_sample
+                << " at row " << progress.rows_done << ".\n";
+    } else {
+      if (!file.create(options.checkpoint, image_width, image_height, settings.str())) {
+        std::cerr << "ERROR: Could not create checkpoint file '" << options.checkpoint << "'.\n";
+        return 1;
+      }
+      progress.first_sample = 0;
+      progress.last_sample = samples_per_pixel;
+      progress.rows_done = 0;
+      progress.reserved = 0;
+      rand_state::save(progress.random);
+    }
+
+    if (!render_with_checkpoints(fb, progress, file, options.checkpoint_interval, sample))
+      return 1;
+    write_output(fb.resolve());
+
+    std::cerr << "\nDone.\n";
+    return output.finish() ? 0 : 1;
+  }
+
+  float_image image(image_width, image_height);
   for (int j = image_height-1; j >= 0; --j) {
     std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
     for (int i = 0; i < image_width; ++i) {
       color pixel_color(0,0,0);
 
       for (int s = 0; s < samples_per_pixel; ++s) {
-        auto u = double(i + random_double()) / (image_width-1);
-        auto v = double(j + random_double()) / (image_height-1);
-
-        ray r = cam.get_ray(u, v);
-        pixel_color += ray_color(r, background, world_list, max_depth);
+        pixel_color += sample(i, j, s);
       }
-      write_color(std::cout, pixel_color, samples_per_pixel);
+      image.set(i, image_height-1 - j, pixel_color * (1.0 / samples_per_pixel));
     }
   }
+  write_output(std::move(image));
 
   std::cerr << "\nDone.\n";
+  return output.finish() ? 0 : 1;
 }
@@ -2,24 +2,62 @@
 #define MATERIAL_H
 
 #include "rtweekend.hpp"
+#include "pdf.hpp"
 #include "texture.hpp"
 
 double schlick(double cosine, double ref_idx) {
   auto r0 = (1-ref_idx) / (1+ref_idx);
   r0 = r0 * r0;
-  return r0 + (1-r0)*pow((1 - cosine), 5);
+  return r0 + (1-r0)*shading_pow5(1 - cosine);
 }
 
 struct hit_record;
 
+// Result of a scatter. Specular materials pick the outgoing ray themselves,
+// everything else reports a pdf to sample directions from, which lets the
+// integrator combine it with light sampling.
+struct scatter_record {
+  ray specular_ray;
+  bool is_specular;
+  color attenuation;
+  shared_ptr<pdf> pdf_ptr;
+};
+
 class material {
 public:
   virtual color emitted(double u, double v, const point3& p) const {
     return color(0,0,0);
   }
 
-  virtual bool scatter(const ray& r_in, const hit_record& rec,
-                       color& attenuation, ray& scattered) const = 0;
+  virtual bool is_emitter() const { return false; }
+
+  // Ideal diffuse reflectors, whose outgoing radiance is attenuation / pi
+  // times the irradiance, so it can be interpolated from an irradiance cache.
+  virtual bool is_diffuse() const { return false; }
+
+  virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const {
+    return false;
+  }
+
+  // The attenuation scatter() gives at rec, without sampling a direction;
+  // white for materials that do not scatter.
+  virtual color reflectance(const hit_record& rec) const {
+    return color(1,1,1);
+  }
+
+  // Solid angle density of the material scattering r_in into scattered, so the
+  // contribution of a sampled direction is attenuation * scattering_pdf / pdf.
+  virtual double scattering_pdf(const ray& r_in, const hit_record& rec,
+                                const ray& scattered) const {
+    return 0;
+  }
+
+  // Compiles the textures of this material into code, see compile_scene.
+  virtual void compile(const shared_ptr<texture_code>& code) {}
+
+  // True when other scatters and emits exactly like this material, so one can
+  // stand in for both. Textures compare by their compiled entries.
+  virtual bool equivalent(const material& other) const { return this == &other; }
 };
 
 class lambertian : public material {
@@ -27,18 +65,35 @@ public:
   lambertian(const color& a) : albedo(make_shared<solid_color>(a)) {}
   lambertian(shared_ptr<texture> a) : albedo(a) {}
 
-  virtual bool scatter(const ray& r_in, const hit_record& rec,
-                       color& attenuation, ray& scattered
+  virtual bool is_diffuse() const override { return true; }
+
+  virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec
                        ) const override {
-    vec3 scatter_direction = rec.normal + random_unit_vector();
-    scattered = ray(rec.p, scatter_direction, r_in.time());
-    // ALTERNATIVE: albedo/p where p is some probability
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
+    srec.is_specular = false;
+    srec.attenuation = albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+    srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
     return true;
   }
 
+  virtual color reflectance(const hit_record& rec) const override {
+    return albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+  }
+
+  virtual double scattering_pdf(const ray& r_in, const hit_record& rec,
+                                const ray& scattered) const override {
+    auto cosine = dot(rec.normal, unit_vector(scattered.direction()));
+    return cosine < 0 ? 0 : cosine/pi;
+  }
+
+  virtual void compile(const shared_ptr<texture_code>& code) override { albedo.compile(code); }
+
+  virtual bool equivalent(const material& other) const override {
+    auto o = dynamic_cast<const lambertian*>(&other);
+    return o && albedo == o->albedo;
+  }
+
 public:
-  shared_ptr<texture> albedo;
+  texture_ref albedo;
 };
 
 class metal : public material {
@@ -46,13 +101,44 @@ public:
   metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
 
-  virtual bool scatter(const ray& r_in, const hit_record& rec,
-                       color& attenuation, ray& scattered
+  // Polished metal is a perfect mirror. Fuzzy metal is glossy: it samples a
+  // Phong lobe around the mirror direction, with the exponent mapped from fuzz
+  // like a roughness, so it can take part in light sampling.
+  virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec
                        ) const override {
     vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-    scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(), r_in.time());
-    attenuation = albedo;
-    return (dot(scattered.direction(), rec.normal) > 0);
+    srec.attenuation = albedo;
+
+    if (fuzz <= 0) {
+      srec.specular_ray = ray(rec.p, reflected, r_in.time());
+      srec.is_specular = true;
+      srec.pdf_ptr = nullptr;
+      return (dot(srec.specular_ray.direction(), rec.normal) > 0);
+    }
+
+    srec.is_specular = false;
+    srec.pdf_ptr = make_shared<phong_pdf>(reflected, exponent());
+    return true;
+  }
+
+  virtual color reflectance(const hit_record& rec) const override { return albedo; }
+
+  virtual double scattering_pdf(const ray& r_in, const hit_record& rec,
+                                const ray& scattered) const override {
+    if (dot(scattered.direction(), rec.normal) <= 0)
+      return 0;
+    vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+    return phong_pdf(reflected, exponent()).value(scattered.direction());
+  }
+
+  double exponent() const {
+    return fmax(0.0, 2/(fuzz*fuzz) - 2);
+  }
+
+  virtual bool equivalent(const material& other) const override {
+    auto o = dynamic_cast<const metal*>(&other);
+    return o && fuzz == o->fuzz && albedo.x() == o->albedo.x()
+      && albedo.y() == o->albedo.y() && albedo.z() == o->albedo.z();
   }
 
 public:
@@ -65,10 +151,11 @@ public:
   dielectric(double ri) : ref_idx(ri) {}
 
 
-  virtual bool scatter(const ray& r_in, const hit_record& rec,
-                       color& attenuation, ray& scattered
+  virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec
                        ) const override {
-    attenuation = color(1.0,1.0,1.0);
+    srec.is_specular = true;
+    srec.pdf_ptr = nullptr;
+    srec.attenuation = color(1.0,1.0,1.0);
     double etai_over_etat = rec.front_face ? (1.0 / ref_idx) : ref_idx;
 
     vec3 unit_direction = unit_vector(r_in.direction());
@@ -77,21 +164,26 @@ public:
     double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
     if (etai_over_etat * sin_theta > 1.0) {
       vec3 reflected = reflect(unit_direction, rec.normal);
-      scattered = ray(rec.p, reflected, r_in.time());
+      srec.specular_ray = ray(rec.p, reflected, r_in.time());
       return true;
     }
     double reflect_prob = schlick(cos_theta, etai_over_etat);
     if (random_double() < reflect_prob) {
       vec3 reflected = reflect(unit_direction, rec.normal);
-      scattered = ray(rec.p, reflected, r_in.time());
+      srec.specular_ray = ray(rec.p, reflected, r_in.time());
       return true;
     }
 
     vec3 refracted = refract(unit_direction, rec.normal, etai_over_etat);
-    scattered = ray(rec.p, refracted, r_in.time());
+    srec.specular_ray = ray(rec.p, refracted, r_in.time());
     return true;
   }
 
+  virtual bool equivalent(const material& other) const override {
+    auto o = dynamic_cast<const dielectric*>(&other);
+    return o && ref_idx == o->ref_idx;
+  }
+
   double ref_idx;
 };
 
@@ -100,18 +192,21 @@ public:
   diffuse_light(shared_ptr<texture> a) : emit(a) {}
   diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
 
-  virtual bool scatter(const ray& r_in, const hit_record& rec,
-                       color& attenuation, ray& scattered
-                       ) const override {
-    return false;
-  }
+  virtual bool is_emitter() const override { return true; }
 
   virtual color emitted(double u, double v, const point3& p) const override {
-    return emit->value(u,v,p);
+    return emit.value(u,v,p);
+  }
+
+  virtual void compile(const shared_ptr<texture_code>& code) override { emit.compile(code); }
+
+  virtual bool equivalent(const material& other) const override {
+    auto o = dynamic_cast<const diffuse_light*>(&other);
+    return o && emit == o->emit;
   }
 
 public:
-  shared_ptr<texture> emit;
+  texture_ref emit;
 };
 
 class isotropic : public material {
@@ -120,15 +215,32 @@ public:
   isotropic(shared_ptr<texture> a) : albedo(a) {}
 
   virtual bool scatter(
-    const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+    const ray& r_in, const hit_record& rec, scatter_record& srec
   ) const override {
-    scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
+    srec.is_specular = false;
+    srec.attenuation = albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+    srec.pdf_ptr = make_shared<sphere_pdf>();
     return true;
   }
 
+  virtual color reflectance(const hit_record& rec) const override {
+    return albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+  }
+
+  virtual double scattering_pdf(const ray& r_in, const hit_record& rec,
+                                const ray& scattered) const override {
+    return 1 / (4*pi);
+  }
+
+  virtual void compile(const shared_ptr<texture_code>& code) override { albedo.compile(code); }
+
+  virtual bool equivalent(const material& other) const override {
+    auto o = dynamic_cast<const isotropic*>(&other);
+    return o && albedo == o->albedo;
+  }
+
 public:
-  shared_ptr<texture> albedo;
+  texture_ref albedo;
 };
 
 #endif
@@ -0,0 +1,357 @@
+#ifndef MIPMAP_HPP
+#define MIPMAP_HPP
+
+#include "rtweekend.hpp"
+
+#include "color.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+enum class texel_format { rgb8, rgb32f };
+
+// 8 bits per channel, for images that came in that way.
+struct rgb8_texel {
+  static const unsigned format = unsigned(texel_format::rgb8);
+
+  rgb8_texel() {}
+  rgb8_texel(const color& c) {
+    for (int i = 0; i < 3; i++)
+      value[i] = static_cast<unsigned char>(clamp(c[i], 0.0, 1.0) * 255 + 0.5);
+  }
+  color to_color() const {
+    const auto scale = 1.0 / 255.0;
+    return color(scale*value[0], scale*value[1], scale*value[2]);
+  }
+
+  unsigned char value[3];
+};
+
+// Single precision floats, for high dynamic range images or where the
+// rounding of the coarser levels to 8 bits shows.
+struct rgb32f_texel {
+  static const unsigned format = unsigned(texel_format::rgb32f);
+
+  rgb32f_texel() {}
+  rgb32f_texel(const color& c) {
+    for (int i = 0; i < 3; i++)
+      value[i] = float(c[i]);
+  }
+  color to_color() const { return color(value[0], value[1], value[2]); }
+
+  float value[3];
+};
+
+// A filtered lookup into an image, with the footprint given as a width in
+// texels of the full resolution image.
+class mip_pyramid {
+public:
+  virtual ~mip_pyramid() {}
+
+  // Trilinear lookup at (u, v), with u from left to right and v from the top
+  // row down, both in [0,1].
+  virtual color lookup(double u, double v, double width) const = 0;
+
+  virtual size_t bytes() const = 0;
+
+  // Size of the full resolution image.
+  virtual int width() const = 0;
+  virtual int height() const = 0;
+
+  // Writes the levels in the layout map_pyramid() reads back.
+  virtual bool write(std::ostream& out) const = 0;
+};
+
+// What write() puts before the texels: this header, the size of every level,
+// then the tiled texels of each level in turn.
+struct pyramid_header {
+  char magic[8];
+  std::uint32_t format;
+  std::uint32_t levels;
+};
+
+const char pyramid_magic[8] = { 'R', 'T', 'M', 'I', 'P', '0', '1', 0 };
+
+// Interleaves the bits of x and y in [0, 8).
+inline int morton8(int x, int y) {
+  static const unsigned char spread[8] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+  return spread[x] | (spread[y] << 1);
+}
+
+// Bilinear filter of a width x height level at (u, v) in [0,1], reading the
+// texel at (x, y) as fetch(x, y), clamped to the edge texels.
+template <class fetch_function>
+inline color bilinear_filter(double u, double v, int width, int height, const fetch_function& fetch) {
+  auto s = u * width - 0.5;
+  auto t = v * height - 0.5;
+  // s, t >= -0.5, so truncating after the shift rounds down; floor() is a
+  // library call without SSE4.1.
+  int x = int(s + 1) - 1, y = int(t + 1) - 1;
+  auto fx = s - x, fy = t - y;
+
+  int x0 = std::max(x, 0), x1 = std::min(x + 1, width - 1);
+  int y0 = std::max(y, 0), y1 = std::min(y + 1, height - 1);
+  return (1 - fy) * ((1 - fx) * fetch(x0, y0) + fx * fetch(x1, y0))
+    + fy * ((1 - fx) * fetch(x0, y1) + fx * fetch(x1, y1));
+}
+
+// Trilinear filter over a pyramid of levels, blending bilinear(level, u, v)
+// of the two levels whose texels are nearest width, in level 0 texels.
+template <class bilinear_function>
+inline color trilinear_filter(double u, double v, double width, int levels,
+                              const bilinear_function& bilinear) {
+  u = clamp(u, 0.0, 1.0);
+  v = clamp(v, 0.0, 1.0);
+
+  int last = levels - 1;
+  auto lod = width > 1 ? log2(width) : 0.0;
+  if (lod <= 0)
+    return bilinear(0, u, v);
+  if (lod >= last)
+    return bilinear(last, u, v);
+
+  int fine = int(lod);
+  auto blend = lod - fine;
+  return (1 - blend) * bilinear(fine, u, v) + blend * bilinear(fine + 1, u, v);
+}
+
+// A mip pyramid, each level half the size of the one before down to a single
+// texel, box filtered. Levels are stored in 8x8 texel tiles, and the texels
+// of a tile in Morton order, so the four texels of a bilinear lookup are
+// almost always in the same tile and a small footprint touches few cache
+// lines, however the image is oriented.
+template <class texel>
+class mipmap : public mip_pyramid {
+public:
+  // pixels holds width * height colors, row by row from the top.
+  mipmap(int width, int height, const std::vector<color>& pixels);
+
+  // rgb holds width * height pixels of three bytes, row by row from the top,
+  // as stb_image loads them.
+  mipmap(int width, int height, const unsigned char* rgb);
+
+  // Levels read in place from data as written by write(), which backing
+  // keeps alive. Leaves the pyramid empty if data is not one.
+  mipmap(const unsigned char* data, size_t size, shared_ptr<const void> backing);
+
+  // Levels point into storage.
+  mipmap(const mipmap&) = delete;
+  mipmap& operator=(const mipmap&) = delete;
+
+  virtual color lookup(double u, double v, double width) const override;
+
+  virtual size_t bytes() const override {
+    size_t total = 0;
+    for (const auto& l : levels)
+      total += l.count * sizeof(texel);
+    return total;
+  }
+
+  virtual int width() const override { return levels.empty() ? 0 : levels[0].width; }
+  virtual int height() const override { return levels.empty() ? 0 : levels[0].height; }
+
+  virtual bool write(std::ostream& out) const override;
+
+  int level_count() const { return levels.size(); }
+
+  // True when the texels live in memory owned elsewhere, such as a mapping.
+  bool borrowed() const { return backing != nullptr; }
+
+private:
+  static const int tile = 8;
+
+  struct level {
+    int width, height, tiles_x;
+    const texel* texels;
+    size_t count;
+  };
+
+  static size_t texel_count(int width, int height) {
+    return size_t((width + tile - 1) / tile) * ((height + tile - 1) / tile) * tile * tile;
+  }
+
+  // x and y are never negative, so the divisions are shifts.
+  static size_t offset(const level& l, unsigned x, unsigned y) {
+    return (size_t((y / tile) * l.tiles_x + x / tile)) * tile * tile + morton8(x % tile, y % tile);
+  }
+
+  color bilinear(int index, double u, double v) const;
+
+  // Adds level 0 from pixel(x, y) and every level below it.
+  template <class fetch_function>
+  void build(int width, int height, const fetch_function& pixel);
+
+  // Halves width and height, returning the box filtered pixels.
+  template <class fetch_function>
+  static std::vector<color> downsample(int& width, int& height, const fetch_function& pixel);
+
+  template <class fetch_function>
+  void add_level(int width, int height, const fetch_function& pixel);
+
+  std::vector<level> levels;
+  std::vector<std::vector<texel>> storage;   // texels of built levels
+  shared_ptr<const void> backing;            // or what holds mapped ones
+};
+
+template <class texel>
+mipmap<texel>::mipmap(int width, int height, const std::vector<color>& pixels) {
+  build(width, height, [&pixels, width](int x, int y) { return pixels[size_t(y) * width + x]; });
+}
+
+template <class texel>
+mipmap<texel>::mipmap(int width, int height, const unsigned char* rgb) {
+  build(width, height, [rgb, width](int x, int y) {
+    const auto color_scale = 1.0 / 255.0;
+    auto p = rgb + (size_t(y) * width + x) * 3;
+    return color(color_scale*p[0], color_scale*p[1], color_scale*p[2]);
+  });
+}
+
+// Only level 0 is read from the source; each level below is filtered from
+// the one above, which is dropped once its texels are stored.
+template <class texel>
+template <class fetch_function>
+void mipmap<texel>::build(int width, int height, const fetch_function& pixel) {
+  add_level(width, height, pixel);
+  if (width <= 1 && height <= 1)
+    return;
+
+  auto current = downsample(width, height, pixel);
+  for (;;) {
+    auto at = [&current, width](int x, int y) { return current[size_t(y) * width + x]; };
+    add_level(width, height, at);
+    if (width <= 1 && height <= 1)
+      break;
+    current = downsample(width, height, at);
+  }
+}
+
+template <class texel>
+template <class fetch_function>
+std::vector<color> mipmap<texel>::downsample(int& width, int& height, const fetch_function& pixel) {
+  int next_width = std::max(1, (width + 1) / 2);
+  int next_height = std::max(1, (height + 1) / 2);
+  std::vector<color> next(size_t(next_width) * next_height);
+
+  // Odd sizes repeat their last row or column.
+  for (int y = 0; y < next_height; y++) {
+    for (int x = 0; x < next_width; x++) {
+      int x0 = std::min(2*x, width - 1), x1 = std::min(2*x + 1, width - 1);
+      int y0 = std::min(2*y, height - 1), y1 = std::min(2*y + 1, height - 1);
+      next[size_t(y) * next_width + x] = 0.25 * (pixel(x0, y0) + pixel(x1, y0)
+        + pixel(x0, y1) + pixel(x1, y1));
+    }
+  }
+
+  width = next_width;
+  height = next_height;
+  return next;
+}
+
+template <class texel>
+template <class fetch_function>
+void mipmap<texel>::add_level(int width, int height, const fetch_function& pixel) {
+  level l;
+  l.width = width;
+  l.height = height;
+  l.tiles_x = (width + tile - 1) / tile;
+  l.count = texel_count(width, height);
+
+  std::vector<texel> texels(l.count);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      texels[offset(l, x, y)] = texel(pixel(x, y));
+
+  storage.push_back(std::move(texels));
+  l.texels = storage.back().data();
+  levels.push_back(l);
+}
+
+template <class texel>
+mipmap<texel>::mipmap(const unsigned char* data, size_t size, shared_ptr<const void> _backing) {
+  pyramid_header header;
+  if (size < sizeof(header))
+    return;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, pyramid_magic, sizeof(pyramid_magic)) != 0
+      || header.format != texel::format || header.levels == 0 || header.levels > 32)
+    return;
+
+  size_t at = sizeof(header) + header.levels * 2 * sizeof(std::uint32_t);
+  if (size < at)
+    return;
+
+  std::vector<level> found;
+  for (std::uint32_t i = 0; i < header.levels; i++) {
+    std::uint32_t dimensions[2];
+    memcpy(dimensions, data + sizeof(header) + i * sizeof(dimensions), sizeof(dimensions));
+
+    level l;
+    l.width = dimensions[0];
+    l.height = dimensions[1];
+    l.tiles_x = (l.width + tile - 1) / tile;
+    l.count = texel_count(l.width, l.height);
+    if (l.width <= 0 || l.height <= 0 || size - at < l.count * sizeof(texel))
+      return;
+    l.texels = reinterpret_cast<const texel*>(data + at);
+    at += l.count * sizeof(texel);
+    found.push_back(l);
+  }
+
+  levels.swap(found);
+  backing = _backing;
+}
+
+template <class texel>
+bool mipmap<texel>::write(std::ostream& out) const {
+  pyramid_header header;
+  memcpy(header.magic, pyramid_magic, sizeof(pyramid_magic));
+  header.format = texel::format;
+  header.levels = levels.size();
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  for (const auto& l : levels) {
+    std::uint32_t dimensions[2] = { std::uint32_t(l.width), std::uint32_t(l.height) };
+    out.write(reinterpret_cast<const char*>(dimensions), sizeof(dimensions));
+  }
+  for (const auto& l : levels)
+    out.write(reinterpret_cast<const char*>(l.texels), l.count * sizeof(texel));
+  return bool(out);
+}
+
+// Reads a pyramid written by mip_pyramid::write() in place, whichever its
+// texel format. Returns nullptr if data does not hold one.
+shared_ptr<mip_pyramid> map_pyramid(const unsigned char* data, size_t size,
+                                    shared_ptr<const void> backing) {
+  pyramid_header header;
+  if (size < sizeof(header))
+    return nullptr;
+  memcpy(&header, data, sizeof(header));
+
+  shared_ptr<mip_pyramid> pyramid;
+  if (header.format == unsigned(texel_format::rgb32f))
+    pyramid = make_shared<mipmap<rgb32f_texel>>(data, size, backing);
+  else
+    pyramid = make_shared<mipmap<rgb8_texel>>(data, size, backing);
+  return pyramid->width() > 0 ? pyramid : nullptr;
+}
+
+template <class texel>
+color mipmap<texel>::bilinear(int index, double u, double v) const {
+  const auto& l = levels[index];
+  return bilinear_filter(u, v, l.width, l.height, [&l](int x, int y) {
+    return l.texels[offset(l, x, y)].to_color();
+  });
+}
+
+template <class texel>
+color mipmap<texel>::lookup(double u, double v, double width) const {
+  return trilinear_filter(u, v, width, levels.size(), [this](int level, double s, double t) {
+    return bilinear(level, s, t);
+  });
+}
+
+#endif
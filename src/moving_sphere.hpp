@@ -18,6 +18,12 @@ class moving_sphere : public hittable {
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
         virtual bool bounding_box(
             double _time0, double _time1, aabb& output_box) const override;
+        virtual bool occluded(
+            const ray& r, double t_min, double t_max) const override;
+
+        virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+            slots.push_back(&mat_ptr);
+        }
 
         point3 center(double time) const;
 
@@ -54,11 +60,32 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
     rec.p = r.at(rec.t);
     auto outward_normal = (rec.p - center(r.time())) / radius;
     rec.set_face_normal(r, outward_normal);
+    rec.dpdu = rec.dpdv = vec3(0,0,0);
     rec.mat_ptr = mat_ptr;
 
     return true;
 }
 
+bool moving_sphere::occluded(const ray& r, double t_min, double t_max) const {
+    vec3 oc = r.origin() - center(r.time());
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant < 0) return false;
+    auto sqrtd = sqrt(discriminant);
+
+    auto root = (-half_b - sqrtd) / a;
+    if (root < t_min || t_max < root) {
+        root = (-half_b + sqrtd) / a;
+        if (root < t_min || t_max < root)
+            return false;
+    }
+
+    return true;
+}
+
 bool moving_sphere::bounding_box(double _time0, double _time1, aabb& output_box) const {
   aabb box0(center(_time0) - vec3(radius, radius, radius),
             center(_time0) + vec3(radius, radius, radius));
@@ -0,0 +1,268 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Command line settings for main(). Zero or empty values leave the choice to
+// the selected scene.
+struct render_options {
+  int scene = 10;
+  int width = 0;
+  int samples_per_pixel = 0;
+  std::string sampler = "sobol";
+
+  // An equirectangular HDR image, scaled by environment_intensity, as the
+  // background and light of the scene instead of its own.
+  std::string environment;
+  double environment_intensity = 1;
+
+  // Adaptive sampling: spend --spp per pixel on average, noisiest pixels
+  // first, stopping those whose relative error drops below the threshold, up
+  // to max_spp samples each.
+  double adaptive_threshold = 0;
+  int max_spp = 0;
+  std::string sample_map;
+
+  // Deadline mode: progressive passes for this many seconds of wall time.
+  double time_budget = 0;
+
+  // Filter the image with the feature-guided denoiser before writing it.
+  bool denoise = false;
+
+  // Interpolate diffuse interreflection from an irradiance cache, optionally
+  // loaded from and saved back to a file so later frames can reuse it.
+  bool irradiance_cache = false;
+  std::string cache_file;
+
+  // Caustic photon map: photons per pass, gather radius (0 picks one from the
+  // scene size) and progressive passes, shrinking the radius by alpha.
+  int photons = 0;
+  double photon_radius = 0;
+  int photon_passes = 1;
+  double photon_alpha = 2.0 / 3.0;
+
+  // Path guiding: training passes of 1, 2, 4, ... samples per pixel before
+  // the render.
+  int guide_passes = 0;
+
+  // Directory decoded textures are stored in and mapped from by later runs,
+  // empty to decode every run.
+  std::string texture_cache = ".texture_cache";
+
+  // Memory for the pages of paged textures, in MiB.
+  int texture_memory = 256;
+
+  // Polynomial approximations instead of libm in shading, see fast_math.hpp.
+  bool fast_math = false;
+
+  // Where the image is written, standard output if empty, and in which of
+  // the formats of image_output.hpp; empty picks one from the file name.
+  std::string output;
+  std::string format;
+
+  // Render tile by tile into this tile file, holding only the tiles being
+  // rendered, then assemble it into the output.
+  std::string tiles;
+  int tile_size = 64;
+
+  // Assemble this tile file into the output and exit.
+  std::string assemble;
+
+  // Stream coarse to fine frames of the render, see preview.hpp.
+  bool preview = false;
+
+  // Render the frames of this keyframe file, see animation.hpp, into one
+  // stream of PPM or Y4M frames, frames first to last if last >= first.
+  std::string animation;
+  int first_frame = 0;
+  int last_frame = -1;
+  int fps = 24;
+
+  // Reuse the samples of the previous frame of a camera animation where its
+  // surfaces are still in view, taking this many new ones there, see
+  // temporal.hpp.
+  int temporal_spp = 0;
+
+  // Checkpoint the render to this file every so many seconds, and continue
+  // from its last checkpoint, adding samples up to samples_per_pixel.
+  std::string checkpoint;
+  double checkpoint_interval = 60;
+  bool resume = false;
+
+  // Convert this image to a paged texture file and exit.
+  std::string convert_from, convert_to;
+};
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program << " [options] > image.ppm\n"
+            << "  --scene N            scene number from main.cc\n"
+            << "  --width N            image width in pixels\n"
+            << "  --spp N              samples per pixel\n"
+            << "  --environment FILE   light the scene with an equirectangular HDR image\n"
+            << "  --env-intensity X    scale the environment image by X\n"
+            << "  --output FILE        write the image to FILE instead of standard output\n"
+            << "  --format NAME        p3, p6, png, pfm or hdr; by default P3 on standard\n"
+            << "                       output, otherwise from the extension of FILE\n"
+            << "  --tiles FILE         render tiles into FILE, then assemble the image from it\n"
+            << "  --tile-size N        tile width and height in pixels\n"
+            << "  --assemble FILE      write the image from the tile file FILE and exit\n"
+            << "  --preview            write a frame after every pass of a coarse to fine\n"
+            << "                       render, as concatenated P6 unless --format is given\n"
+            << "  --animation FILE     render the keyframes in FILE as a stream of frames, in\n"
+            << "                       concatenated P6 or, with --format y4m, YUV4MPEG2\n"
+            << "  --frames FIRST LAST  render only these frames of the animation\n"
+            << "  --fps N              frame rate in the Y4M header\n"
+            << "  --temporal N         reuse the samples of the previous frame where its\n"
+            << "                       surfaces are still seen, adding N to them there\n"
+            << "  --checkpoint FILE    save the render to FILE as it goes, to resume it later\n"
+            << "  --checkpoint-every S seconds between checkpoints\n"
+            << "  --resume             continue the render in the checkpoint file, or add\n"
+            << "                       samples to a finished one up to --spp\n"
+            << "  --sampler NAME       independent, stratified, sobol, halton or bluenoise\n"
+            << "  --adaptive ERROR     sample adaptively to this relative error, --spp per\n"
+            << "                       pixel on average\n"
+            << "  --max-spp N          sample limit per pixel for adaptive sampling, by\n"
+            << "                       default 16 times --spp\n"
+            << "  --sample-map FILE    write the samples taken per pixel as a PGM\n"
+            << "  --time SECONDS       render progressive passes until the deadline\n"
+            << "  --denoise            denoise the image using albedo, normal and depth\n"
+            << "  --irradiance-cache   interpolate indirect diffuse light from a cache\n"
+            << "  --cache-file FILE    load the irradiance cache from FILE and save it back\n"
+            << "  --photons N          render caustics from a photon map of N photons\n"
+            << "  --photon-radius R    photon gather radius in world units\n"
+            << "  --photon-passes N    progressive photon passes with shrinking radius\n"
+            << "  --guide N            train a path guide over N passes before rendering\n"
+            << "  --texture-cache DIR  keep decoded textures in DIR, \"\" to not store them\n"
+            << "  --texture-memory MB  memory for the pages of paged textures\n"
+            << "  --fast-math          approximate sin, cos, log, acos and atan2 in shading\n"
+            << "  --convert-texture IMAGE FILE\n"
+            << "                       write IMAGE as a paged texture FILE and exit\n";
+}
+
+bool parse_options(int argc, char** argv, render_options& options) {
+  for (int a = 1; a < argc; a++) {
+    std::string arg = argv[a];
+    bool has_value = a + 1 < argc;
+
+    if (arg == "--help" || arg == "-h") {
+      usage(argv[0]);
+      return false;
+    } else if (arg == "--scene" && has_value) {
+      options.scene = atoi(argv[++a]);
+    } else if (arg == "--width" && has_value) {
+      options.width = atoi(argv[++a]);
+    } else if (arg == "--spp" && has_value) {
+      options.samples_per_pixel = atoi(argv[++a]);
+    } else if (arg == "--environment" && has_value) {
+      options.environment = argv[++a];
+    } else if (arg == "--env-intensity" && has_value) {
+      options.environment_intensity = atof(argv[++a]);
+    } else if (arg == "--output" && has_value) {
+      options.output = argv[++a];
+    } else if (arg == "--format" && has_value) {
+      options.format = argv[++a];
+    } else if (arg == "--tiles" && has_value) {
+      options.tiles = argv[++a];
+    } else if (arg == "--tile-size" && has_value) {
+      options.tile_size = std::max(1, atoi(argv[++a]));
+    } else if (arg == "--assemble" && has_value) {
+      options.assemble = argv[++a];
+    } else if (arg == "--preview") {
+      options.preview = true;
+    } else if (arg == "--animation" && has_value) {
+      options.animation = argv[++a];
+    } else if (arg == "--frames" && a + 2 < argc) {
+      options.first_frame = atoi(argv[++a]);
+      options.last_frame = atoi(argv[++a]);
+    } else if (arg == "--temporal" && has_value) {
+      options.temporal_spp = std::max(1, atoi(argv[++a]));
+    } else if (arg == "--fps" && has_value) {
+      options.fps = std::max(1, atoi(argv[++a]));
+    } else if (arg == "--checkpoint" && has_value) {
+      options.checkpoint = argv[++a];
+    } else if (arg == "--checkpoint-every" && has_value) {
+      options.checkpoint_interval = atof(argv[++a]);
+    } else if (arg == "--resume") {
+      options.resume = true;
+    } else if (arg == "--sampler" && has_value) {
+      options.sampler = argv[++a];
+    } else if (arg == "--adaptive" && has_value) {
+      options.adaptive_threshold = atof(argv[++a]);
+    } else if (arg == "--max-spp" && has_value) {
+      options.max_spp = atoi(argv[++a]);
+    } else if (arg == "--sample-map" && has_value) {
+      options.sample_map = argv[++a];
+    } else if (arg == "--time" && has_value) {
+      options.time_budget = atof(argv[++a]);
+    } else if (arg == "--denoise") {
+      options.denoise = true;
+    } else if (arg == "--irradiance-cache") {
+      options.irradiance_cache = true;
+    } else if (arg == "--cache-file" && has_value) {
+      options.irradiance_cache = true;
+      options.cache_file = argv[++a];
+    } else if (arg == "--photons" && has_value) {
+      options.photons = atoi(argv[++a]);
+    } else if (arg == "--photon-radius" && has_value) {
+      options.photon_radius = atof(argv[++a]);
+    } else if (arg == "--photon-passes" && has_value) {
+      options.photon_passes = atoi(argv[++a]);
+    } else if (arg == "--guide" && has_value) {
+      options.guide_passes = atoi(argv[++a]);
+    } else if (arg == "--texture-cache" && has_value) {
+      options.texture_cache = argv[++a];
+    } else if (arg == "--texture-memory" && has_value) {
+      options.texture_memory = atoi(argv[++a]);
+    } else if (arg == "--fast-math") {
+      options.fast_math = true;
+    } else if (arg == "--convert-texture" && a + 2 < argc) {
+      options.convert_from = argv[++a];
+      options.convert_to = argv[++a];
+    } else {
+      std::cerr << "Unknown or incomplete option '" << arg << "'.\n";
+      usage(argv[0]);
+      return false;
+    }
+  }
+
+  if (!options.animation.empty() && (options.preview || !options.checkpoint.empty()
+      || !options.tiles.empty() || options.time_budget > 0 || options.adaptive_threshold > 0
+      || options.denoise || options.photon_passes > 1)) {
+    std::cerr << "--animation renders cannot be previewed, checkpointed, tiled, timed, adaptive,"
+              << " denoised or progressive photon mapped.\n";
+    return false;
+  }
+  if (options.temporal_spp > 0 && options.animation.empty()) {
+    std::cerr << "--temporal needs --animation FILE.\n";
+    return false;
+  }
+  if (options.resume && options.checkpoint.empty()) {
+    std::cerr << "--resume needs --checkpoint FILE.\n";
+    return false;
+  }
+  // main() renders in one of these modes, which would drop the others.
+  int modes = options.preview + !options.tiles.empty() + (options.time_budget > 0)
+    + (options.adaptive_threshold > 0) + options.denoise
+    + (options.photons > 0 && options.photon_passes > 1) + !options.checkpoint.empty();
+  if (modes > 1) {
+    std::cerr << "Only one of --preview, --tiles, --time, --adaptive, --denoise, --photon-passes"
+              << " and --checkpoint can be given.\n";
+    return false;
+  }
+  // A resumed render would build these again before it goes on, and not
+  // always the same: guides learn from the paths of every thread in the order
+  // they finish, cache records depend on the number of threads, and the map on
+  // the photon pass.
+  if (!options.checkpoint.empty() && (options.photons > 0 || options.guide_passes > 0
+      || options.irradiance_cache)) {
+    std::cerr << "--checkpoint renders cannot use --photons, --guide or --irradiance-cache.\n";
+    return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef PAGED_TEXTURE_HPP
+#define PAGED_TEXTURE_HPP
+
+#include "rtweekend.hpp"
+
+#include "mipmap.hpp"
+#include "rtw_stb_image.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Texture pages of every paged texture in the process, at most budget bytes
+// of them resident, the least recently used evicted first. Each thread also
+// holds on to the few pages it read last, outside the budget.
+class page_cache {
+public:
+  typedef std::vector<unsigned char> page;
+
+  page_cache(size_t budget_bytes) : budget(budget_bytes) {}
+
+  // The cache paged textures read through.
+  static page_cache& global() {
+    static page_cache cache(size_t(256) << 20);
+    return cache;
+  }
+
+  void set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> hold(lock);
+    budget = bytes;
+    evict();
+  }
+
+  // Names a file whose pages go through the cache, unique in the process.
+  static std::uint32_t add_file() {
+    static std::atomic<std::uint32_t> next_file(0);
+    return next_file++;
+  }
+
+  // Page number index of file, read from fd at offset on a miss. The page
+  // stays valid for the calling thread until its next fetch(). Returns
+  // nullptr, and caches nothing, if the read comes up short.
+  const page* fetch(std::uint32_t file, std::uint64_t index, int fd, off_t offset, size_t bytes);
+
+  // Pages a thread finds among those it read last are not counted.
+  struct statistics {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t resident = 0;        // bytes
+    size_t peak_resident = 0;
+    size_t budget = 0;
+  };
+
+  statistics stats() const {
+    std::lock_guard<std::mutex> hold(lock);
+    auto s = counts;
+    s.resident = resident;
+    s.budget = budget;
+    return s;
+  }
+
+private:
+  struct slot {
+    shared_ptr<const page> data;
+    std::list<std::uint64_t>::iterator age;
+  };
+
+  static std::uint64_t key(std::uint32_t file, std::uint64_t index) {
+    return (std::uint64_t(file) << 40) | index;
+  }
+
+  void evict() {
+    while (resident > budget && !order.empty()) {
+      auto victim = pages.find(order.back());
+      resident -= victim->second.data->size();
+      pages.erase(victim);
+      order.pop_back();
+      counts.evictions++;
+    }
+  }
+
+  size_t budget;
+  size_t resident = 0;
+  statistics counts;
+  std::list<std::uint64_t> order;   // most recently used first
+  std::unordered_map<std::uint64_t, slot> pages;
+  mutable std::mutex lock;
+};
+
+const page_cache::page* page_cache::fetch(std::uint32_t file, std::uint64_t index,
+                                          int fd, off_t offset, size_t bytes) {
+  auto k = key(file, index);
+
+  // Pages this thread used last skip the lock, and are kept alive here
+  // however the cache evicts.
+  struct recent_page {
+    std::uint64_t key = ~std::uint64_t(0);
+    shared_ptr<const page> data;
+  };
+  static const int recent_count = 16;
+  thread_local recent_page recent[recent_count];
+  // Hashed, as pages above each other are a power of two apart.
+  auto& memo = recent[(k * 0x9e3779b97f4a7c15ull) >> 60];
+  if (memo.key == k)
+    return memo.data.get();
+
+  {
+    std::lock_guard<std::mutex> hold(lock);
+    auto found = pages.find(k);
+    if (found != pages.end()) {
+      counts.hits++;
+      order.splice(order.begin(), order, found->second.age);
+      memo.key = k;
+      memo.data = found->second.data;
+      return memo.data.get();
+    }
+    counts.misses++;
+  }
+
+  // Read without the lock, so other threads keep going; if two threads miss
+  // the same page the first copy in wins.
+  auto buffer = make_shared<page>(bytes);
+  size_t done = 0;
+  while (done < bytes) {
+    auto n = pread(fd, buffer->data() + done, bytes - done, offset + done);
+    if (n <= 0)
+      return nullptr;
+    done += n;
+  }
+  shared_ptr<const page> loaded = buffer;
+
+  std::lock_guard<std::mutex> hold(lock);
+  auto found = pages.find(k);
+  if (found != pages.end()) {
+    loaded = found->second.data;
+  } else {
+    order.push_front(k);
+    pages.emplace(k, slot{ loaded, order.begin() });
+    resident += bytes;
+    counts.peak_resident = std::max(counts.peak_resident, resident);
+    evict();
+  }
+  memo.key = k;
+  memo.data = loaded;
+  return loaded.get();
+}
+
+// Paged texture files hold a mip pyramid cut into pages of 64x64 texels, each
+// stored like a level of mipmap, so any page can be read on its own:
+//
+//   paged_header
+//   paged_level for every level
+//   pages, from data_offset, levels in turn, page rows from the top
+const char paged_magic[8] = { 'R', 'T', 'P', 'A', 'G', 'E', '0', '1' };
+const int page_size = 64;
+
+struct paged_header {
+  char magic[8];
+  std::uint32_t format;
+  std::uint32_t levels;
+  std::uint64_t data_offset;
+};
+
+struct paged_level {
+  std::uint32_t width, height, pages_x, pages_y;
+  std::uint64_t first_page;
+};
+
+// Offset of texel (x, y) in [0, 64) within its page.
+inline int page_offset(unsigned x, unsigned y) {
+  return ((y / 8) * (page_size / 8) + x / 8) * 64 + morton8(x % 8, y % 8);
+}
+
+// A pyramid read from a paged texture file a page at a time, through cache.
+template <class texel>
+class paged_pyramid : public mip_pyramid {
+public:
+  // Takes ownership of fd, which holds the file at path with the given
+  // header and levels.
+  paged_pyramid(int _fd, const std::string& _path, const paged_header& header,
+                const std::vector<paged_level>& _levels, page_cache& _cache)
+    : fd(_fd), path(_path), data_offset(header.data_offset), levels(_levels), cache(_cache),
+      file(page_cache::add_file()), failed(false) {}
+
+  ~paged_pyramid() { close(fd); }
+
+  virtual color lookup(double u, double v, double width) const override {
+    return trilinear_filter(u, v, width, levels.size(), [this](int level, double s, double t) {
+      const auto& l = levels[level];
+      // The page of the last texel read, as most taps share it.
+      std::uint64_t last = ~std::uint64_t(0);
+      const texel* texels = nullptr;
+      // Taps are never negative, so the divisions are shifts.
+      return bilinear_filter(s, t, l.width, l.height, [&](unsigned x, unsigned y) {
+        auto index = l.first_page + std::uint64_t(y / page_size) * l.pages_x + x / page_size;
+        if (index != last) {
+          auto page = cache.fetch(file, index, fd, data_offset + index * page_bytes, page_bytes);
+          if (!page) {
+            if (!failed.exchange(true))
+              std::cerr << "ERROR: Could not read page " << index << " of paged texture '"
+                        << path << "'.\n";
+            // Solid cyan for debug, like a missing image_texture.
+            return color(0,1,1);
+          }
+          texels = reinterpret_cast<const texel*>(page->data());
+          last = index;
+        }
+        return texels[page_offset(x % page_size, y % page_size)].to_color();
+      });
+    });
+  }
+
+  // Pages live in the cache, only the level table here.
+  virtual size_t bytes() const override { return levels.size() * sizeof(paged_level); }
+
+  virtual int width() const override { return levels[0].width; }
+  virtual int height() const override { return levels[0].height; }
+
+  // The file already is the stored form.
+  virtual bool write(std::ostream& out) const override { return false; }
+
+private:
+  static const size_t page_bytes = page_size * page_size * sizeof(texel);
+
+  int fd;
+  std::string path;
+  std::uint64_t data_offset;
+  std::vector<paged_level> levels;
+  page_cache& cache;
+  std::uint32_t file;
+  mutable std::atomic<bool> failed;   // a read error was reported
+};
+
+template <class texel>
+const size_t paged_pyramid<texel>::page_bytes;
+
+// True if the file at path starts like a paged texture.
+bool is_paged_texture(const std::string& path) {
+  char magic[sizeof(paged_magic)];
+  std::ifstream in(path, std::ios::binary);
+  return in.read(magic, sizeof(magic)) && std::equal(magic, magic + sizeof(magic), paged_magic);
+}
+
+// The pyramid of a paged texture file, or nullptr if it is not one.
+shared_ptr<mip_pyramid> open_paged_texture(const std::string& path,
+                                           page_cache& cache = page_cache::global()) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  paged_header header;
+  std::vector<paged_level> levels;
+  bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header)
+    && std::equal(header.magic, header.magic + sizeof(paged_magic), paged_magic)
+    && header.levels > 0 && header.levels <= 32;
+  if (valid) {
+    levels.resize(header.levels);
+    auto table = header.levels * sizeof(paged_level);
+    valid = pread(fd, levels.data(), table, sizeof(header)) == ssize_t(table);
+  }
+  if (valid)
+    valid = header.format == unsigned(texel_format::rgb8)
+      || header.format == unsigned(texel_format::rgb32f);
+
+  // Every level as write_paged_texture() lays it out, so no page index
+  // lookup() computes lies past the end of the file.
+  std::uint64_t pages = 0;
+  for (size_t i = 0; valid && i < levels.size(); i++) {
+    const auto& l = levels[i];
+    valid = l.width > 0 && l.height > 0 && l.first_page == pages
+      && l.pages_x == (l.width + page_size - 1) / page_size
+      && l.pages_y == (l.height + page_size - 1) / page_size;
+    pages += std::uint64_t(l.pages_x) * l.pages_y;
+  }
+  if (!valid) {
+    close(fd);
+    return nullptr;
+  }
+
+  auto texel_bytes = header.format == unsigned(texel_format::rgb32f)
+    ? sizeof(rgb32f_texel) : sizeof(rgb8_texel);
+  auto page_bytes = std::uint64_t(page_size) * page_size * texel_bytes;
+  struct stat file;
+  if (fstat(fd, &file) != 0 || header.data_offset > std::uint64_t(file.st_size)
+      || pages > (std::uint64_t(file.st_size) - header.data_offset) / page_bytes) {
+    std::cerr << "ERROR: Paged texture '" << path << "' is shorter than its "
+              << pages << " pages.\n";
+    close(fd);
+    return nullptr;
+  }
+
+  if (header.format == unsigned(texel_format::rgb32f))
+    return make_shared<paged_pyramid<rgb32f_texel>>(fd, path, header, levels, cache);
+  return make_shared<paged_pyramid<rgb8_texel>>(fd, path, header, levels, cache);
+}
+
+// Writes a paged texture file from the full resolution texels, row by row
+// from the top. Only one level is held in memory besides the one being
+// filtered down from it.
+template <class texel>
+bool write_paged_texture(const std::string& path, int width, int height, std::vector<texel> texels) {
+  std::vector<paged_level> levels;
+  std::uint64_t pages = 0;
+  for (int w = width, h = height; ; w = std::max(1, (w + 1) / 2), h = std::max(1, (h + 1) / 2)) {
+    paged_level l;
+    l.width = w;
+    l.height = h;
+    l.pages_x = (w + page_size - 1) / page_size;
+    l.pages_y = (h + page_size - 1) / page_size;
+    l.first_page = pages;
+    pages += std::uint64_t(l.pages_x) * l.pages_y;
+    levels.push_back(l);
+    if (w == 1 && h == 1)
+      break;
+  }
+
+  paged_header header;
+  std::copy(paged_magic, paged_magic + sizeof(paged_magic), header.magic);
+  header.format = texel::format;
+  header.levels = levels.size();
+  // Pages start on a 4K boundary.
+  header.data_offset = (sizeof(header) + levels.size() * sizeof(paged_level) + 4095) / 4096 * 4096;
+
+  auto partial = path + "." + std::to_string(getpid());
+  std::ofstream out(partial, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(paged_level));
+  out.seekp(header.data_offset);
+
+  std::vector<texel> page(page_size * page_size);
+  for (size_t i = 0; i < levels.size(); i++) {
+    const auto& l = levels[i];
+    for (std::uint32_t py = 0; py < l.pages_y; py++) {
+      for (std::uint32_t px = 0; px < l.pages_x; px++) {
+        // Texels past the edge repeat the last row and column.
+        for (int y = 0; y < page_size; y++) {
+          for (int x = 0; x < page_size; x++) {
+            auto sx = std::min(px * page_size + x, l.width - 1);
+            auto sy = std::min(py * page_size + y, l.height - 1);
+            page[page_offset(x, y)] = texels[size_t(sy) * l.width + sx];
+          }
+        }
+        out.write(reinterpret_cast<const char*>(page.data()), page.size() * sizeof(texel));
+      }
+    }
+
+    if (i + 1 < levels.size()) {
+      // Box filter, odd sizes repeating their last row or column.
+      const auto& n = levels[i + 1];
+      std::vector<texel> next(size_t(n.width) * n.height);
+      for (std::uint32_t y = 0; y < n.height; y++) {
+        for (std::uint32_t x = 0; x < n.width; x++) {
+          auto x0 = std::min(2*x, l.width - 1), x1 = std::min(2*x + 1, l.width - 1);
+          auto y0 = std::min(2*y, l.height - 1), y1 = std::min(2*y + 1, l.height - 1);
+          next[size_t(y) * n.width + x] = texel(0.25 * (texels[size_t(y0) * l.width + x0].to_color()
+            + texels[size_t(y0) * l.width + x1].to_color() + texels[size_t(y1) * l.width + x0].to_color()
+            + texels[size_t(y1) * l.width + x1].to_color()));
+        }
+      }
+      texels.swap(next);
+    }
+  }
+
+  out.close();
+  if (!out || std::rename(partial.c_str(), path.c_str()) != 0) {
+    std::remove(partial.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Converts any image stb_image reads into a paged texture file.
+bool convert_to_paged_texture(const char* image, const std::string& path,
+                              texel_format format = texel_format::rgb8) {
+  int width, height, components;
+  auto data = stbi_load(image, &width, &height, &components, 3);
+  if (!data) {
+    std::cerr << "ERROR: Could not load texture image file '" << image << "'.\n";
+    return false;
+  }
+
+  bool written;
+  const auto color_scale = 1.0 / 255.0;
+  size_t count = size_t(width) * height;
+  if (format == texel_format::rgb32f) {
+    std::vector<rgb32f_texel> texels(count);
+    for (size_t i = 0; i < count; i++)
+      texels[i] = color(color_scale*data[3*i], color_scale*data[3*i+1], color_scale*data[3*i+2]);
+    stbi_image_free(data);
+    written = write_paged_texture(path, width, height, std::move(texels));
+  } else {
+    std::vector<rgb8_texel> texels(count);
+    for (size_t i = 0; i < count; i++)
+      std::copy(data + 3*i, data + 3*i + 3, texels[i].value);
+    stbi_image_free(data);
+    written = write_paged_texture(path, width, height, std::move(texels));
+  }
+  return written;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline int thread_count() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs f(i) for every i in [begin, end) on all hardware threads. Indices are
+// handed out in chunks on demand, so uneven work still balances.
+template <typename F>
+void parallel_for(int begin, int end, F f, int chunk = 1) {
+  std::atomic<int> next(begin);
+  auto worker = [&]() {
+    for (;;) {
+      int start = next.fetch_add(chunk);
+      if (start >= end)
+        break;
+      for (int i = start; i < std::min(end, start + chunk); i++)
+        f(i);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int t = 1; t < thread_count(); t++)
+    pool.push_back(std::thread(worker));
+  worker();
+  for (auto& thread : pool)
+    thread.join();
+}
+
+#endif
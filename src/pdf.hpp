@@ -0,0 +1,157 @@
+#ifndef PDF_HPP
+#define PDF_HPP
+
+#include "rtweekend.hpp"
+
+#include "hittable.hpp"
+#include "onb.hpp"
+
+inline vec3 random_cosine_direction(double r1, double r2) {
+  auto z = sqrt(1-r2);
+
+  double sin_phi, cos_phi;
+  shading_sincos(2*pi*r1, sin_phi, cos_phi);
+  auto x = cos_phi*sqrt(r2);
+  auto y = sin_phi*sqrt(r2);
+
+  return vec3(x, y, z);
+}
+
+inline vec3 random_cosine_direction() {
+  return random_cosine_direction(random_double(), random_double());
+}
+
+inline vec3 random_to_sphere(double radius, double distance_squared) {
+  auto r1 = random_double();
+  auto r2 = random_double();
+  auto z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
+
+  double sin_phi, cos_phi;
+  shading_sincos(2*pi*r1, sin_phi, cos_phi);
+  auto x = cos_phi*sqrt(1-z*z);
+  auto y = sin_phi*sqrt(1-z*z);
+
+  return vec3(x, y, z);
+}
+
+// A probability density over directions. value() is the solid angle density
+// of a direction and generate() draws a direction distributed by it.
+class pdf {
+public:
+  virtual ~pdf() {}
+
+  virtual double value(const vec3& direction) const = 0;
+  virtual vec3 generate() const = 0;
+
+  // Draws a direction from two uniform numbers, so a sampler can supply well
+  // distributed ones. Densities without a warp ignore them.
+  virtual vec3 generate(double u1, double u2) const {
+    return generate();
+  }
+};
+
+class cosine_pdf : public pdf {
+public:
+  cosine_pdf(const vec3& w) { uvw.build_from_w(w); }
+
+  virtual double value(const vec3& direction) const override {
+    auto cosine = dot(unit_vector(direction), uvw.w());
+    return (cosine <= 0) ? 0 : cosine/pi;
+  }
+
+  virtual vec3 generate() const override {
+    return generate(random_double(), random_double());
+  }
+
+  virtual vec3 generate(double u1, double u2) const override {
+    return uvw.local(random_cosine_direction(u1, u2));
+  }
+
+public:
+  onb uvw;
+};
+
+class sphere_pdf : public pdf {
+public:
+  sphere_pdf() {}
+
+  virtual double value(const vec3& direction) const override {
+    return 1 / (4*pi);
+  }
+
+  virtual vec3 generate() const override {
+    return random_unit_vector();
+  }
+
+  virtual vec3 generate(double u1, double u2) const override {
+    return uniform_sphere(u1, u2);
+  }
+};
+
+// A Phong lobe around a mirror direction, for glossy reflection. Larger
+// exponents give tighter highlights.
+class phong_pdf : public pdf {
+public:
+  phong_pdf(const vec3& reflected, double e) : exponent(e) { uvw.build_from_w(reflected); }
+
+  virtual double value(const vec3& direction) const override {
+    auto cosine = dot(unit_vector(direction), uvw.w());
+    return (cosine <= 0) ? 0 : (exponent + 1) / (2*pi) * pow(cosine, exponent);
+  }
+
+  virtual vec3 generate() const override {
+    return generate(random_double(), random_double());
+  }
+
+  virtual vec3 generate(double u1, double u2) const override {
+    auto cos_alpha = pow(u1, 1 / (exponent + 1));
+    auto sin_alpha = sqrt(1 - cos_alpha*cos_alpha);
+    auto phi = 2*pi*u2;
+    return uvw.local(cos(phi)*sin_alpha, sin(phi)*sin_alpha, cos_alpha);
+  }
+
+public:
+  onb uvw;
+  double exponent;
+};
+
+class hittable_pdf : public pdf {
+public:
+  hittable_pdf(shared_ptr<hittable> p, const point3& origin) : ptr(p), o(origin) {}
+
+  virtual double value(const vec3& direction) const override {
+    return ptr->pdf_value(o, direction);
+  }
+
+  virtual vec3 generate() const override {
+    return ptr->random(o);
+  }
+
+public:
+  shared_ptr<hittable> ptr;
+  point3 o;
+};
+
+class mixture_pdf : public pdf {
+public:
+  mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
+    p[0] = p0;
+    p[1] = p1;
+  }
+
+  virtual double value(const vec3& direction) const override {
+    return 0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction);
+  }
+
+  virtual vec3 generate() const override {
+    if (random_double() < 0.5)
+      return p[0]->generate();
+    else
+      return p[1]->generate();
+  }
+
+public:
+  shared_ptr<pdf> p[2];
+};
+
+#endif
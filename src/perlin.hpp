@@ -3,24 +3,53 @@
 
 #include "rtweekend.hpp"
 
+#include <algorithm>
+#include <cstdint>
+
+// Blends the gradients of the 8 lattice corners around each of n lookups,
+// scaled by weight: u, v, w are the positions inside the cells and g* the
+// corner gradients, corner c = 4*di + 2*dj + dk at g*[c*stride + lane]. Kept
+// free of branches and aliasing so it vectorizes; the gathers happen before.
+inline void perlin_lanes(int n, int stride,
+                         const float* __restrict u, const float* __restrict v,
+                         const float* __restrict w, const float* __restrict weight,
+                         const float* __restrict gx, const float* __restrict gy,
+                         const float* __restrict gz, float* __restrict out) {
+  for (int l = 0; l < n; l++) {
+    float x = u[l], y = v[l], z = w[l];
+    float uu = x*x*(3 - 2*x);
+    float vv = y*y*(3 - 2*y);
+    float ww = z*z*(3 - 2*z);
+
+    float d[8];
+    for (int c = 0; c < 8; c++) {
+      float dx = x - (c >> 2), dy = y - ((c >> 1) & 1), dz = z - (c & 1);
+      d[c] = gx[c*stride + l]*dx + gy[c*stride + l]*dy + gz[c*stride + l]*dz;
+    }
+
+    float x00 = d[0] + uu*(d[4] - d[0]);
+    float x01 = d[1] + uu*(d[5] - d[1]);
+    float x10 = d[2] + uu*(d[6] - d[2]);
+    float x11 = d[3] + uu*(d[7] - d[3]);
+    float y0 = x00 + vv*(x10 - x00);
+    float y1 = x01 + vv*(x11 - x01);
+    out[l] = weight[l] * (y0 + ww*(y1 - y0));
+  }
+}
+
 class perlin {
 public:
   perlin() {
-    ranvec = new vec3[point_count];
     for(int i = 0; i < point_count; ++i) {
       ranvec[i] = unit_vector(vec3::random(-1,1));
+      grad_x[i] = float(ranvec[i].x());
+      grad_y[i] = float(ranvec[i].y());
+      grad_z[i] = float(ranvec[i].z());
     }
 
-    perm_x = perlin_generate_perm();
-    perm_y = perlin_generate_perm();
-    perm_z = perlin_generate_perm();
-  }
-
-  ~perlin() {
-    delete[] ranvec;
-    delete[] perm_x;
-    delete[] perm_y;
-    delete[] perm_z;
+    perlin_generate_perm(perm_x);
+    perlin_generate_perm(perm_y);
+    perlin_generate_perm(perm_z);
   }
 
   double noise(const point3& p) const {
@@ -47,61 +76,43 @@ public:
     return perlin_interp(c, u, v, w);
   }
 
+  // The octaves of one point are evaluated together, in single precision;
+  // results stay within 1e-5 of summing noise() per octave.
   double turbulence(const point3& p, int depth=7) const {
-    auto accum = 0.0;
-    auto temp_p = p;
-    auto weight = 1.0;
-
-    for (int i = 0; i < depth; i++) {
-      accum += weight*noise(temp_p);
-      weight *= 0.5;
-      temp_p *= 2;
-    }
-
-    return fabs(accum);
+    double result;
+    turbulence(&p, &result, 1, depth);
+    return result;
   }
 
+  // turbulence() of count points at once, into out.
+  void turbulence(const point3* points, double* out, int count, int depth=7) const;
+
 private:
   static const int point_count = 256;
-  vec3* ranvec;
-  int* perm_x;
-  int* perm_y;
-  int* perm_z;
+  static const int lanes = 64;   // octave evaluations per perlin_lanes call
 
-  static int* perlin_generate_perm() {
-    auto p = new int[point_count];
+  vec3 ranvec[point_count];
+  float grad_x[point_count], grad_y[point_count], grad_z[point_count];
+  std::int32_t perm_x[point_count];
+  std::int32_t perm_y[point_count];
+  std::int32_t perm_z[point_count];
 
+  static void perlin_generate_perm(std::int32_t* p) {
     for(int i = 0; i < perlin::point_count; i++) {
       p[i] = i;
     }
     permute(p, point_count);
-
-    return p;
   }
 
-  static void permute(int *p, int n) {
+  static void permute(std::int32_t *p, int n) {
     for(int i = n-1; i>0; i--) {
       int target = random_int(0,i);
-      int tmp = p[i];
+      std::int32_t tmp = p[i];
       p[i] = p[target];
       p[target] = tmp;
     }
   }
 
-  static double trinilear_interp(double c[2][2][2], double u, double v, double w) {
-    auto accum = 0.0;
-    for (int i=0; i < 2; i++) {
-      for (int j=0; j < 2; j++) {
-        for (int k=0; k < 2; k++) {
-          accum += (i*u + (1-i)*(1-u))*
-                   (j*v + (1-j)*(1-v))*
-                   (k*w + (1-k)*(1-w))*c[i][j][k];
-        }
-      }
-    }
-    return accum;
-  }
-
   static double perlin_interp(vec3 c[2][2][2], double u, double v, double w) {
     auto uu = u*u*(3-2*u);
     auto vv = v*v*(3-2*v);
@@ -122,4 +133,58 @@ private:
   }
 };
 
+// Every (point, octave) pair is a lane: lattice cells, hashes and gradient
+// gathers are done per lane with scalar code, then perlin_lanes blends the
+// corners of a whole block of lanes in vector registers.
+void perlin::turbulence(const point3* points, double* out, int count, int depth) const {
+  float u[lanes], v[lanes], w[lanes], weight[lanes], result[lanes];
+  float gx[8*lanes], gy[8*lanes], gz[8*lanes];
+  int owner[lanes];
+
+  for (int i = 0; i < count; i++)
+    out[i] = 0;
+
+  int n = 0;
+  auto flush = [&]() {
+    perlin_lanes(n, lanes, u, v, w, weight, gx, gy, gz, result);
+    for (int l = 0; l < n; l++)
+      out[owner[l]] += result[l];
+    n = 0;
+  };
+
+  for (int point = 0; point < count; point++) {
+    auto p = points[point];
+    auto octave_weight = 1.0;
+    for (int octave = 0; octave < depth; octave++) {
+      auto fx = floor(p.x()), fy = floor(p.y()), fz = floor(p.z());
+      auto i = static_cast<int>(fx), j = static_cast<int>(fy), k = static_cast<int>(fz);
+      u[n] = float(p.x() - fx);
+      v[n] = float(p.y() - fy);
+      w[n] = float(p.z() - fz);
+      weight[n] = float(octave_weight);
+      owner[n] = point;
+
+      std::int32_t hx[2] = { perm_x[i & 255], perm_x[(i+1) & 255] };
+      std::int32_t hy[2] = { perm_y[j & 255], perm_y[(j+1) & 255] };
+      std::int32_t hz[2] = { perm_z[k & 255], perm_z[(k+1) & 255] };
+      for (int c = 0; c < 8; c++) {
+        auto g = hx[c >> 2] ^ hy[(c >> 1) & 1] ^ hz[c & 1];
+        gx[c*lanes + n] = grad_x[g];
+        gy[c*lanes + n] = grad_y[g];
+        gz[c*lanes + n] = grad_z[g];
+      }
+
+      if (++n == lanes)
+        flush();
+      octave_weight *= 0.5;
+      p *= 2;
+    }
+  }
+  if (n > 0)
+    flush();
+
+  for (int i = 0; i < count; i++)
+    out[i] = fabs(out[i]);
+}
+
 #endif
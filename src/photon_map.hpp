@@ -0,0 +1,208 @@
+#ifndef PHOTON_MAP_HPP
+#define PHOTON_MAP_HPP
+
+#include "rtweekend.hpp"
+
+#include "color.hpp"
+#include "distribution.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "onb.hpp"
+#include "parallel.hpp"
+#include "pdf.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Flux arriving at a diffuse surface through one or more specular bounces.
+struct photon {
+  point3 p;
+  vec3 direction;  // of travel, towards the surface
+  color power;
+};
+
+// A caustic photon map, after "Global Illumination using Photon Maps" (Jensen
+// 1996). Photons leave the emitters, follow specular chains through
+// dielectrics and mirrors, and are stored where they land on a diffuse
+// surface. Photons that reach a surface without a specular bounce are
+// dropped, next event estimation already covers that light.
+//
+// Photons are binned into a hashed grid with cells one radius wide, so a
+// density estimate visits the 27 cells around the query point.
+class photon_map {
+public:
+  photon_map() : radius(0), emitted(0) {}
+
+  // Traces count photons from the lights, in parallel. Each block of photons
+  // draws from its own generator, the scattering of the materials included,
+  // so the result only depends on seed and count.
+  photon_map(const std::vector<shared_ptr<hittable>>& lights, const hittable& world,
+             int count, double radius, int max_depth, unsigned seed = 0);
+
+  bool empty() const { return photons.empty(); }
+  size_t size() const { return photons.size(); }
+
+  // Irradiance at p from the photons within radius that arrived on the side
+  // normal faces.
+  color irradiance(const point3& p, const vec3& normal) const;
+
+public:
+  double radius;
+  int emitted;
+
+private:
+  void trace(const hittable& light, double light_probability, const hittable& world,
+             int max_depth, std::mt19937& generator, std::vector<photon>& out) const;
+
+  void cell(const point3& p, int64_t& x, int64_t& y, int64_t& z) const {
+    x = int64_t(floor(p.x() / radius));
+    y = int64_t(floor(p.y() / radius));
+    z = int64_t(floor(p.z() / radius));
+  }
+
+  size_t bucket(int64_t x, int64_t y, int64_t z) const {
+    auto h = uint64_t(x) * 73856093u ^ uint64_t(y) * 19349663u ^ uint64_t(z) * 83492791u;
+    return h & (cell_start.size() - 2);
+  }
+
+  std::vector<photon> photons;   // sorted by bucket
+  std::vector<int> cell_start;   // buckets + 1 offsets into photons
+};
+
+photon_map::photon_map(const std::vector<shared_ptr<hittable>>& lights, const hittable& world,
+                       int count, double r, int max_depth, unsigned seed)
+  : radius(r), emitted(count) {
+  // Choose lights by their power, estimated from the radiance at one point.
+  std::vector<double> power;
+  for (const auto& light : lights) {
+    hit_record rec;
+    if (!light->sample_surface(0.5, 0.5, 0, rec))
+      power.push_back(0);
+    else
+      power.push_back(luminance(rec.mat_ptr->emitted(rec.u, rec.v, rec.p)) * light->area());
+  }
+  if (power.empty() || count <= 0)
+    return;
+  distribution_1d light_distribution(power.data(), power.size());
+
+  const int block = 4096;
+  int blocks = (count + block - 1) / block;
+  std::vector<std::vector<photon>> found(blocks);
+
+  parallel_for(0, blocks, [&](int b) {
+    std::mt19937 generator(seed * 7919u + b);
+    scoped_random_source random(generator);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (int k = b*block; k < std::min(count, (b+1)*block); k++) {
+      double probability;
+      int index;
+      light_distribution.sample(uniform(generator), probability, index);
+      probability /= power.size();
+      if (probability > 0)
+        trace(*lights[index], probability, world, max_depth, generator, found[b]);
+    }
+  });
+
+  // Counting sort into the hashed grid.
+  size_t buckets = 1;
+  size_t total = 0;
+  for (const auto& f : found)
+    total += f.size();
+  while (buckets < 2*total)
+    buckets *= 2;
+  cell_start.assign(buckets + 1, 0);
+
+  for (const auto& f : found) {
+    for (const auto& ph : f) {
+      int64_t x, y, z;
+      cell(ph.p, x, y, z);
+      cell_start[bucket(x, y, z) + 1]++;
+    }
+  }
+  for (size_t i = 1; i <= buckets; i++)
+    cell_start[i] += cell_start[i-1];
+
+  photons.resize(total);
+  std::vector<int> next(cell_start.begin(), cell_start.end() - 1);
+  for (const auto& f : found) {
+    for (const auto& ph : f) {
+      int64_t x, y, z;
+      cell(ph.p, x, y, z);
+      photons[next[bucket(x, y, z)]++] = ph;
+    }
+  }
+}
+
+void photon_map::trace(const hittable& light, double light_probability, const hittable& world,
+                       int max_depth, std::mt19937& generator, std::vector<photon>& out) const {
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  hit_record rec;
+  if (!light.sample_surface(uniform(generator), uniform(generator), uniform(generator), rec))
+    return;
+
+  // diffuse_light emits from both sides, with a cosine distribution.
+  auto normal = uniform(generator) < 0.5 ? rec.normal : -rec.normal;
+  onb uvw;
+  uvw.build_from_w(normal);
+  auto direction = uvw.local(random_cosine_direction(uniform(generator), uniform(generator)));
+
+  color power = rec.mat_ptr->emitted(rec.u, rec.v, rec.p) * (2 * pi * light.area())
+    / (light_probability * emitted);
+  ray r(rec.p, direction, 0);
+
+  bool specular = false;
+  for (int depth = 0; depth < max_depth; depth++) {
+    if (!world.hit(r, 0.001, infinity, rec))
+      return;
+
+    scatter_record srec;
+    if (!rec.mat_ptr->scatter(r, rec, srec))
+      return;
+
+    if (!srec.is_specular) {
+      if (specular && rec.mat_ptr->is_diffuse())
+        out.push_back({rec.p, unit_vector(r.direction()), power});
+      return;
+    }
+
+    specular = true;
+    power = power * srec.attenuation;
+    r = srec.specular_ray;
+  }
+}
+
+color photon_map::irradiance(const point3& p, const vec3& normal) const {
+  if (photons.empty())
+    return color(0,0,0);
+
+  int64_t cx, cy, cz;
+  cell(p, cx, cy, cz);
+
+  // Neighbouring cells may share a bucket, visit each bucket once.
+  size_t visited[27];
+  int visited_count = 0;
+
+  color sum(0,0,0);
+  for (int64_t x = cx - 1; x <= cx + 1; x++) {
+    for (int64_t y = cy - 1; y <= cy + 1; y++) {
+      for (int64_t z = cz - 1; z <= cz + 1; z++) {
+        auto b = bucket(x, y, z);
+        if (std::find(visited, visited + visited_count, b) != visited + visited_count)
+          continue;
+        visited[visited_count++] = b;
+
+        for (int i = cell_start[b]; i < cell_start[b+1]; i++) {
+          const auto& ph = photons[i];
+          if ((ph.p - p).length_squared() < radius*radius && dot(ph.direction, normal) < 0)
+            sum += ph.power;
+        }
+      }
+    }
+  }
+  return sum / (pi * radius * radius);
+}
+
+#endif
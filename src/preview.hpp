@@ -0,0 +1,77 @@
+#ifndef PREVIEW_HPP
+#define PREVIEW_HPP
+
+#include "rtweekend.hpp"
+
+#include "framebuffer.hpp"
+#include "image_output.hpp"
+#include "parallel.hpp"
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <iostream>
+#include <string>
+
+// Renders a quick sequence of ever better images of a width x height view
+// and passes each to frame() as soon as it is done: one sample in every 4x4
+// block of pixels, then in every 2x2 block, then every pixel at 1 spp, then
+// doubling the samples per pixel up to max_spp. The block passes paint the
+// whole block, so every frame is full size. Rows render in parallel, each
+// with its own sampler from make_sampler() and a generator seeded by pass
+// and row, so the frames do not depend on the threads.
+//
+// sample(i, j, index, s) traces sample number index of pixel (i, j) with s,
+// row 0 at the bottom.
+void render_preview(int width, int height, int max_spp,
+                    const std::function<shared_ptr<sampler>()>& make_sampler,
+                    const std::function<color(int, int, int, sampler&)>& sample,
+                    const std::function<void(float_image)>& frame) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  auto report = [&](const std::string& pass) {
+    std::cerr << pass << " at "
+              << std::chrono::duration<double>(clock::now() - start).count() * 1e3 << " ms\n";
+  };
+
+  int pass = 0;
+  for (int block : { 4, 2 }) {
+    float_image image(width, height);
+    int blocks_x = (width + block - 1) / block, blocks_y = (height + block - 1) / block;
+    parallel_for(0, blocks_y, [&](int by) {
+      std::mt19937 generator(hash_combine(hash_uint(pass), by));
+      scoped_random_source random(generator);
+      auto s = make_sampler();
+      for (int bx = 0; bx < blocks_x; bx++) {
+        int x0 = bx * block, y0 = by * block;
+        int x1 = std::min(x0 + block, width), y1 = std::min(y0 + block, height);
+        auto c = sample((x0 + x1) / 2, height-1 - (y0 + y1) / 2, 0, *s);
+        for (int y = y0; y < y1; y++)
+          for (int x = x0; x < x1; x++)
+            image.set(x, y, c);
+      }
+    });
+    frame(std::move(image));
+    report(block == 4 ? "1/16 resolution" : "1/4 resolution");
+    pass++;
+  }
+
+  framebuffer fb(width, height);
+  for (int spp = 1, done = 0; done < max_spp; done = spp, spp = std::min(2 * spp, max_spp)) {
+    parallel_for(0, height, [&](int j) {
+      std::mt19937 generator(hash_combine(hash_uint(pass), j));
+      scoped_random_source random(generator);
+      auto s = make_sampler();
+      for (int i = 0; i < width; i++)
+        for (int k = done; k < spp; k++)
+          fb.add(i, j, sample(i, j, k, *s));
+    });
+    frame(fb.resolve());
+    report(std::to_string(spp) + " spp");
+    pass++;
+  }
+}
+
+#endif
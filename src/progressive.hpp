@@ -0,0 +1,52 @@
+#ifndef PROGRESSIVE_HPP
+#define PROGRESSIVE_HPP
+
+#include "rtweekend.hpp"
+
+#include "framebuffer.hpp"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+struct progressive_result {
+  int passes = 0;
+  double seconds = 0;
+};
+
+// Adds one sample per pixel per pass until the deadline. A pass only starts
+// if the slowest pass so far would still finish in time, so the image always
+// ends on a pass boundary with every pixel sampled equally, and at least one
+// pass always runs.
+//
+// sample(i, j, index) traces sample number index of pixel (i, j).
+progressive_result render_until(framebuffer& fb, double seconds,
+                                const std::function<color(int, int, int)>& sample) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  auto elapsed = [&]() {
+    return std::chrono::duration<double>(clock::now() - start).count();
+  };
+
+  progressive_result result;
+  double slowest_pass = 0;
+
+  while (result.passes == 0 || elapsed() + slowest_pass <= seconds) {
+    auto pass_start = elapsed();
+
+    for (int j = 0; j < fb.height; ++j) {
+      for (int i = 0; i < fb.width; ++i)
+        fb.add(i, j, sample(i, j, fb.samples[j*fb.width + i]));
+    }
+
+    result.passes++;
+    slowest_pass = std::max(slowest_pass, elapsed() - pass_start);
+    std::cerr << "\rPass " << result.passes << " done at " << elapsed() << "s " << std::flush;
+  }
+  std::cerr << '\n';
+
+  result.seconds = elapsed();
+  return result;
+}
+
+#endif
@@ -24,4 +24,18 @@ class ray {
         double tm;
 };
 
+// How a camera ray's direction changes from one pixel to the next, in x and
+// y. The neighbouring rays share its origin.
+struct ray_differential {
+  vec3 dx, dy;
+};
+
+// Change of the texture coordinates from one pixel to the next at a surface
+// point, estimated from ray differentials. All zero when unknown, which
+// textures take as a point sample.
+struct texture_footprint {
+  double du_dx = 0, dv_dx = 0;
+  double du_dy = 0, dv_dy = 0;
+};
+
 #endif
@@ -0,0 +1,411 @@
+#ifndef RENDER_HPP
+#define RENDER_HPP
+
+#include "rtweekend.hpp"
+
+#include "aov.hpp"
+#include "camera.hpp"
+#include "environment.hpp"
+#include "guide.hpp"
+#include "hittable.hpp"
+#include "irradiance_cache.hpp"
+#include "lights.hpp"
+#include "material.hpp"
+#include "onb.hpp"
+#include "parallel.hpp"
+#include "photon_map.hpp"
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <vector>
+
+// Rays cast into the scene by ray_color, closest hit and shadow rays alike,
+// for throughput reports.
+std::atomic<unsigned long long> rays_traced(0);
+
+// Everything ray_color reads besides the ray: the geometry, what lights it,
+// and optional caches. It is never modified while rendering, so threads can
+// share one; a training path guide only takes atomic records.
+struct render_context {
+  render_context(const environment& b, const hittable& w, const light_sampler& l)
+    : background(b), world(w), lights(l), irradiance(nullptr), caustics(nullptr),
+      guide(nullptr) {}
+
+  const environment& background;
+  const hittable& world;
+  const light_sampler& lights;
+  const irradiance_cache* irradiance;
+  const photon_map* caustics;
+  path_guide* guide;
+};
+
+// What the path reaching ray_color last did, so light carried by the caustic
+// photon map is not also counted by path tracing: a diffuse bounce, or
+// specular bounces following a diffuse one. Anything else is a camera_path.
+enum path_kind { camera_path, diffuse_path, caustic_path };
+
+// Probability that next event estimation samples the environment instead of
+// one of the emitters in the scene.
+double environment_probability(const environment& background, const light_sampler& lights) {
+  if (!background.sampled())
+    return 0;
+  return lights.empty() ? 1.0 : 0.5;
+}
+
+// bsdf_pdf is the density the previous bounce sampled r with, or negative for
+// camera rays and specular bounces, which light sampling can never produce.
+// When aov is given it receives the attributes of the first surface r hits.
+// Camera rays pass the change of their direction to the next pixel over as
+// differential, which textures filter their lookups by.
+color ray_color(const ray& r, const render_context& scene, int depth, sampler& s,
+                double bsdf_pdf = -1, aov_sample* aov = nullptr, path_kind path = camera_path,
+                const ray_differential* differential = nullptr) {
+  const auto& background = scene.background;
+  const auto& world = scene.world;
+  const auto& lights = scene.lights;
+  hit_record rec;
+
+  // If we've exceeded the ray bounce limit, no more light is gathered.
+  if(depth <= 0) {
+    return color(0,0,0);
+  }
+
+  auto env_probability = environment_probability(background, lights);
+
+  // If the ray hits nothing, return the background color
+  rays_traced++;
+  if (!world.hit(r, 0.001, infinity, rec)) {
+    auto sky = background.value(r.direction());
+    if (aov) {
+      aov->albedo = sky;
+      aov->normal = -unit_vector(r.direction());
+      aov->depth = 1e6;
+    }
+    if (bsdf_pdf > 0 && env_probability > 0)
+      sky *= power_heuristic(bsdf_pdf, env_probability * background.pdf_value(r.direction()));
+    return sky;
+  }
+
+  if (differential)
+    compute_footprint(r, *differential, rec);
+
+  scatter_record srec;
+  color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+  // Emitters found by BSDF sampling share their contribution with light sampling.
+  if (bsdf_pdf > 0 && emitted.length_squared() > 0) {
+    auto light_pdf = (1 - env_probability) * lights.pdf_value(r.origin(), r.direction());
+    emitted *= power_heuristic(bsdf_pdf, light_pdf);
+  }
+
+  // Light reaching a diffuse surface through specular bounces is in the
+  // photon map.
+  if (path == caustic_path && scene.caustics)
+    emitted = color(0,0,0);
+
+  bool scatters = rec.mat_ptr->scatter(r, rec, srec);
+  if (aov) {
+    aov->albedo = scatters ? srec.attenuation : color(1,1,1);
+    aov->normal = rec.normal;
+    aov->depth = rec.t * r.direction().length();
+  }
+
+  if (!scatters) {
+    return emitted;
+  }
+
+  if (srec.is_specular) {
+    auto next = path == camera_path ? camera_path : caustic_path;
+    return emitted + srec.attenuation *
+      ray_color(srec.specular_ray, scene, depth-1, s, -1, nullptr, next);
+  }
+
+  // The guide mixes the light it learned arrives here into BSDF sampling,
+  // before next event estimation so both weigh against the mixture.
+  int guide_cell = -1;
+  if (scene.guide) {
+    guide_cell = scene.guide->cell_index(rec.p);
+    srec.pdf_ptr = scene.guide->sampling_pdf(guide_cell, srec.pdf_ptr);
+  }
+
+  // Caustics on diffuse surfaces come from the photon map.
+  if (scene.caustics && rec.mat_ptr->is_diffuse())
+    emitted += srec.attenuation / pi * scene.caustics->irradiance(rec.p, rec.normal);
+
+  // Next event estimation: sample the environment or an emitter directly and
+  // cast a shadow ray to it.
+  color direct(0,0,0);
+  light_sample ls;
+  bool sampled;
+  if (random_double() < env_probability) {
+    sampled = background.sample(ls);
+    ls.pdf *= env_probability;
+  } else {
+    sampled = lights.sample(rec.p, r.time(), ls);
+    ls.pdf *= 1 - env_probability;
+  }
+
+  ray shadow(rec.p, ls.direction, r.time());
+  auto scattering_pdf = sampled ? rec.mat_ptr->scattering_pdf(r, rec, shadow) : 0;
+
+  if (scattering_pdf > 0) {
+    rays_traced++;
+    if (!world.occluded(shadow, 0.001, ls.distance * (1 - 1e-6))) {
+      auto weight = power_heuristic(ls.pdf, srec.pdf_ptr->value(ls.direction));
+      direct = weight * srec.attenuation * scattering_pdf * ls.emitted / ls.pdf;
+    }
+  }
+
+  // Diffuse interreflection seen through a diffuse or glossy bounce varies
+  // slowly, interpolate it from the irradiance cache where it has records.
+  color irradiance;
+  if (bsdf_pdf > 0 && scene.irradiance && rec.mat_ptr->is_diffuse()
+      && scene.irradiance->lookup(rec.p, rec.normal, irradiance)) {
+    return emitted + direct + srec.attenuation * irradiance / pi;
+  }
+
+  double u1, u2;
+  s.get_2d(u1, u2);
+  ray scattered(rec.p, srec.pdf_ptr->generate(u1, u2), r.time());
+  auto pdf_val = srec.pdf_ptr->value(scattered.direction());
+  if (pdf_val <= 0) {
+    return emitted + direct;
+  }
+
+  auto next = rec.mat_ptr->is_diffuse() ? diffuse_path : camera_path;
+  auto incoming = ray_color(scattered, scene, depth-1, s, pdf_val, nullptr, next);
+  auto reflected = srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered) * incoming;
+
+  if (scene.guide && scene.guide->training) {
+    scene.guide->record(guide_cell, scattered.direction(), luminance(incoming), *srec.pdf_ptr,
+                        luminance(reflected));
+  }
+
+  return emitted + direct + reflected / pdf_val;
+}
+
+// Traces sample number index of pixel (i, j), drawing the pixel position,
+// lens position, shutter time and BSDF directions from s.
+color sample_pixel(int i, int j, int index, int image_width, int image_height,
+                   const camera& cam, const render_context& scene, int max_depth, sampler& s,
+                   aov_sample* aov = nullptr) {
+  s.start_sample(i, j, index);
+
+  double du, dv, lens_u, lens_v;
+  s.get_2d(du, dv);
+  s.get_2d(lens_u, lens_v);
+  auto shutter = s.get_1d();
+
+  auto u = double(i + du) / (image_width-1);
+  auto v = double(j + dv) / (image_height-1);
+
+  ray r = cam.get_ray(u, v, lens_u, lens_v, shutter);
+  auto differential = cam.differentials(image_width, image_height);
+  return ray_color(r, scene, max_depth, s, -1, aov, camera_path, &differential);
+}
+
+// Trains guide over passes of 1, 2, 4, ... samples per pixel, each learning
+// from the distributions the previous ones built. Rows render in parallel,
+// each drawing from a generator seeded by pass and row, and the images are
+// thrown away.
+void train_guide(path_guide& guide, int passes, const camera& cam, int image_width,
+                 int image_height, const render_context& scene, int max_depth) {
+  render_context training_scene = scene;
+  training_scene.guide = &guide;
+  guide.training = true;
+
+  for (int pass = 0; pass < passes; pass++) {
+    int spp = 1 << pass;
+    parallel_for(0, image_height, [&](int j) {
+      std::mt19937 generator(hash_combine(hash_uint(pass), j));
+      scoped_random_source random(generator);
+      independent_sampler s;
+      for (int i = 0; i < image_width; i++) {
+        for (int k = 0; k < spp; k++)
+          sample_pixel(i, j, k, image_width, image_height, cam, training_scene, max_depth, s);
+      }
+    });
+    guide.update();
+  }
+
+  guide.training = false;
+}
+
+// A surface point the render will look up irradiance at, with the bounces
+// left for paths continuing from it.
+struct cache_point {
+  point3 p;
+  vec3 normal;
+  double time;
+  int depth;
+};
+
+// Finds the points an irradiance cache needs records for: the first diffuse
+// hit after a non-specular bounce, on one path through every stride-th pixel.
+std::vector<cache_point> cache_points(const camera& cam, int image_width, int image_height,
+                                      int stride, const render_context& scene, int max_depth) {
+  std::vector<cache_point> points;
+  for (int j = 0; j < image_height; j += stride) {
+    for (int i = 0; i < image_width; i += stride) {
+      auto r = cam.get_ray(double(i + random_double()) / (image_width-1),
+                           double(j + random_double()) / (image_height-1));
+      bool diffuse_bounce = false;
+
+      for (int depth = max_depth; depth > 0; depth--) {
+        hit_record rec;
+        scatter_record srec;
+        if (!scene.world.hit(r, 0.001, infinity, rec) || !rec.mat_ptr->scatter(r, rec, srec))
+          break;
+
+        if (diffuse_bounce && rec.mat_ptr->is_diffuse()) {
+          points.push_back({rec.p, rec.normal, r.time(), depth});
+          break;
+        }
+
+        diffuse_bounce = !srec.is_specular;
+        r = srec.is_specular ? srec.specular_ray
+                             : ray(rec.p, srec.pdf_ptr->generate(), r.time());
+      }
+    }
+  }
+  return points;
+}
+
+// Computes a record at p from stratified cosine-weighted gather rays, with
+// the irradiance gradients of Ward & Heckbert, "Irradiance Gradients" (1992),
+// in the cosine-weighted form given by Krivanek et al. (2008). Gather rays
+// hitting diffuse surfaces may use the records already in scene.irradiance.
+irradiance_record gather_irradiance(const cache_point& point, const render_context& scene,
+                                    const irradiance_settings& settings, sampler& s) {
+  const int m = settings.theta_samples;
+  const int n = settings.phi_samples;
+  onb uvw;
+  uvw.build_from_w(point.normal);
+
+  std::vector<color> radiance(m*n);
+  std::vector<double> distance(m*n);
+  std::vector<double> tan_theta(m*n);
+  std::vector<vec3> tangent(m*n);
+
+  irradiance_record record;
+  record.p = point.p;
+  record.normal = point.normal;
+  record.irradiance = color(0,0,0);
+
+  double inverse_distances = 0;
+  for (int j = 0; j < m; j++) {
+    for (int k = 0; k < n; k++) {
+      auto sin2_theta = (j + random_double()) / m;
+      auto phi = 2*pi * (k + random_double()) / n;
+      auto sin_theta = sqrt(sin2_theta);
+      auto cos_theta = sqrt(1 - sin2_theta);
+      auto direction = uvw.local(sin_theta*cos(phi), sin_theta*sin(phi), cos_theta);
+
+      aov_sample first_hit;
+      auto l = ray_color(ray(point.p, direction, point.time), scene, point.depth - 1, s,
+                         cos_theta / pi, &first_hit, diffuse_path);
+
+      int index = j*n + k;
+      radiance[index] = l;
+      distance[index] = first_hit.depth;
+      tan_theta[index] = sin_theta / fmax(cos_theta, 1e-6);
+      tangent[index] = uvw.local(-sin(phi), cos(phi), 0);
+      record.irradiance += l;
+      inverse_distances += 1 / fmax(first_hit.depth, 1e-6);
+    }
+  }
+
+  record.irradiance *= pi / (m*n);
+  record.radius = m*n / fmax(inverse_distances, 1e-12);
+
+  for (int c = 0; c < 3; c++) {
+    record.rotational[c] = vec3(0,0,0);
+    record.translational[c] = vec3(0,0,0);
+  }
+
+  for (int k = 0; k < n; k++) {
+    auto phi_center = 2*pi * (k + 0.5) / n;
+    auto phi_edge = 2*pi * k / n;
+    auto u_k = uvw.local(cos(phi_center), sin(phi_center), 0);
+    auto v_k = uvw.local(-sin(phi_edge), cos(phi_edge), 0);
+    int previous_k = (k + n - 1) % n;
+
+    for (int j = 0; j < m; j++) {
+      int index = j*n + k;
+      auto sin_lower = sqrt(double(j) / m);
+      auto cos_lower = sqrt(1 - double(j) / m);
+      auto cos_upper = sqrt(1 - double(j + 1) / m);
+      auto sin_center = sqrt((j + 0.5) / m);
+
+      // Change across the boundary to the ring below, then to the wedge before.
+      color theta_change(0,0,0);
+      if (j > 0) {
+        int below = (j-1)*n + k;
+        theta_change = (radiance[index] - radiance[below]) * (2*pi / n)
+          * sin_lower * cos_lower * cos_lower / fmin(distance[index], distance[below]);
+      }
+      int before = j*n + previous_k;
+      color phi_change = (radiance[index] - radiance[before]) * (cos_lower - cos_upper)
+        / (sin_center * fmin(distance[index], distance[before]));
+
+      for (int c = 0; c < 3; c++) {
+        record.rotational[c] += (-pi / (m*n)) * tan_theta[index] * radiance[index][c] * tangent[index];
+        record.translational[c] += theta_change[c] * u_k + phi_change[c] * v_k;
+      }
+    }
+  }
+
+  // Do not reuse the record further than its gradient says the irradiance
+  // stays within reach, after Tabellion & Lamorlette (2004).
+  auto gradient = luminance(color(record.translational[0].length(),
+                                  record.translational[1].length(),
+                                  record.translational[2].length()));
+  if (gradient > 0)
+    record.radius = fmin(record.radius, luminance(record.irradiance) / gradient);
+
+  return record;
+}
+
+// Adds records to cache until every point is covered. Points are processed
+// in waves: the points of a wave that no record covers yet are gathered in
+// parallel against the cache as it stood, then the new records are inserted
+// one by one, dropping those that an earlier one in the wave already covers.
+// For the same points and threads the records are the same every run.
+void populate_irradiance_cache(irradiance_cache& cache, std::vector<cache_point> points,
+                               const render_context& scene) {
+  std::mt19937 shuffle_generator(1);
+  std::shuffle(points.begin(), points.end(), shuffle_generator);
+
+  render_context gather_scene = scene;
+  gather_scene.irradiance = &cache;
+
+  const size_t wave = 64 * thread_count();
+  for (size_t start = 0; start < points.size(); start += wave) {
+    auto count = std::min(wave, points.size() - start);
+    std::vector<irradiance_record> gathered(count);
+    std::vector<char> needed(count, 0);
+
+    parallel_for(0, count, [&](int k) {
+      const auto& point = points[start + k];
+      color irradiance;
+      if (cache.lookup(point.p, point.normal, irradiance))
+        return;
+      // Every gather draws from a generator of its own, seeded by its point.
+      std::mt19937 generator(unsigned(start + k));
+      scoped_random_source random(generator);
+      independent_sampler s;
+      gathered[k] = gather_irradiance(point, gather_scene, cache.settings, s);
+      needed[k] = 1;
+    });
+
+    for (size_t k = 0; k < count; k++) {
+      color irradiance;
+      if (needed[k] && !cache.lookup(gathered[k].p, gathered[k].normal, irradiance))
+        cache.insert(gathered[k]);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef RTWEEKEND_STB_IMAGE_WRITE_H
+#define RTWEEKEND_STB_IMAGE_WRITE_H
+
+// Disable pedantic warnings for this external library.
+#ifdef _MSC_VER
+    // Microsoft Visual C++ Compiler
+    #pragma warning (push, 0)
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../vendor/stb/stb_image_write.h"
+
+// Restore warning levels.
+#ifdef _MSC_VER
+    // Microsoft Visual C++ Compiler
+    #pragma warning (pop)
+#endif
+
+#endif
@@ -25,8 +25,31 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// While set, random_double() on this thread draws from this generator
+// rather than rand(). Work done in parallel before the render sets one
+// seeded per task, so what it builds does not depend on the threads, and
+// the threads do not queue on the lock glibc takes in rand().
+thread_local std::mt19937* random_source = nullptr;
+
+// Sets random_source for the life of a scope.
+class scoped_random_source {
+public:
+    scoped_random_source(std::mt19937& generator) : previous(random_source) {
+        random_source = &generator;
+    }
+    ~scoped_random_source() { random_source = previous; }
+
+    scoped_random_source(const scoped_random_source&) = delete;
+    scoped_random_source& operator=(const scoped_random_source&) = delete;
+
+private:
+    std::mt19937* previous;
+};
+
 inline double random_double() {
     // Returns a random real in [0,1).
+    if (random_source)
+        return (*random_source)() / 4294967296.0;
     return rand() / (RAND_MAX + 1.0);
 }
 
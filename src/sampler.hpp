@@ -0,0 +1,416 @@
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include "rtweekend.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Supplies the uniform numbers for one camera path. Each sample of a pixel
+// asks for dimensions in a fixed order (pixel position, lens, shutter time,
+// then two per bounce for the BSDF), so samplers that distribute each
+// dimension well across the samples of a pixel cut noise at equal spp.
+class sampler {
+public:
+  sampler() : pixel_x(0), pixel_y(0), sample_index(0), dimension(0) {}
+  virtual ~sampler() {}
+
+  // Begin sample number index of pixel (i, j), restarting at dimension 0.
+  virtual void start_sample(int i, int j, int index) {
+    pixel_x = i;
+    pixel_y = j;
+    sample_index = index;
+    dimension = 0;
+  }
+
+  virtual double get_1d() = 0;
+  virtual void get_2d(double& u, double& v) = 0;
+
+protected:
+  int pixel_x, pixel_y, sample_index, dimension;
+};
+
+// Hashing helpers for samplers that derive everything from (pixel, sample,
+// dimension) instead of storing precomputed tables.
+
+inline uint32_t hash_uint(uint32_t x) {
+  // lowbias32 from https://nullprogram.com/blog/2018/07/31/
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+  return hash_uint(seed ^ (v + 0x9e3779b9 + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t pixel_hash(int i, int j, int dimension) {
+  return hash_combine(hash_combine(hash_uint(i), j), dimension);
+}
+
+inline double to_unit(uint32_t x) {
+  // Keep the result strictly below one.
+  return fmin(x * (1.0 / 4294967296.0), 1 - 1e-16);
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+  x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+  x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+  x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+  return x;
+}
+
+// Element i of a random permutation of [0, l) selected by p, from Kensler's
+// "Correlated Multi-Jittered Sampling".
+inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+  uint32_t w = l - 1;
+  w |= w >> 1;
+  w |= w >> 2;
+  w |= w >> 4;
+  w |= w >> 8;
+  w |= w >> 16;
+  do {
+    i ^= p;
+    i *= 0xe170893d;
+    i ^= p >> 16;
+    i ^= (i & w) >> 4;
+    i ^= p >> 8;
+    i *= 0x0929eb3f;
+    i ^= p >> 23;
+    i ^= (i & w) >> 1;
+    i *= 1 | p >> 27;
+    i *= 0x6935fa69;
+    i ^= (i & w) >> 11;
+    i *= 0x74dcb303;
+    i ^= (i & w) >> 2;
+    i *= 0x9e501cc3;
+    i ^= (i & w) >> 2;
+    i *= 0xc860a3df;
+    i &= w;
+    i ^= i >> 5;
+  } while (i >= l);
+  return (i + p) % l;
+}
+
+// Uncorrelated random numbers, how main() always sampled.
+class independent_sampler : public sampler {
+public:
+  virtual double get_1d() override { return random_double(); }
+
+  virtual void get_2d(double& u, double& v) override {
+    u = random_double();
+    v = random_double();
+  }
+};
+
+// The first two Sobol dimensions with hash based Owen scrambling, following
+// Burley's "Practical Hash-based Owen Scrambling" (JCGT 2020). Each requested
+// dimension pair gets its own shuffle of the sample order and its own
+// scramble, which keeps every pair well stratified and progressive.
+class sobol_sampler : public sampler {
+public:
+  sobol_sampler(uint32_t s = 0) : seed(s) {}
+
+  virtual double get_1d() override {
+    auto pixel_seed = hash_combine(seed_for(dimension++), 0x51633e2d);
+    auto index = nested_uniform_scramble(sample_index, pixel_seed);
+    return to_unit(nested_uniform_scramble(sobol(index, 0), hash_uint(pixel_seed)));
+  }
+
+  virtual void get_2d(double& u, double& v) override {
+    auto pixel_seed = seed_for(dimension);
+    dimension += 2;
+    auto index = nested_uniform_scramble(sample_index, pixel_seed);
+    u = to_unit(nested_uniform_scramble(sobol(index, 0), hash_combine(pixel_seed, 0)));
+    v = to_unit(nested_uniform_scramble(sobol(index, 1), hash_combine(pixel_seed, 1)));
+  }
+
+  static uint32_t sobol(uint32_t index, int dim) {
+    if (dim == 0)
+      return reverse_bits(index);
+
+    // The second Sobol dimension, generated by the upper triangular Pascal
+    // matrix.
+    uint32_t v = 1u << 31;
+    uint32_t result = 0;
+    for (; index; index >>= 1, v ^= v >> 1) {
+      if (index & 1)
+        result ^= v;
+    }
+    return result;
+  }
+
+  static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return x;
+  }
+
+  static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x = laine_karras_permutation(x, seed);
+    return reverse_bits(x);
+  }
+
+protected:
+  virtual uint32_t seed_for(int dim) const {
+    return hash_combine(pixel_hash(pixel_x, pixel_y, dim), seed);
+  }
+
+  uint32_t seed;
+};
+
+// Jittered strata: every dimension of a pixel is split into samples_per_pixel
+// strata (a grid for 2D dimensions) visited in a per-pixel random order.
+// Samples past samples_per_pixel, which adaptive sampling, resumed renders
+// and temporal accumulation ask for, continue as a scrambled Sobol sequence
+// instead of visiting the strata again.
+class stratified_sampler : public sampler {
+public:
+  stratified_sampler(int samples_per_pixel)
+    : spp(std::max(samples_per_pixel, 1)), beyond(0x68bc21eb) {
+    nx = static_cast<int>(sqrt(double(spp)));
+    ny = (spp + nx - 1) / nx;
+  }
+
+  virtual void start_sample(int i, int j, int index) override {
+    sampler::start_sample(i, j, index);
+    if (index >= spp)
+      beyond.start_sample(i, j, index - spp);
+  }
+
+  virtual double get_1d() override {
+    if (sample_index >= spp) {
+      dimension++;
+      return beyond.get_1d();
+    }
+    auto seed = pixel_hash(pixel_x, pixel_y, dimension++);
+    auto stratum = permute(sample_index, spp, seed);
+    return (stratum + to_unit(hash_combine(seed, sample_index))) / spp;
+  }
+
+  virtual void get_2d(double& u, double& v) override {
+    if (sample_index >= spp) {
+      dimension += 2;
+      beyond.get_2d(u, v);
+      return;
+    }
+    auto seed = pixel_hash(pixel_x, pixel_y, dimension);
+    dimension += 2;
+    auto cell = permute(sample_index, nx*ny, seed);
+    u = (cell % nx + to_unit(hash_combine(seed, 2*sample_index))) / nx;
+    v = (cell / nx + to_unit(hash_combine(seed, 2*sample_index + 1))) / ny;
+  }
+
+private:
+  int spp, nx, ny;
+  sobol_sampler beyond;
+};
+
+// Radical inverses in successive prime bases, decorrelated between pixels by
+// a random toroidal shift. Dimensions past the prime table fall back to
+// independent numbers.
+class halton_sampler : public sampler {
+public:
+  virtual double get_1d() override {
+    int dim = dimension++;
+    if (dim >= prime_count)
+      return random_double();
+
+    auto x = radical_inverse(dim, sample_index + 1)
+      + to_unit(pixel_hash(pixel_x, pixel_y, dim));
+    return x - floor(x);
+  }
+
+  virtual void get_2d(double& u, double& v) override {
+    u = get_1d();
+    v = get_1d();
+  }
+
+  static double radical_inverse(int base_index, uint64_t a) {
+    const uint64_t base = primes[base_index];
+    const double inv_base = 1.0 / base;
+    uint64_t reversed = 0;
+    double inv_base_n = 1;
+    while (a) {
+      uint64_t next = a / base;
+      uint64_t digit = a - next * base;
+      reversed = reversed * base + digit;
+      inv_base_n *= inv_base;
+      a = next;
+    }
+    return fmin(reversed * inv_base_n, 1 - 1e-16);
+  }
+
+private:
+  static const int prime_count = 32;
+  static const int primes[prime_count];
+};
+
+const int halton_sampler::primes[halton_sampler::prime_count] = {
+  2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+  59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+};
+
+// A tileable blue noise threshold mask made with Ulichney's void-and-cluster
+// method, ranked into values in [0,1).
+class blue_noise_mask {
+public:
+  static const int size = 64;
+
+  blue_noise_mask() : values(size*size) {
+    const int n = size*size;
+    const double sigma = 1.5;
+
+    // Toroidal gaussian energy kernel.
+    std::vector<double> kernel(n);
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++) {
+        auto dx = std::min(x, size - x);
+        auto dy = std::min(y, size - y);
+        kernel[y*size + x] = exp(-(dx*dx + dy*dy) / (2*sigma*sigma));
+      }
+    }
+
+    std::vector<bool> on(n, false);
+    std::vector<double> energy(n, 0.0);
+    auto toggle = [&](int p, bool set) {
+      on[p] = set;
+      int px = p % size, py = p / size;
+      for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+          auto k = kernel[((y - py + size) % size)*size + (x - px + size) % size];
+          energy[y*size + x] += set ? k : -k;
+        }
+      }
+    };
+    auto tightest_cluster = [&]() {
+      int best = -1;
+      for (int p = 0; p < n; p++)
+        if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+      return best;
+    };
+    auto largest_void = [&]() {
+      int best = -1;
+      for (int p = 0; p < n; p++)
+        if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+      return best;
+    };
+
+    // Initial pattern: random points, relaxed by moving the point in the
+    // tightest cluster into the largest void until that stops changing it.
+    // The points come from a generator of their own, so the mask is the same
+    // in every run, whenever the first sample builds it.
+    std::mt19937 generator(1);
+    int initial = n / 10;
+    for (int placed = 0; placed < initial; ) {
+      int p = int(generator() % n);
+      if (!on[p]) {
+        toggle(p, true);
+        placed++;
+      }
+    }
+    for (int iteration = 0; iteration < n; iteration++) {
+      int cluster = tightest_cluster();
+      toggle(cluster, false);
+      int hole = largest_void();
+      toggle(hole, true);
+      if (hole == cluster)
+        break;
+    }
+
+    // Rank the initial points by removing clusters, then fill voids.
+    std::vector<int> rank(n, 0);
+    auto saved_on = on;
+    auto saved_energy = energy;
+    for (int r = initial - 1; r >= 0; r--) {
+      int cluster = tightest_cluster();
+      toggle(cluster, false);
+      rank[cluster] = r;
+    }
+    on = saved_on;
+    energy = saved_energy;
+    for (int r = initial; r < n; r++) {
+      int hole = largest_void();
+      toggle(hole, true);
+      rank[hole] = r;
+    }
+
+    for (int p = 0; p < n; p++)
+      values[p] = (rank[p] + 0.5) / n;
+  }
+
+  double value(int x, int y) const {
+    return values[(y & (size-1))*size + (x & (size-1))];
+  }
+
+private:
+  std::vector<double> values;
+};
+
+// Blue noise dithered sampling (Georgiev & Fajardo 2016): every pixel uses the
+// same Owen-scrambled Sobol points, toroidally shifted by a blue noise mask
+// offset per dimension, so the error left at low spp is blue noise across
+// the image instead of white noise.
+class blue_noise_sampler : public sobol_sampler {
+public:
+  blue_noise_sampler() : sobol_sampler(0x2545f491) {}
+
+  virtual double get_1d() override {
+    int dim = dimension;
+    return shift(sobol_sampler::get_1d(), dim);
+  }
+
+  virtual void get_2d(double& u, double& v) override {
+    int dim = dimension;
+    sobol_sampler::get_2d(u, v);
+    u = shift(u, dim);
+    v = shift(v, dim + 1);
+  }
+
+protected:
+  // The same sequence for every pixel, the mask decorrelates them.
+  virtual uint32_t seed_for(int dim) const override {
+    return hash_combine(hash_uint(dim), seed);
+  }
+
+private:
+  double shift(double x, int dim) const {
+    // Offset the mask per dimension so dimensions are not correlated.
+    auto ox = hash_uint(2*dim) % blue_noise_mask::size;
+    auto oy = hash_uint(2*dim + 1) % blue_noise_mask::size;
+    x += mask().value(pixel_x + ox, pixel_y + oy);
+    return x >= 1 ? x - 1 : x;
+  }
+
+  static const blue_noise_mask& mask() {
+    static blue_noise_mask m;
+    return m;
+  }
+};
+
+const char* sampler_names[] = { "independent", "stratified", "sobol", "halton", "bluenoise" };
+
+shared_ptr<sampler> make_sampler(const std::string& name, int samples_per_pixel) {
+  if (name == "stratified") return make_shared<stratified_sampler>(samples_per_pixel);
+  if (name == "sobol") return make_shared<sobol_sampler>();
+  if (name == "halton") return make_shared<halton_sampler>();
+  if (name == "bluenoise") return make_shared<blue_noise_sampler>();
+  if (name != "independent")
+    std::cerr << "Unknown sampler '" << name << "', using independent.\n";
+  return make_shared<independent_sampler>();
+}
+
+#endif
@@ -0,0 +1,547 @@
+#ifndef SCENES_HPP
+#define SCENES_HPP
+
+#include "rtweekend.hpp"
+
+#include "hittable_list.hpp"
+#include "sphere.hpp"
+#include "moving_sphere.hpp"
+#include "triangle.hpp"
+#include "camera.hpp"
+#include "material.hpp"
+#include "bvh.hpp"
+#include "aarect.hpp"
+#include "box.hpp"
+#include "constant_medium.hpp"
+#include "grid_medium.hpp"
+#include "texture_cache.hpp"
+
+hittable_list refractive_dielectrics() {
+  hittable_list world;
+
+  // This looks funny on reflection and the dielectric isn't being reflected, why?
+  auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
+  auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
+  auto material_left   = make_shared<dielectric>(1.5);
+  auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
+
+  world.add(make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
+  world.add(make_shared<sphere>(point3( 0.0,    0.0, -1.0),   0.5, material_center));
+  world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
+  world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),  -0.45, material_left));
+  world.add(make_shared<sphere>(point3( 1.0,    0.0, -1.0),   0.5, material_right));
+
+  return world;
+}
+
+hittable_list camera_fov_test() {
+  hittable_list world;
+
+  auto R = cos(pi/4);
+  auto material_left  = make_shared<lambertian>(color(0,0,1));
+  auto material_right = make_shared<lambertian>(color(1,0,0));
+
+  world.add(make_shared<sphere>(point3(-R, 0, -1), R, material_left));
+  world.add(make_shared<sphere>(point3( R, 0, -1), R, material_right));
+
+  return world;
+}
+
+hittable_list two_spheres() {
+  hittable_list objects;
+
+  auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+
+  objects.add(make_shared<sphere>(point3(0,-10, 0), 10, make_shared<lambertian>(checker)));
+  objects.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
+
+  return objects;
+}
+
+hittable_list two_perlin_spheres() {
+  hittable_list objects;
+
+  auto perlin_text = make_shared<noise_texture>(4);
+
+  objects.add(make_shared<sphere>(point3(0,-1000,0), 1000,
+                                  make_shared<lambertian>(perlin_text)));
+  objects.add(make_shared<sphere>(point3(0,2,0), 2,
+                                  make_shared<lambertian>(perlin_text)));
+
+  return objects;
+}
+
+hittable_list random_scene() {
+  hittable_list world;
+
+  auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9,0.9,0.9));
+  auto ground_material = make_shared<lambertian>(checker);
+  world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+  for (int a = -11; a < 11; a++) {
+    for (int b = -11; b < 11; b++) {
+      auto choose_mat = random_double();
+      point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+      if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+        shared_ptr<material> sphere_material;
+
+        if (choose_mat < 0.8) {
+          // diffuse
+          auto albedo = color::random() * color::random();
+          sphere_material = make_shared<lambertian>(albedo);
+          auto center2 = center + vec3(0, random_double(0, 0.5), 0);
+          world.add(make_shared<moving_sphere>(center, center2, 0.0, 1.0,
+                                               0.2, sphere_material));
+        } else if (choose_mat < 0.95) {
+          // metal
+          auto albedo = color::random(0.5, 1);
+          auto fuzz = random_double(0, 0.5);
+          sphere_material = make_shared<metal>(albedo, fuzz);
+          world.add(make_shared<sphere>(center, 0.2, sphere_material));
+        } else {
+          // glass
+          sphere_material = make_shared<dielectric>(1.5);
+          world.add(make_shared<sphere>(center, 0.2, sphere_material));
+        }
+      }
+    }
+  }
+
+  auto material1 = make_shared<dielectric>(1.5);
+  world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+  auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+  world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+  auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+  world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+  return world;
+}
+
+hittable_list earth() {
+  auto earth_texture = texture_cache::global().load("images/earthmap.jpg");
+  auto earth_surface = make_shared<lambertian>(earth_texture);
+  auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
+
+  return hittable_list(globe);
+}
+
+hittable_list simple_light() {
+  hittable_list objects;
+  auto pertext = make_shared<noise_texture>(4);
+
+  objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
+  objects.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
+
+  auto difflight = make_shared<diffuse_light>(color(4.0,4.0,4.0));
+  objects.add(make_shared<xy_rect>(3,5,1,3,-2, difflight));
+  // optional overhead light
+  auto difflight2 = make_shared<diffuse_light>(color(0.5,0.0,0.0));
+  objects.add(make_shared<sphere>(point3(0,7,0), 1, difflight2));
+
+  return objects;
+}
+
+hittable_list cornell_box() {
+  hittable_list objects;
+
+  auto red   = make_shared<lambertian>(color(.65, .05, .05));
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  auto green = make_shared<lambertian>(color(.12, .45, .15));
+  auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+  // X is the intuitive direction
+  // Y is up
+  // Z is in
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+  objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+  objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+  shared_ptr<hittable> back_box =
+    make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+  back_box = make_shared<rotate_y>(back_box, 15);
+  back_box = make_shared<translate>(back_box, point3(265, 0, 295));
+  objects.add(back_box);
+
+  shared_ptr<hittable> front_box =
+    make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
+  front_box = make_shared<rotate_y>(front_box, -18);
+  front_box = make_shared<translate>(front_box, vec3(130,0,65));
+  objects.add(front_box);
+
+  return objects;
+}
+
+hittable_list cornell_smoke() {
+  hittable_list objects;
+
+  auto red   = make_shared<lambertian>(color(.65, .05, .05));
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  auto green = make_shared<lambertian>(color(.12, .45, .15));
+  auto light = make_shared<diffuse_light>(color(7, 7, 7));
+
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+  objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+  objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+  shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
+  box1 = make_shared<rotate_y>(box1, 15);
+  box1 = make_shared<translate>(box1, vec3(265,0,295));
+
+  shared_ptr<hittable> box2 = make_shared<box>(point3(0,0,0), point3(165,165,165), white);
+  box2 = make_shared<rotate_y>(box2, -18);
+  box2 = make_shared<translate>(box2, vec3(130,0,65));
+
+  objects.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
+  objects.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
+
+  return objects;
+}
+
+hittable_list final_scene() {
+  hittable_list boxes1;
+  auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+
+  // floor cubes, 20x20
+  const int boxes_per_side = 20;
+  for (int i = 0; i < boxes_per_side; i++) {
+    for (int j = 0; j < boxes_per_side; j++) {
+      auto w = 100.0;
+      auto x0 = -1000.0 + i*w;
+      auto z0 = -1000.0 + j*w;
+      auto y0 = 0.0;
+      auto x1 = x0 + w;
+      auto y1 = random_double(1,101);
+      auto z1 = z0 + w;
+
+      boxes1.add(make_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+    }
+  }
+
+  hittable_list objects;
+
+  objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+
+  // light up top
+  auto light = make_shared<diffuse_light>(color(7, 7, 7));
+  objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+
+  // copper moving sphere
+  auto center1 = point3(400, 400, 200);
+  auto center2 = center1 + vec3(30,0,0);
+  auto moving_sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
+  objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+  // transparent globe
+  objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
+  // lower right metal sphere
+  objects.add(make_shared<sphere>(
+                                  point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
+                                  ));
+
+  // blue metal ball
+  auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
+  objects.add(boundary);
+  objects.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+  // unknown
+  boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
+  objects.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
+
+  // earthglobe
+  auto emat = make_shared<lambertian>(texture_cache::global().load("images/earthmap.jpg"));
+  objects.add(make_shared<sphere>(point3(400,200,400), 100, emat));
+  auto pertext = make_shared<noise_texture>(0.1);
+  objects.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
+
+  // cube of spheres
+  hittable_list boxes2;
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  int ns = 1000;
+  for (int j = 0; j < ns; j++) {
+    boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
+  }
+
+  objects.add(make_shared<translate>(make_shared<rotate_y>(make_shared<bvh_node>(boxes2, 0.0, 1.0), 15), vec3(-100,270,395)));
+
+  return objects;
+}
+
+hittable_list ghost_scene() {
+  hittable_list boxes1;
+  auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+
+  // floor cubes, 20x20
+  const int boxes_per_side = 20;
+  for (int i = 0; i < boxes_per_side; i++) {
+    for (int j = 0; j < boxes_per_side; j++) {
+      auto w = 100.0;
+      auto x0 = -1000.0 + i*w;
+      auto z0 = -1000.0 + j*w;
+      auto y0 = 0.0;
+      auto x1 = x0 + w;
+      auto y1 = random_double(1,101);
+      auto z1 = z0 + w;
+
+      boxes1.add(make_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+    }
+  }
+
+  hittable_list objects;
+
+  objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+
+  // light up top
+  auto light = make_shared<diffuse_light>(color(7, 7, 7));
+  objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+
+  // transparent globe
+  // objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
+
+  // unknown
+  auto boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
+  objects.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
+
+  auto pertext = make_shared<noise_texture>(0.2);
+  objects.add(make_shared<sphere>(point3(220,360,300), 80, make_shared<lambertian>(pertext)));
+  auto head_cover = make_shared<sphere>(point3(220, 360, 300), 82, make_shared<dielectric>(1.5));
+  objects.add(make_shared<constant_medium>(head_cover, .0001, color(.33,.33,.66)));
+
+  // alternatively make smaller variations on the head as moving spheres of the same size to make a cylindrical body
+
+  // body
+  hittable_list boxes2;
+  int ns = 120;
+  for (int j = 0; j < ns; j++) {
+    auto c = make_shared<lambertian>(color(.33, .33, .66)*random_double(0.6,1.1));
+    auto pos = vec3(random_double(20, 140), random_double(0, 220), random_double(20, 140));
+    auto pos2 = pos + vec3(0,-random_double(5, 20),0);
+    boxes2.add(make_shared<moving_sphere>(pos,pos2, 0, 1, 20, c));
+  }
+
+  objects.add(make_shared<translate>(make_shared<rotate_y>(make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
+                                     vec3(140,120,220)));
+
+  return objects;
+}
+
+hittable_list triangle_test() {
+  hittable_list world;
+
+  point3 origin = point3(0,0,0);
+  point3 a = point3(0,10,0);
+  point3 b = point3(-10,0,0);
+  point3 c = point3(0,0,-10);
+  point3 d = origin;
+
+  // auto ground = make_shared<lambertian>(color(0.5, 0.0, 0.0));
+  // world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground));
+
+  // Consider rendering the expected normal of the entire triangle as a box in the example?
+  auto a_color = make_shared<lambertian>(color(1.0,0.0,0.0));
+  auto b_color = make_shared<lambertian>(color(0.0,1.0,0.0));
+  auto c_color = make_shared<lambertian>(color(0.0,0.0,1.0));
+  auto d_color = make_shared<lambertian>(color(0.0,0.5,0.5));
+  world.add(make_shared<sphere>(a, 1, a_color));
+  world.add(make_shared<sphere>(b, 1, b_color));
+  world.add(make_shared<sphere>(c, 1, c_color));
+  world.add(make_shared<sphere>(d, 1, d_color));
+  auto tex0 = make_shared<lambertian>(color(0.0, 1.0, 0.0));
+  world.add(make_shared<triangle>(d,a,b, tex0)); // in z-plane
+  auto tex1 = make_shared<lambertian>(color(0.0, 0.0, 1.0));
+  world.add(make_shared<triangle>(d,c,b, tex1)); // in y-plane
+  auto tex2 = make_shared<lambertian>(color(0.5, 0.0, 1.0));
+  world.add(make_shared<triangle>(d,c,a, tex2)); // in x-plane
+
+  auto light = make_shared<diffuse_light>(color(1.0,1.0,1.0));
+  world.add(make_shared<sphere>(point3(-20,0,-20), 10, light));
+
+  return world;
+}
+
+hittable_list st_patricks_test() {
+  hittable_list world;
+
+  auto green = make_shared<lambertian>(color(0.1, 0.8, 0.2));
+  auto orange = make_shared<lambertian>(color(0.6, 0.3, 0.0));
+
+  auto light = make_shared<diffuse_light>(color(1.0,1.0,1.0));
+  world.add(make_shared<sphere>(point3(30,0,-20), 10, light));
+
+  point3 base = point3(0.0, 0.0, 0.0);
+  world.add(make_shared<sphere>(base, 0.5, green));
+
+  float r = 15.0;
+  float width = 0.7;
+  for(float theta = 0.0; theta < 1.5*pi; theta += pi/2) {
+    for(float t = theta; t <= (theta + width); t += width / 2) {
+      point3 start = point3(r * cos(t), r*sin(t), 0.0);
+      point3 end = point3(r * cos(t+width), r*sin(t+width), 5.0);
+      world.add(make_shared<triangle>(base, start, end, green));
+      world.add(make_shared<sphere>(start, 0.5, green));
+      world.add(make_shared<sphere>(end, 0.5, orange));
+    }
+  }
+
+  return world;
+}
+
+// Diffuse, glossy and glass spheres on a plain floor, meant to be lit by an
+// HDR environment map.
+hittable_list sunlit_spheres() {
+  hittable_list world;
+
+  world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+  world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+  world.add(make_shared<sphere>(point3( 0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
+  world.add(make_shared<sphere>(point3( 4, 1, 0), 1.0, make_shared<metal>(color(0.7, 0.6, 0.5), 0.3)));
+
+  return world;
+}
+
+// A dim cornell box lit only by a few thousand small lights scattered over
+// the ceiling and walls, to exercise sampling many emitters.
+hittable_list many_lights() {
+  hittable_list objects;
+
+  auto red   = make_shared<lambertian>(color(.65, .05, .05));
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  auto green = make_shared<lambertian>(color(.12, .45, .15));
+
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+  objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+  const int lights = 2000;
+  for (int i = 0; i < lights; i++) {
+    auto emit = make_shared<diffuse_light>(color::random(0.5, 1) * 40);
+    if (i % 2 == 0) {
+      auto x = random_double(10, 540);
+      auto z = random_double(10, 540);
+      objects.add(make_shared<xz_rect>(x, x+4, z, z+4, 554, emit));
+    } else {
+      auto center = point3(random_double(10, 545), random_double(10, 545), random_double(300, 545));
+      objects.add(make_shared<sphere>(center, 1.5, emit));
+    }
+  }
+
+  shared_ptr<hittable> block = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+  block = make_shared<rotate_y>(block, 15);
+  block = make_shared<translate>(block, vec3(265, 0, 295));
+  objects.add(block);
+
+  return objects;
+}
+
+// The Cornell box with a glass ball in front of the tall block, which focuses
+// the ceiling light into a caustic on the floor.
+hittable_list cornell_glass() {
+  hittable_list objects;
+
+  auto red   = make_shared<lambertian>(color(.65, .05, .05));
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  auto green = make_shared<lambertian>(color(.12, .45, .15));
+  auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+  objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+  objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+  shared_ptr<hittable> block = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+  block = make_shared<rotate_y>(block, 15);
+  block = make_shared<translate>(block, vec3(265, 0, 295));
+  objects.add(block);
+
+  objects.add(make_shared<sphere>(point3(190, 120, 190), 90, make_shared<dielectric>(1.5)));
+
+  return objects;
+}
+
+// A Cornell box split by a wall with a doorway, lit only from the ceiling of
+// the back room, so the room in front sees the light through the door.
+hittable_list light_through_door() {
+  hittable_list objects;
+
+  auto red   = make_shared<lambertian>(color(.65, .05, .05));
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  auto green = make_shared<lambertian>(color(.12, .45, .15));
+  auto light = make_shared<diffuse_light>(color(40, 40, 40));
+
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+  objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+  objects.add(make_shared<xz_rect>(150, 400, 430, 530, 554, light));
+
+  // The dividing wall, with a doorway at 330 < x < 430 below y = 220.
+  objects.add(make_shared<xy_rect>(0, 330, 0, 555, 380, white));
+  objects.add(make_shared<xy_rect>(430, 555, 0, 555, 380, white));
+  objects.add(make_shared<xy_rect>(330, 430, 220, 555, 380, white));
+
+  shared_ptr<hittable> block = make_shared<box>(point3(0, 0, 0), point3(120, 120, 120), white);
+  block = make_shared<rotate_y>(block, -18);
+  block = make_shared<translate>(block, vec3(120, 0, 150));
+  objects.add(block);
+
+  return objects;
+}
+
+// Two procedural clouds in a Cornell box: turbulent noise inside a ball,
+// cut off at a threshold so the outside is empty. One is kept in a dense
+// grid, the other in a sparse brick grid.
+hittable_list cornell_clouds() {
+  hittable_list objects;
+
+  auto red   = make_shared<lambertian>(color(.65, .05, .05));
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  auto green = make_shared<lambertian>(color(.12, .45, .15));
+  auto light = make_shared<diffuse_light>(color(7, 7, 7));
+
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+  objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+  objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+  objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+  objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+  const int n = 64;
+  auto noise = make_shared<perlin>();
+  auto cloud = [noise](int i, int j, int k) {
+    point3 p((i + 0.5) / n * 2 - 1, (j + 0.5) / n * 2 - 1, (k + 0.5) / n * 2 - 1);
+    auto f = 1 - p.length() + 0.5 * noise->turbulence(4 * p);
+    return float(f > 0.25 ? 2 * (f - 0.25) : 0);
+  };
+
+  auto dense = make_shared<dense_grid>(n, n, n, cloud);
+  objects.add(make_shared<grid_medium>(dense, aabb(point3(40, 60, 200), point3(280, 300, 440)),
+                                       0.05, color(.9, .9, .9)));
+
+  auto sparse = make_shared<brick_grid>(n, n, n, cloud);
+  objects.add(make_shared<grid_medium>(sparse, aabb(point3(300, 20, 150), point3(520, 240, 370)),
+                                       0.05, color(.8, .6, .4)));
+
+  return objects;
+}
+
+camera camera_at(const point3 &lookfrom, const point3 &lookat,
+                 double aspect_ratio, double fov, double aperture) {
+  vec3 vup(0,1,0);
+  auto dist_to_focus = 10.0;
+
+  return camera(lookfrom, lookat, vup, fov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
+}
+
+#endif
@@ -2,6 +2,9 @@
 #define SPHERE_H
 
 #include "hittable.hpp"
+#include "material.hpp"
+#include "onb.hpp"
+#include "pdf.hpp"
 #include "vec3.hpp"
 
 class sphere : public hittable {
@@ -12,6 +15,41 @@ public:
 
   virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const override;
   virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+  virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+  virtual double pdf_value(const point3& o, const vec3& v) const override;
+  virtual vec3 random(const point3& o) const override;
+  virtual bool is_light() const override { return mat_ptr->is_emitter(); }
+  virtual double area() const override { return 4*pi*radius*radius; }
+
+  virtual bool sample_surface(double u1, double u2, double time, hit_record& rec) const override {
+    auto outward_normal = uniform_sphere(u1, u2);
+    rec.p = center + radius * outward_normal;
+    rec.normal = outward_normal;
+    rec.front_face = true;
+    get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat_ptr = mat_ptr;
+    return true;
+  }
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    slots.push_back(&mat_ptr);
+  }
+
+  virtual bool inside(const ray& r, double& t_enter, double& t_exit) const override {
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant <= 0)
+      return false;
+
+    auto root = sqrt(discriminant);
+    t_enter = (-half_b - root) / a;
+    t_exit = (-half_b + root) / a;
+    return true;
+  }
 
 public:
   point3 center;
@@ -27,12 +65,22 @@ private:
     //    <0 1 0> yields <0.50 1.00>         < 0 -1  0> yields <0.50 0.00>
     //    <0 0 1> yields <0.25 0.50>         < 0  0 -1> yields <0.75 0.50>
 
-    auto theta = acos(-p.y());
-    auto phi = atan2(-p.z(), p.x()) + pi;
+    auto theta = shading_acos(-p.y());
+    auto phi = shading_atan2(-p.z(), p.x()) + pi;
 
     u = phi / (2*pi);
     v = theta / pi;
   }
+
+  // Derivatives of a point p relative to the center with the u and v above.
+  static void get_sphere_partials(const vec3& p, vec3& dpdu, vec3& dpdv) {
+    auto rho = sqrt(p.x()*p.x() + p.z()*p.z());
+    dpdu = 2*pi * vec3(p.z(), 0, -p.x());
+    if (rho > 0)
+      dpdv = pi * vec3(-p.x()*p.y() / rho, rho, -p.y()*p.z() / rho);
+    else
+      dpdv = vec3(0,0,0);
+  }
 };
 
 // Profiling says this is 25% of program time
@@ -53,6 +101,7 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
       vec3 outward_normal = (rec.p - center) / radius;
       rec.set_face_normal(r, outward_normal);
       get_sphere_uv(outward_normal, rec.u, rec.v);
+      get_sphere_partials(rec.p - center, rec.dpdu, rec.dpdv);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -64,6 +113,7 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
       vec3 outward_normal = (rec.p - center) / radius;
       rec.set_face_normal(r, outward_normal);
       get_sphere_uv(outward_normal, rec.u, rec.v);
+      get_sphere_partials(rec.p - center, rec.dpdu, rec.dpdv);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -72,6 +122,55 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
   return false;
 }
 
+bool sphere::occluded(const ray& r, double t_min, double t_max) const {
+  vec3 oc = r.origin() - center;
+  auto a = r.direction().length_squared();
+  auto half_b = dot(oc, r.direction());
+  auto c = oc.length_squared() - radius*radius;
+  auto discriminant = half_b*half_b - a*c;
+
+  if (discriminant <= 0)
+    return false;
+
+  auto root = sqrt(discriminant);
+  auto temp = (-half_b - root) / a;
+  if (temp < t_max && temp > t_min)
+    return true;
+
+  temp = (-half_b + root) / a;
+  return temp < t_max && temp > t_min;
+}
+
+// Samples the cone of directions subtended by the sphere, which is only
+// defined from outside of it.
+double sphere::pdf_value(const point3& o, const vec3& v) const {
+  auto distance_squared = (center - o).length_squared();
+  if (distance_squared <= radius*radius || !occluded(ray(o, v), 0.001, infinity))
+    return 0;
+
+  auto cos_theta_max = sqrt(1 - radius*radius/distance_squared);
+  auto solid_angle = 2*pi*(1-cos_theta_max);
+
+  return 1 / solid_angle;
+}
+
+vec3 sphere::random(const point3& o) const {
+  vec3 direction = center - o;
+  auto distance_squared = direction.length_squared();
+  if (distance_squared <= radius*radius)
+    return direction;
+
+  onb uvw;
+  uvw.build_from_w(direction);
+  vec3 to_surface = uvw.local(random_to_sphere(radius, distance_squared));
+
+  // Scale to the near intersection, so the sampled point lies at t = 1.
+  hit_record rec;
+  if (!hit(ray(o, to_surface), 0.001, infinity, rec))
+    return direction;
+  return rec.t * to_surface;
+}
+
 bool sphere::bounding_box(double time0, double time1, aabb& output_box) const {
   output_box = aabb(center - vec3(radius, radius, radius),
                     center + vec3(radius, radius, radius));
@@ -0,0 +1,267 @@
+#ifndef TEMPORAL_HPP
+#define TEMPORAL_HPP
+
+#include "rtweekend.hpp"
+
+#include "aov.hpp"
+#include "camera.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "image_output.hpp"
+#include "parallel.hpp"
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Temporal accumulation for camera animations of a static scene: every
+// pixel keeps the mean of the samples it has taken so far together with the
+// first hit of the ray through its center. A pixel of the next frame whose
+// first hit the previous frame saw, as the position projected through the
+// previous camera says, with the same surface there by a plane and normal
+// test, starts from that history and takes only reuse_spp new samples.
+// Disoccluded pixels, and those that see the sky, take full_spp. History
+// counts for at most max_history samples, so view dependent shading, which
+// the tests cannot see, fades out instead of smearing, and is clipped to
+// the range of the new samples around it.
+//
+// What is kept is the light divided by the albedo at the first hit, which
+// every frame multiplies back by its own, as in "Spatiotemporal
+// Variance-Guided Filtering" (Schied et al. 2017): resampling history blurs
+// it, and the light is smooth where the textures are not. Reused pixels take
+// their albedo from the first hits alone of full_spp samples, a fraction of
+// the cost of their paths, so textures stay as sharp as in a full render.
+class temporal_accumulator {
+public:
+  temporal_accumulator(int w, int h, int reuse, int full, int max_history)
+    : width(w), height(h), reuse_spp(std::max(reuse, 1)), full_spp(std::max(full, 1)),
+      history_limit(std::max(max_history, 1)), has_previous(false),
+      previous_cam(point3(0,0,0), point3(0,0,-1), vec3(0,1,0), 90, 1, 0, 1),
+      history(size_t(w) * h), frames(0), reused(0), samples(0) {}
+
+  // Renders the next frame from cam. sample(i, j, index, s, aov) traces
+  // sample number index of pixel (i, j) with s, row 0 at the bottom, through
+  // world, and fills in aov.
+  float_image render(const camera& cam, const hittable& world,
+                     const std::function<shared_ptr<sampler>()>& make_sampler,
+                     const std::function<color(int, int, int, sampler&, aov_sample*)>& sample);
+
+  // Of the last frame rendered.
+  double reused_fraction() const { return double(reused) / history.size(); }
+  double average_spp() const { return double(samples) / history.size(); }
+
+private:
+  struct pixel {
+    color mean;                  // of the light over the albedo
+    double weight = 0;           // samples the mean stands for
+    std::uint32_t next_index = 0;
+    bool hit = false;
+    point3 p;
+    vec3 normal;
+    const material* mat = nullptr;
+
+    // This frame's samples.
+    color light;
+    color albedo;
+    int count = 0;
+  };
+
+  // The history at continuous pixel position (x, y) of the previous frame,
+  // rows from the top, for the first hit of px at distance: the
+  // neighbours that pass the tests, blended by a Catmull-Rom filter, which
+  // blurs less than a bilinear one over many frames. False if most of the
+  // nearest four fail them.
+  bool reproject(double x, double y, double distance, pixel& px) const;
+
+  // The albedo sample number index of pixel (i, j) meets first, with the
+  // same pixel and lens positions as sample_pixel() draws.
+  color first_hit_albedo(int i, int j, int index, const camera& cam, const hittable& world,
+                         const ray_differential& differential, sampler& s) const;
+
+  int width, height, reuse_spp, full_spp, history_limit;
+  bool has_previous;
+  camera previous_cam;
+  std::vector<pixel> history;
+  int frames;    // rendered, which with the row seeds the generator of a row
+  long reused, samples;
+};
+
+bool temporal_accumulator::reproject(double x, double y, double distance, pixel& px) const {
+  int x0 = int(std::floor(x)), y0 = int(std::floor(y));
+  double fx = x - x0, fy = y - y0;
+  auto catmull_rom = [](double t, double* w) {
+    auto t2 = t*t, t3 = t2*t;
+    w[0] = 0.5 * (-t3 + 2*t2 - t);
+    w[1] = 0.5 * (3*t3 - 5*t2 + 2);
+    w[2] = 0.5 * (-3*t3 + 4*t2 + t);
+    w[3] = 0.5 * (t3 - t2);
+  };
+  double wx[4], wy[4];
+  catmull_rom(fx, wx);
+  catmull_rom(fy, wy);
+
+  color mean(0,0,0);
+  double coverage = 0, weight = 0, bilinear = 0;
+  std::uint32_t next_index = 0;
+  for (int ty = y0 - 1; ty <= y0 + 2; ty++) {
+    for (int tx = x0 - 1; tx <= x0 + 2; tx++) {
+      auto w = wx[tx - x0 + 1] * wy[ty - y0 + 1];
+      if (tx < 0 || ty < 0 || tx >= width || ty >= height)
+        continue;
+      const auto& h = history[size_t(ty) * width + tx];
+      // The same surface: of the same material, on the plane of the new hit
+      // and facing the same way.
+      if (!h.hit || h.mat != px.mat || fabs(dot(h.p - px.p, px.normal)) > 0.01 * distance
+          || dot(h.normal, px.normal) < 0.9)
+        continue;
+      mean += w * h.mean;
+      coverage += w;
+      if (tx >= x0 && tx <= x0 + 1 && ty >= y0 && ty <= y0 + 1) {
+        auto b = (tx == x0 ? 1 - fx : fx) * (ty == y0 ? 1 - fy : fy);
+        weight += b * h.weight;
+        bilinear += b;
+        next_index = std::max(next_index, h.next_index);
+      }
+    }
+  }
+  if (bilinear < 0.5 || coverage < 0.5)
+    return false;
+
+  px.mean = mean / coverage;
+  for (int c = 0; c < 3; c++)
+    px.mean[c] = std::max(px.mean[c], 0.0);
+  px.weight = std::min(weight, double(history_limit));
+  px.next_index = next_index;
+  return true;
+}
+
+color temporal_accumulator::first_hit_albedo(int i, int j, int index, const camera& cam,
+                                            const hittable& world,
+                                            const ray_differential& differential,
+                                            sampler& s) const {
+  s.start_sample(i, j, index);
+  double du, dv, lens_u, lens_v;
+  s.get_2d(du, dv);
+  s.get_2d(lens_u, lens_v);
+  auto shutter = s.get_1d();
+
+  ray r = cam.get_ray(double(i + du) / (width-1), double(j + dv) / (height-1), lens_u, lens_v,
+                      shutter);
+  hit_record rec;
+  if (!world.hit(r, 0.001, infinity, rec))
+    return color(1,1,1);
+  compute_footprint(r, differential, rec);
+  return rec.mat_ptr->reflectance(rec);
+}
+
+float_image temporal_accumulator::render(const camera& cam, const hittable& world,
+                                         const std::function<shared_ptr<sampler>()>& make_sampler,
+                                         const std::function<color(int, int, int, sampler&, aov_sample*)>& sample) {
+  std::vector<pixel> current(history.size());
+  float_image image(width, height);
+  std::vector<long> reused_rows(height, 0), sample_rows(height, 0);
+  auto differential = cam.differentials(width, height);
+
+  parallel_for(0, height, [&](int y) {
+    std::mt19937 generator(hash_combine(hash_uint(frames), y));
+    scoped_random_source random(generator);
+    auto s = make_sampler();
+    int j = height-1 - y;
+    for (int i = 0; i < width; i++) {
+      auto& px = current[size_t(y) * width + i];
+      auto u = (i + 0.5) / (width-1), v = (j + 0.5) / (height-1);
+      ray r = cam.get_ray(u, v, 0.5, 0.5, 0.5);
+      hit_record rec;
+      px.hit = world.hit(r, 0.001, infinity, rec);
+
+      double pu, pv;
+      if (px.hit) {
+        px.p = rec.p;
+        px.normal = rec.normal;
+        px.mat = rec.mat_ptr.get();
+        if (has_previous && previous_cam.project(rec.p, pu, pv)
+            && reproject(pu * (width-1) - 0.5, (height-1) - (pv * (height-1) - 0.5),
+                         rec.t * r.direction().length(), px))
+          reused_rows[y]++;
+      }
+
+      // Full renders of a pixel have the albedo of their own first hits.
+      color sum(0,0,0), albedo(0,0,0);
+      int count = px.weight > 0 ? reuse_spp : full_spp;
+      for (int k = 0; k < count; k++) {
+        aov_sample aov;
+        sum += sample(i, j, int(px.next_index) + k, *s, &aov);
+        albedo += aov.albedo;
+      }
+      if (px.weight > 0) {
+        albedo = color(0,0,0);
+        for (int k = 0; k < full_spp; k++)
+          albedo += first_hit_albedo(i, j, k, cam, world, differential, *s);
+        albedo /= full_spp;
+      } else {
+        albedo = px.hit ? albedo / count : color(1,1,1);
+      }
+
+      // Black albedo carries no light to divide out.
+      for (int c = 0; c < 3; c++)
+        px.light[c] = albedo[c] > 1e-3 ? sum[c] / count / albedo[c] : sum[c] / count;
+      px.albedo = albedo;
+      px.count = count;
+      sample_rows[y] += count;
+    }
+  });
+
+  // History is clipped to the range of the new samples around it, mean and
+  // deviation over 3x3 pixels, as in "High Quality Temporal Supersampling"
+  // (Karis 2014). Whatever the tests let through that the view no longer
+  // shows, and fireflies that resampling would spread as the view zooms in,
+  // fall outside it.
+  parallel_for(0, height, [&](int y) {
+    for (int i = 0; i < width; i++) {
+      auto& px = current[size_t(y) * width + i];
+      if (px.weight > 0) {
+        color mean(0,0,0), square(0,0,0);
+        int n = 0;
+        for (int ty = std::max(y-1, 0); ty <= std::min(y+1, height-1); ty++) {
+          for (int tx = std::max(i-1, 0); tx <= std::min(i+1, width-1); tx++) {
+            const auto& l = current[size_t(ty) * width + tx].light;
+            mean += l;
+            square += l * l;
+            n++;
+          }
+        }
+        mean /= n;
+        for (int c = 0; c < 3; c++) {
+          auto deviation = sqrt(std::max(square[c] / n - mean[c] * mean[c], 0.0));
+          px.mean[c] = clamp(px.mean[c], mean[c] - deviation, mean[c] + deviation);
+        }
+      }
+
+      px.mean = (px.mean * px.weight + px.light * px.count) / (px.weight + px.count);
+      px.weight += px.count;
+      px.next_index += px.count;
+
+      color shown;
+      for (int c = 0; c < 3; c++)
+        shown[c] = px.albedo[c] > 1e-3 ? px.mean[c] * px.albedo[c] : px.mean[c];
+      image.set(i, y, shown);
+    }
+  });
+
+  history.swap(current);
+  previous_cam = cam;
+  has_previous = true;
+  frames++;
+  reused = samples = 0;
+  for (int y = 0; y < height; y++) {
+    reused += reused_rows[y];
+    samples += sample_rows[y];
+  }
+  return image;
+}
+
+#endif
@@ -3,13 +3,29 @@
 
 #include "rtweekend.hpp"
 #include "rtw_stb_image.hpp"
+#include "mipmap.hpp"
 #include "perlin.hpp"
 
 #include <iostream>
+#include <map>
+#include <tuple>
+#include <vector>
+
+class texture_code;
 
 class texture {
 public:
   virtual color value(double u, double v, const point3& p) const = 0;
+
+  // value() averaged over footprint, for textures that can prefilter.
+  virtual color filtered_value(double u, double v, const point3& p,
+                               const texture_footprint& footprint) const {
+    return value(u, v, p);
+  }
+
+  // Adds this texture graph to code and returns its entry point. Textures
+  // without a compiled form are called through value().
+  virtual int compile(texture_code& code) const;
 };
 
 class solid_color : public texture {
@@ -24,6 +40,8 @@ public:
     return color_value;
   }
 
+  virtual int compile(texture_code& code) const override;
+
 private:
   color color_value;
 };
@@ -40,13 +58,24 @@ public:
     : even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2)) {}
 
   virtual color value(double u, double v, const point3& p) const override {
-    auto sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
+    auto sines = shading_sin(10*p.x())*shading_sin(10*p.y())*shading_sin(10*p.z());
     if (sines < 0)
       return odd->value(u,v,p);
     else
       return even->value(u,v,p);
   }
 
+  virtual color filtered_value(double u, double v, const point3& p,
+                               const texture_footprint& footprint) const override {
+    auto sines = shading_sin(10*p.x())*shading_sin(10*p.y())*shading_sin(10*p.z());
+    if (sines < 0)
+      return odd->filtered_value(u,v,p,footprint);
+    else
+      return even->filtered_value(u,v,p,footprint);
+  }
+
+  virtual int compile(texture_code& code) const override;
+
 public:
   shared_ptr<texture> odd;
   shared_ptr<texture> even;
@@ -58,65 +87,206 @@ public:
   noise_texture(double sc) : scale(sc) {}
 
   virtual color value(double u, double v, const point3& p) const override {
-    return color(1,1,1) * 0.5 * (1.0 + sin(scale*p.z() + 10 * noise.turbulence(p)));
+    return color(1,1,1) * 0.5 * (1.0 + shading_sin(scale*p.z() + 10 * noise.turbulence(p)));
   }
 
+  virtual int compile(texture_code& code) const override;
+
 public:
   perlin noise;
   double scale;
 };
 
+// An image stored as a mip pyramid. Lookups with a footprint blend the two
+// levels whose texels are closest to its size; lookups without one are
+// bilinear at full resolution.
 class image_texture : public texture {
 public:
   const static int bytes_per_pixel = 3;
 
-  image_texture()
-    : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
+  image_texture() : width(0), height(0) {}
 
-  image_texture(const char* filename) {
+  image_texture(const char* filename, texel_format format = texel_format::rgb8)
+    : width(0), height(0) {
     auto components_per_pixel = bytes_per_pixel;
-
-    data = stbi_load(filename, &width, &height, &components_per_pixel, components_per_pixel);
+    auto data = stbi_load(filename, &width, &height, &components_per_pixel, components_per_pixel);
 
     if (!data) {
       std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
       width = height = 0;
+      return;
     }
 
-    bytes_per_scanline = bytes_per_pixel * width;
+    build(static_cast<const unsigned char*>(data), format);
+    stbi_image_free(data);
   }
 
-  ~image_texture() {
-    delete data;
+  // An image from width * height colors, row by row from the top.
+  image_texture(int w, int h, const std::vector<color>& pixels,
+                texel_format format = texel_format::rgb8)
+    : width(w), height(h) {
+    build(pixels, format);
   }
 
+  // An image already in a pyramid, which may be shared with other textures.
+  image_texture(shared_ptr<const mip_pyramid> p)
+    : width(p->width()), height(p->height()), pyramid(p) {}
+
   virtual color value(double u, double v, const vec3& p) const override {
+    return filtered_value(u, v, p, texture_footprint());
+  }
+
+  virtual color filtered_value(double u, double v, const point3& p,
+                               const texture_footprint& footprint) const override {
     // If we have no texture data, then return solid cyan for debug
-    if (data == nullptr) {
+    if (!pyramid)
       return color(0,1,1);
-    }
 
-    // Clamp input texture coordinates to [0,1] x [1,0]
-    u = clamp(u, 0.0, 1.0);
-    v = 1.0 - clamp(v, 0.0, 1.0); // flip V to image coords
+    // Footprint in texels, the longer of its two axes.
+    auto x = std::hypot(footprint.du_dx * width, footprint.dv_dx * height);
+    auto y = std::hypot(footprint.du_dy * width, footprint.dv_dy * height);
 
-    auto i = static_cast<int>(u * width);
-    auto j = static_cast<int>(v * height);
+    // flip V to image coords
+    return pyramid->lookup(u, 1.0 - v, fmax(x, y));
+  }
 
-    // Clamp integer mapping, since actual coordinates should be less than 1.0
-    if (i >= width) { i = width-1; }
-    if (j >= height) { j = height-1; }
+  virtual int compile(texture_code& code) const override;
 
-    const auto color_scale= 1.0 / 255.0;
-    auto pixel = data + j*bytes_per_scanline + i*bytes_per_pixel;
+  size_t bytes() const { return pyramid ? pyramid->bytes() : 0; }
+  shared_ptr<const mip_pyramid> levels() const { return pyramid; }
 
-    return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
+private:
+  // pixels is a std::vector<color> or the bytes stb_image loaded.
+  template <class pixel_source>
+  void build(const pixel_source& pixels, texel_format format) {
+    if (format == texel_format::rgb32f)
+      pyramid = make_shared<mipmap<rgb32f_texel>>(width, height, pixels);
+    else
+      pyramid = make_shared<mipmap<rgb8_texel>>(width, height, pixels);
   }
 
-private:
-  unsigned char *data;
   int width, height;
-  int bytes_per_scanline;
+  shared_ptr<const mip_pyramid> pyramid;
+};
+
+// The texture graphs of a scene flattened into one array of nodes, so that
+// evaluating a texture walks an array instead of chasing shared_ptrs through
+// virtual calls. Identical nodes are stored once: every solid_color of the
+// same value, and so every checker of the same colors, shares one entry.
+class texture_code {
+public:
+  enum op_code { constant, checker, noise, image, opaque };
+
+  struct node {
+    op_code op;
+    int even, odd;        // checker branches
+    color value;          // constant
+    const texture* data;  // noise, image and opaque textures
+  };
+
+  color value(int entry, double u, double v, const point3& p,
+              const texture_footprint& footprint) const;
+
+  // Returns the index of n, adding it unless an identical node exists.
+  int add(const node& n);
+
+  size_t size() const { return nodes.size(); }
+  const node& operator[](int entry) const { return nodes[entry]; }
+
+private:
+  typedef std::tuple<int, int, int, double, double, double, const texture*> key;
+
+  std::vector<node> nodes;
+  std::map<key, int> index;
+};
+
+int texture_code::add(const node& n) {
+  key k(n.op, n.even, n.odd, n.value.x(), n.value.y(), n.value.z(), n.data);
+  auto found = index.find(k);
+  if (found != index.end())
+    return found->second;
+
+  int entry = nodes.size();
+  nodes.push_back(n);
+  index[k] = entry;
+  return entry;
+}
+
+// Checkers jump to a branch, every other node is a leaf. Noise and image
+// nodes call their texture's value() non-virtually.
+color texture_code::value(int entry, double u, double v, const point3& p,
+                          const texture_footprint& footprint) const {
+  for (;;) {
+    const auto& n = nodes[entry];
+    switch (n.op) {
+    case constant:
+      return n.value;
+    case checker:
+      entry = shading_sin(10*p.x())*shading_sin(10*p.y())*shading_sin(10*p.z()) < 0 ? n.odd : n.even;
+      break;
+    case noise:
+      return static_cast<const noise_texture*>(n.data)->noise_texture::value(u, v, p);
+    case image:
+      return static_cast<const image_texture*>(n.data)->image_texture::filtered_value(u, v, p, footprint);
+    case opaque:
+      return n.data->filtered_value(u, v, p, footprint);
+    }
+  }
+}
+
+int texture::compile(texture_code& code) const {
+  return code.add({ texture_code::opaque, -1, -1, color(0,0,0), this });
+}
+
+int solid_color::compile(texture_code& code) const {
+  return code.add({ texture_code::constant, -1, -1, color_value, nullptr });
+}
+
+int checker_texture::compile(texture_code& code) const {
+  auto e = even->compile(code);
+  auto o = odd->compile(code);
+  return code.add({ texture_code::checker, e, o, color(0,0,0), nullptr });
+}
+
+int noise_texture::compile(texture_code& code) const {
+  return code.add({ texture_code::noise, -1, -1, color(0,0,0), this });
+}
+
+int image_texture::compile(texture_code& code) const {
+  return code.add({ texture_code::image, -1, -1, color(0,0,0), this });
+}
+
+// A texture as materials hold it: the texture graph, and once compile_scene
+// has run, its entry point into the scene's texture_code. Constant textures
+// keep their color here and never touch the code.
+struct texture_ref {
+  texture_ref(shared_ptr<texture> t) : source(t), entry(-1), is_constant(false) {}
+
+  color value(double u, double v, const point3& p,
+              const texture_footprint& footprint = texture_footprint()) const {
+    if (is_constant)
+      return constant;
+    return code ? code->value(entry, u, v, p, footprint)
+                : source->filtered_value(u, v, p, footprint);
+  }
+
+  void compile(const shared_ptr<texture_code>& c) {
+    entry = source->compile(*c);
+    code = c;
+    is_constant = (*c)[entry].op == texture_code::constant;
+    constant = (*c)[entry].value;
+  }
+
+  // Same texture_code entry, so the same texture.
+  bool operator==(const texture_ref& other) const {
+    return code && code == other.code && entry == other.entry;
+  }
+
+  shared_ptr<texture> source;
+  shared_ptr<const texture_code> code;
+  int entry;
+  bool is_constant;
+  color constant;
 };
 
 #endif
@@ -0,0 +1,283 @@
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include "rtweekend.hpp"
+
+#include "paged_texture.hpp"
+#include "texture.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A whole file mapped read-only, unmapped with the last reference to it.
+class mapped_file {
+public:
+  // nullptr if the file cannot be opened or is empty.
+  static shared_ptr<mapped_file> open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return nullptr;
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+      data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      return nullptr;
+    return shared_ptr<mapped_file>(new mapped_file(data, info.st_size));
+  }
+
+  ~mapped_file() { munmap(address, length); }
+
+  const unsigned char* data() const { return static_cast<const unsigned char*>(address); }
+  size_t size() const { return length; }
+
+private:
+  mapped_file(void* a, size_t l) : address(a), length(l) {}
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  void* address;
+  size_t length;
+};
+
+// 64 bit FNV-1a of the contents of the file at path.
+bool hash_file(const std::string& path, std::uint64_t& hash) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+
+  hash = 14695981039346656037ull;
+  char buffer[1 << 16];
+  while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+    for (std::streamsize i = 0; i < in.gcount(); i++) {
+      hash ^= static_cast<unsigned char>(buffer[i]);
+      hash *= 1099511628211ull;
+    }
+  }
+  return true;
+}
+
+// Image textures shared by everything in the process that loads them. Each
+// image is decoded once per content, whatever path it was loaded by, and its
+// mip pyramid kept in a store directory named by the content hash. Later
+// loads, in this run or another, map the stored pyramid instead of decoding,
+// so renders running side by side share its pages. Paged texture files are
+// opened in place by path, their pages read through page_cache::global().
+class texture_cache {
+public:
+  texture_cache(const std::string& directory = "") : store(directory) {}
+
+  // The cache textures in scenes are loaded through.
+  static texture_cache& global() {
+    static texture_cache cache;
+    return cache;
+  }
+
+  // Where pyramids are stored, created if missing; empty keeps them in memory.
+  void set_directory(const std::string& directory) {
+    std::lock_guard<std::mutex> hold(lock);
+    store = directory;
+    if (!store.empty())
+      mkdir(store.c_str(), 0777);
+  }
+
+  // The texture of the image at path. Unreadable images give an empty
+  // texture, which is solid cyan.
+  shared_ptr<image_texture> load(const std::string& path,
+                                 texel_format format = texel_format::rgb8);
+
+  // The store file for an image with these contents.
+  std::string store_path(std::uint64_t hash, texel_format format) const {
+    std::ostringstream name;
+    name << store << '/' << std::hex << std::setw(16) << std::setfill('0') << hash
+         << (format == texel_format::rgb32f ? ".f32" : ".rgb8") << ".mip";
+    return name.str();
+  }
+
+  struct statistics {
+    size_t textures = 0;
+    size_t bytes = 0;      // of all pyramids, mapped or not
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t decoded = 0;
+    size_t mapped = 0;     // misses found in the store
+    size_t paged = 0;      // read through the page cache, not in bytes
+  };
+
+  statistics stats() const;
+
+  // Prints stats() and a line for each texture.
+  void report(std::ostream& out) const;
+
+private:
+  enum origin { decoded, mapped, missing, paged };
+
+  struct entry {
+    std::string path;   // the first one it was loaded by
+    shared_ptr<image_texture> texture;
+    origin from;
+    size_t uses;
+  };
+
+  typedef std::pair<std::uint64_t, int> key;
+
+  shared_ptr<image_texture> from_store(std::uint64_t hash, texel_format format) const;
+  void save(std::uint64_t hash, texel_format format, const mip_pyramid& pyramid) const;
+
+  std::string store;
+  std::map<std::string, std::uint64_t> hashes;   // by path
+  std::map<std::string, entry> paged_entries;    // by path
+  std::map<key, entry> entries;
+  size_t hits = 0, misses = 0;
+  mutable std::mutex lock;
+};
+
+shared_ptr<image_texture> texture_cache::load(const std::string& path, texel_format format) {
+  std::lock_guard<std::mutex> hold(lock);
+
+  // Paged files can be far too large to hash, and are the stored form.
+  auto paged_found = paged_entries.find(path);
+  if (paged_found != paged_entries.end()) {
+    hits++;
+    paged_found->second.uses++;
+    return paged_found->second.texture;
+  }
+  if (is_paged_texture(path)) {
+    if (auto pyramid = open_paged_texture(path)) {
+      misses++;
+      entry e;
+      e.path = path;
+      e.uses = 1;
+      e.from = paged;
+      e.texture = make_shared<image_texture>(pyramid);
+      return paged_entries.emplace(path, e).first->second.texture;
+    }
+  }
+
+  auto known = hashes.find(path);
+  if (known == hashes.end()) {
+    std::uint64_t hash;
+    if (!hash_file(path, hash)) {
+      std::cerr << "ERROR: Could not load texture image file '" << path << "'.\n";
+      misses++;
+      return make_shared<image_texture>();
+    }
+    known = hashes.emplace(path, hash).first;
+  }
+
+  key k(known->second, int(format));
+  auto found = entries.find(k);
+  if (found != entries.end()) {
+    hits++;
+    found->second.uses++;
+    return found->second.texture;
+  }
+
+  misses++;
+  entry e;
+  e.path = path;
+  e.uses = 1;
+  e.from = mapped;
+  if (!store.empty())
+    e.texture = from_store(k.first, format);
+
+  if (!e.texture) {
+    e.texture = make_shared<image_texture>(path.c_str(), format);
+    e.from = e.texture->levels() ? decoded : missing;
+
+    // Use the stored copy, so its pages are shared.
+    if (e.from == decoded && !store.empty()) {
+      save(k.first, format, *e.texture->levels());
+      if (auto stored = from_store(k.first, format))
+        e.texture = stored;
+    }
+  }
+
+  entries.emplace(k, e);
+  return e.texture;
+}
+
+shared_ptr<image_texture> texture_cache::from_store(std::uint64_t hash, texel_format format) const {
+  auto file = mapped_file::open(store_path(hash, format));
+  if (!file)
+    return nullptr;
+  auto pyramid = map_pyramid(file->data(), file->size(), file);
+  return pyramid ? make_shared<image_texture>(pyramid) : nullptr;
+}
+
+// Writes beside the final name and renames, so other processes never map a
+// partial file.
+void texture_cache::save(std::uint64_t hash, texel_format format, const mip_pyramid& pyramid) const {
+  auto path = store_path(hash, format);
+  auto partial = path + "." + std::to_string(getpid());
+  {
+    std::ofstream out(partial, std::ios::binary);
+    if (out && pyramid.write(out) && out.flush()) {
+      out.close();
+      if (std::rename(partial.c_str(), path.c_str()) == 0)
+        return;
+    }
+  }
+  std::remove(partial.c_str());
+}
+
+texture_cache::statistics texture_cache::stats() const {
+  std::lock_guard<std::mutex> hold(lock);
+  statistics s;
+  s.textures = entries.size() + paged_entries.size();
+  s.hits = hits;
+  s.misses = misses;
+  for (const auto& e : entries) {
+    s.bytes += e.second.texture->bytes();
+    s.decoded += e.second.from == decoded;
+    s.mapped += e.second.from == mapped;
+  }
+  s.paged = paged_entries.size();
+  return s;
+}
+
+void texture_cache::report(std::ostream& out) const {
+  auto s = stats();
+  out << "Texture cache: " << s.textures << " textures, " << s.bytes / 1048576.0 << " MiB, "
+      << s.hits << " hits, " << s.misses << " misses (" << s.decoded << " decoded, "
+      << s.mapped << " mapped, " << s.paged << " paged).\n";
+  if (s.paged > 0) {
+    auto p = page_cache::global().stats();
+    out << "Page cache: " << p.resident / 1048576.0 << " of " << p.budget / 1048576.0
+        << " MiB resident, peak " << p.peak_resident / 1048576.0 << " MiB, " << p.hits
+        << " hits, " << p.misses << " misses, " << p.evictions << " evictions.\n";
+  }
+
+  std::lock_guard<std::mutex> hold(lock);
+  const char* origins[] = { "decoded", "mapped", "missing", "paged" };
+  auto print = [&](const entry& e) {
+    auto levels = e.texture->levels();
+    out << "  " << e.path << ": ";
+    if (levels)
+      out << levels->width() << "x" << levels->height() << ", ";
+    if (e.from != paged)
+      out << e.texture->bytes() / 1048576.0 << " MiB, ";
+    out << origins[e.from] << ", " << e.uses << " uses\n";
+  };
+  for (const auto& e : entries)
+    print(e.second);
+  for (const auto& e : paged_entries)
+    print(e.second);
+}
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef TILED_IMAGE_HPP
+#define TILED_IMAGE_HPP
+
+#include "rtweekend.hpp"
+
+#include "image_output.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// How an image is cut into square tiles, numbered row by row from the top
+// left. Tiles on the right and bottom edges are cropped to the image.
+struct tile_layout {
+  tile_layout() : width(0), height(0), size(1) {}
+  tile_layout(int w, int h, int s) : width(w), height(h), size(s) {}
+
+  int tiles_x() const { return (width + size - 1) / size; }
+  int tiles_y() const { return (height + size - 1) / size; }
+  int count() const { return tiles_x() * tiles_y(); }
+
+  int x0(int tile) const { return tile % tiles_x() * size; }
+  int y0(int tile) const { return tile / tiles_x() * size; }
+  int tile_width(int tile) const { return std::min(size, width - x0(tile)); }
+  int tile_height(int tile) const { return std::min(size, height - y0(tile)); }
+
+  int width, height, size;
+};
+
+// A tile file is this header, an index of the file offset of every tile, 0
+// until it is written, then the tiles in whatever order they finished: the
+// float RGB of each, rows from the top. The index is written after its tile,
+// so any tile it names is whole.
+struct tiled_header {
+  char magic[8];
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t tile_size;
+  std::uint32_t reserved;
+};
+
+const char tiled_magic[8] = { 'R', 'T', 'T', 'I', 'L', 'E', '1', 0 };
+
+inline bool write_fully(int fd, const void* data, size_t bytes, std::uint64_t offset) {
+  size_t done = 0;
+  while (done < bytes) {
+    auto n = pwrite(fd, static_cast<const char*>(data) + done, bytes - done, offset + done);
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+inline bool read_fully(int fd, void* data, size_t bytes, std::uint64_t offset) {
+  size_t done = 0;
+  while (done < bytes) {
+    auto n = pread(fd, static_cast<char*>(data) + done, bytes - done, offset + done);
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+// Streams finished tiles to a tile file. Tiles can be written from any
+// thread in any order, and nothing but the index is kept in memory, so a
+// render of any size holds only the tiles it is working on.
+class tiled_image_writer {
+public:
+  tiled_image_writer() : fd(-1), end(0), failed(false) {}
+  ~tiled_image_writer() { close(); }
+
+  tiled_image_writer(const tiled_image_writer&) = delete;
+  tiled_image_writer& operator=(const tiled_image_writer&) = delete;
+
+  // Creates or truncates path for an image of this layout.
+  bool open(const std::string& path, const tile_layout& l) {
+    close();
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+      return false;
+
+    layout = l;
+    failed = false;
+    tiled_header header;
+    std::copy(tiled_magic, tiled_magic + sizeof(tiled_magic), header.magic);
+    header.width = layout.width;
+    header.height = layout.height;
+    header.tile_size = layout.size;
+    header.reserved = 0;
+
+    std::vector<std::uint64_t> index(layout.count(), 0);
+    end = sizeof(header) + index.size() * sizeof(std::uint64_t);
+    return write_fully(fd, &header, sizeof(header), 0)
+      && write_fully(fd, index.data(), index.size() * sizeof(std::uint64_t), sizeof(header));
+  }
+
+  // Writes tile number tile from the tile_width * tile_height pixels of rgb.
+  bool write_tile(int tile, const float* rgb) {
+    auto bytes = size_t(layout.tile_width(tile)) * layout.tile_height(tile) * 3 * sizeof(float);
+    std::uint64_t offset;
+    {
+      std::lock_guard<std::mutex> hold(lock);
+      offset = end;
+      end += bytes;
+    }
+
+    bool written = write_fully(fd, rgb, bytes, offset)
+      && write_fully(fd, &offset, sizeof(offset), sizeof(tiled_header) + tile * sizeof(offset));
+    if (!written) {
+      std::lock_guard<std::mutex> hold(lock);
+      failed = true;
+    }
+    return written;
+  }
+
+  // False if the file could not be opened or any tile written.
+  bool close() {
+    bool ok = fd >= 0 && !failed;
+    if (fd >= 0)
+      ::close(fd);
+    fd = -1;
+    return ok;
+  }
+
+  const tile_layout& tiles() const { return layout; }
+
+private:
+  int fd;
+  tile_layout layout;
+  std::uint64_t end;
+  bool failed;
+  std::mutex lock;
+};
+
+class tiled_image_reader {
+public:
+  tiled_image_reader() : fd(-1) {}
+  ~tiled_image_reader() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  tiled_image_reader(const tiled_image_reader&) = delete;
+  tiled_image_reader& operator=(const tiled_image_reader&) = delete;
+
+  // False if path is not a tile file.
+  bool open(const std::string& path) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    tiled_header header;
+    if (!read_fully(fd, &header, sizeof(header), 0)
+        || !std::equal(tiled_magic, tiled_magic + sizeof(tiled_magic), header.magic)
+        || header.width == 0 || header.height == 0 || header.tile_size == 0)
+      return false;
+
+    layout = tile_layout(header.width, header.height, header.tile_size);
+    index.resize(layout.count());
+    return read_fully(fd, index.data(), index.size() * sizeof(std::uint64_t), sizeof(header));
+  }
+
+  const tile_layout& tiles() const { return layout; }
+
+  bool has_tile(int tile) const { return index[tile] != 0; }
+
+  int missing_tiles() const {
+    return int(std::count(index.begin(), index.end(), std::uint64_t(0)));
+  }
+
+  // Reads tile_width * tile_height pixels of a written tile into rgb.
+  bool read_tile(int tile, float* rgb) const {
+    auto bytes = size_t(layout.tile_width(tile)) * layout.tile_height(tile) * 3 * sizeof(float);
+    return has_tile(tile) && read_fully(fd, rgb, bytes, index[tile]);
+  }
+
+private:
+  int fd;
+  tile_layout layout;
+  std::vector<std::uint64_t> index;
+};
+
+// Renders the tiles of writer's layout on all threads, render_tile(tile,
+// rgb) filling the pixels of one, and streams each out as it finishes. Every
+// tile draws its random numbers from a generator seeded by its index, so the
+// image does not depend on which thread took which tile.
+bool render_tiled(tiled_image_writer& writer,
+                  const std::function<void(int, float*)>& render_tile) {
+  const auto& layout = writer.tiles();
+  std::atomic<int> remaining(layout.count());
+  std::atomic<bool> ok(true);
+  std::mutex progress;
+
+  parallel_for(0, layout.count(), [&](int tile) {
+    std::vector<float> rgb(size_t(layout.tile_width(tile)) * layout.tile_height(tile) * 3);
+    std::mt19937 generator(tile);
+    scoped_random_source random(generator);
+    render_tile(tile, rgb.data());
+    if (!writer.write_tile(tile, rgb.data()))
+      ok = false;
+
+    std::lock_guard<std::mutex> hold(progress);
+    std::cerr << "\rTiles remaining: " << --remaining << ' ' << std::flush;
+  });
+  std::cerr << '\n';
+  return ok;
+}
+
+// Writes the image in a tile file to path, or standard output for "" or
+// "-", in one pass over it. Only one row of tiles is in memory at a time, so
+// memory grows with the width of the image but not its height. png is not
+// supported, as it would need the whole image.
+bool assemble_tiled_image(const std::string& tiles, image_format format, const std::string& path) {
+  tiled_image_reader reader;
+  if (!reader.open(tiles)) {
+    std::cerr << "ERROR: Could not read tile file '" << tiles << "'.\n";
+    return false;
+  }
+  if (format == image_format::png) {
+    std::cerr << "ERROR: Tiled images cannot be assembled as png.\n";
+    return false;
+  }
+  if (auto missing = reader.missing_tiles()) {
+    std::cerr << "ERROR: Tile file '" << tiles << "' is missing " << missing << " of "
+              << reader.tiles().count() << " tiles.\n";
+    return false;
+  }
+
+  std::ofstream file;
+  bool to_stdout = path.empty() || path == "-";
+  if (!to_stdout)
+    file.open(path, std::ios::binary);
+  std::ostream& out = to_stdout ? std::cout : file;
+
+  const auto& layout = reader.tiles();
+  scanline_encoder encoder(out, format, layout.width, layout.height);
+  auto bottom_up = scanline_encoder::from_bottom(format);
+
+  std::vector<float> band(size_t(layout.width) * layout.size * 3), tile(size_t(layout.size) * layout.size * 3);
+  bool ok = bool(out);
+  for (int b = 0; b < layout.tiles_y() && ok; b++) {
+    auto row = bottom_up ? layout.tiles_y() - 1 - b : b;
+    auto first = row * layout.tiles_x();
+    auto rows = layout.tile_height(first);
+
+    for (int t = first; t < first + layout.tiles_x() && ok; t++) {
+      ok = reader.read_tile(t, tile.data());
+      auto w = layout.tile_width(t);
+      for (int y = 0; y < rows; y++)
+        std::copy(&tile[size_t(y) * w * 3], &tile[size_t(y + 1) * w * 3],
+                  &band[(size_t(y) * layout.width + layout.x0(t)) * 3]);
+    }
+
+    for (int y = 0; y < rows && ok; y++) {
+      auto r = bottom_up ? rows - 1 - y : y;
+      ok = encoder.write_row(&band[size_t(r) * layout.width * 3]);
+    }
+  }
+  ok = ok && out.flush();
+
+  if (!ok) {
+    std::cerr << "ERROR: Could not assemble '" << tiles << "' into '"
+              << (to_stdout ? "-" : path) << "'.\n";
+    if (!to_stdout) {
+      file.close();
+      std::remove(path.c_str());
+    }
+  }
+  return ok;
+}
+
+#endif
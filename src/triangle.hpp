@@ -15,20 +15,30 @@ public:
 
   virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const override;
   virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+  virtual bool occluded(const ray& r, double tmin, double tmax) const override {
+    double t;
+    vec3 N;
+    return intersect(r, tmin, tmax, t, N);
+  }
+
+  virtual void material_slots(std::vector<shared_ptr<material>*>& slots) override {
+    slots.push_back(&mat_ptr);
+  }
 
   point3 a,b,c;
   shared_ptr<material> mat_ptr;
+
+private:
+  bool intersect(const ray& r, double t_min, double t_max, double& t, vec3& N) const;
 };
 
 // ref: https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/ray-triangle-intersection-geometric-solution
-bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-
-
+bool triangle::intersect(const ray& r, double t_min, double t_max, double& t, vec3& N) const {
   // compute plane's normal
   vec3 ab = b - a;
   vec3 ac = c - a;
 
-  vec3 N = cross(ab,ac);
+  N = cross(ab,ac);
   //float area2 = N.length();
 
   // find P
@@ -38,12 +48,13 @@ bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 
   float d = -dot(N, a);
   // handle if t is in t_min/t_max or is that a different t?
-  float t = -(dot(N, r.origin()) + d) / NdotRayDirection;
+  float ft = -(dot(N, r.origin()) + d) / NdotRayDirection;
   // check if the triangle is behind the ray or outside of t_min/t_max
   // used to have t < 0;
-  if (t < t_min || t > t_max) return false;
+  if (ft < t_min || ft > t_max) return false;
 
   // compute intersection point
+  t = ft;
   point3 P = r.at(t);
 
   // inside-outside test
@@ -68,6 +79,15 @@ bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 
   if (dot(N,C) < 0) return false;
 
+  return true;
+}
+
+bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+  double t;
+  vec3 N;
+  if (!intersect(r, t_min, t_max, t, N))
+    return false;
+
   // TODO: fix for coordinate mapping
   // flatten out triangle, pick a corner as origin, and then calculate u,v as
   // something related to the magnitude of the distance between the intersection
@@ -85,11 +105,12 @@ bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
   // https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/geometry-of-a-triangle
   rec.u = 0.5;
   rec.v = 0.5;
+  rec.dpdu = rec.dpdv = vec3(0,0,0);
   rec.t = t;
   auto outward_normal = N; // TODO: is this right?
   rec.set_face_normal(r, outward_normal);
   rec.mat_ptr = mat_ptr;
-  rec.p = P;
+  rec.p = r.at(t);
 
   return true;
 }
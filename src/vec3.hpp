@@ -4,6 +4,8 @@
 #include <cmath>
 #include <iostream>
 
+#include "fast_math.hpp"
+
 using std::sqrt;
 
 class vec3 {
@@ -104,30 +106,55 @@ inline vec3 cross(const vec3 &u, const vec3 &v) {
 }
 
 inline vec3 unit_vector(vec3 v) {
+  // One division instead of three.
+  if (shading_math == math_mode::fast)
+    return (1 / v.length()) * v;
   return v / v.length();
 }
 
-vec3 random_in_unit_sphere() {
-  while(true) {
-    auto p = vec3::random(-1, 1);
-    if(p.length_squared() >= 1) continue;
-    return p;
+// Closed form warps from uniform numbers in [0,1), so stratified and
+// low-discrepancy samples keep their distribution instead of being consumed
+// by rejection loops.
+
+// Shirley and Chiu's concentric mapping of the square onto the unit disk.
+inline vec3 concentric_disk(double u1, double u2) {
+  auto a = 2*u1 - 1;
+  auto b = 2*u2 - 1;
+  if (a == 0 && b == 0)
+    return vec3(0, 0, 0);
+
+  double r, theta;
+  if (fabs(a) > fabs(b)) {
+    r = a;
+    theta = (pi/4) * (b/a);
+  } else {
+    r = b;
+    theta = (pi/2) - (pi/4) * (a/b);
   }
+  double s, c;
+  shading_sincos(theta, s, c);
+  return vec3(r*c, r*s, 0);
 }
 
-vec3 random_in_unit_disk() {
-  while(true) {
-    auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-    if (p.length_squared() >= 1) continue;
-    return p;
-  }
+inline vec3 uniform_sphere(double u1, double u2) {
+  auto a = 2*pi*u1;
+  auto z = 1 - 2*u2;
+  auto r = sqrt(fmax(0.0, 1 - z*z));
+  double s, c;
+  shading_sincos(a, s, c);
+  return vec3(r*c, r*s, z);
 }
 
 vec3 random_unit_vector() {
-  auto a = random_double(0,2*pi);
-  auto z = random_double(-1,1);
-  auto r = sqrt(1 - z*z);
-  return vec3(r*cos(a), r*sin(a), z);
+  return uniform_sphere(random_double(), random_double());
+}
+
+vec3 random_in_unit_sphere() {
+  return cbrt(random_double()) * random_unit_vector();
+}
+
+vec3 random_in_unit_disk() {
+  return concentric_disk(random_double(), random_double());
 }
 
 vec3 random_in_hemisphere(const vec3& normal) {